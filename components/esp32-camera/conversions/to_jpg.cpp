@@ -153,7 +153,7 @@ public:
         index += ocb(oarg, index, data, len);
         return true;
     }
-    virtual size_t get_size() const
+    virtual uint get_size() const
     {
         return index;
     }
@@ -199,7 +199,7 @@ public:
         return true;
     }
 
-    virtual size_t get_size() const
+    virtual uint get_size() const
     {
         return index;
     }
@@ -15,9 +15,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdalign.h>
+#include <stddef.h>
 #include "esp_heap_caps.h"
 #include "ll_cam.h"
 #include "cam_hal.h"
+#include "cam_trace.h"
 
 #if (ESP_IDF_VERSION_MAJOR == 3) && (ESP_IDF_VERSION_MINOR == 3)
 #include "rom/ets_sys.h"
@@ -45,16 +47,14 @@ static cam_obj_t *cam_obj = NULL;
 static const uint32_t JPEG_SOI_MARKER = 0xFFD8FF;  // written in little-endian for esp32
 static const uint16_t JPEG_EOI_MARKER = 0xD9FF;  // written in little-endian for esp32
 
-static int cam_verify_jpeg_soi(const uint8_t *inbuf, uint32_t length)
+static bool cam_verify_jpeg_soi(const uint8_t *inbuf, uint32_t length)
 {
-    for (uint32_t i = 0; i < length; i++) {
-        if (memcmp(&inbuf[i], &JPEG_SOI_MARKER, 3) == 0) {
-            //ESP_LOGW(TAG, "SOI: %d", (int) i);
-            return i;
-        }
+    // A frame not starting with SOI is dropped anyway, no need to search for it
+    if (length >= 3 && memcmp(inbuf, &JPEG_SOI_MARKER, 3) == 0) {
+        return true;
     }
     ESP_LOGW(TAG, "NO-SOI");
-    return -1;
+    return false;
 }
 
 static int cam_verify_jpeg_eoi(const uint8_t *inbuf, uint32_t length)
@@ -72,6 +72,47 @@ static int cam_verify_jpeg_eoi(const uint8_t *inbuf, uint32_t length)
     return -1;
 }
 
+// Record the offsets of the JPEG header segments received so far.
+// Only segment lengths are followed, the data itself is never scanned,
+// and indexing resumes where it stopped when the next DMA chunk arrives.
+static void cam_index_jpeg_header(cam_frame_t *frame)
+{
+    camera_fb_t *fb = &frame->fb;
+    camera_jpeg_index_t *idx = &fb->jpeg;
+    uint32_t pos = frame->jpeg_pos;
+
+    while (!idx->sos && pos + 4 <= fb->len) {
+        const uint8_t *p = &fb->buf[pos];
+        if (p[0] != 0xFF) {
+            frame->jpeg_pos = UINT32_MAX - 4; // corrupt header, stop indexing this frame
+            return;
+        }
+        if (p[1] == 0xD8 || p[1] == 0xFF) { // SOI or fill byte
+            pos += (p[1] == 0xD8) ? 2 : 1;
+            continue;
+        }
+        switch (p[1]) {
+            case 0xDB: if (!idx->dqt) idx->dqt = pos; break;
+            case 0xC4: if (!idx->dht) idx->dht = pos; break;
+            case 0xDD: idx->dri = pos; break;
+            case 0xDA: idx->sos = pos; break;
+            case 0xC0:
+                if (pos + 12 > fb->len) {
+                    frame->jpeg_pos = pos; // wait for the component table
+                    return;
+                }
+                idx->sof = pos;
+                idx->height = (p[5] << 8) | p[6];
+                idx->width = (p[7] << 8) | p[8];
+                idx->sampling = p[11];
+                break;
+            default: break;
+        }
+        pos += 2 + ((p[2] << 8) | p[3]);
+    }
+    frame->jpeg_pos = pos;
+}
+
 static bool cam_get_next_frame(int * frame_pos)
 {
     if(!cam_obj->frames[*frame_pos].en){
@@ -96,6 +137,9 @@ static bool cam_start_frame(int * frame_pos)
             uint64_t us = (uint64_t)esp_timer_get_time();
             cam_obj->frames[*frame_pos].fb.timestamp.tv_sec = us / 1000000UL;
             cam_obj->frames[*frame_pos].fb.timestamp.tv_usec = us % 1000000UL;
+            memset(&cam_obj->frames[*frame_pos].fb.jpeg, 0, sizeof(camera_jpeg_index_t));
+            cam_obj->frames[*frame_pos].jpeg_pos = 0;
+            CAM_TRACE(CAM_TRACE_VSYNC, &cam_obj->frames[*frame_pos].fb);
             return true;
         }
     }
@@ -156,9 +200,12 @@ static void cam_task(void *arg)
                             cam_obj->dma_half_buffer_size);
                     }
                     //Check for JPEG SOI in the first buffer. stop if not found
-                    if (cam_obj->jpeg_mode && cnt == 0 && cam_verify_jpeg_soi(frame_buffer_event->buf, frame_buffer_event->len) != 0) {
+                    if (cam_obj->jpeg_mode && cnt == 0 && !cam_verify_jpeg_soi(frame_buffer_event->buf, frame_buffer_event->len)) {
                         ll_cam_stop(cam_obj);
                         cam_obj->state = CAM_STATE_IDLE;
+                    } else if (cam_obj->jpeg_mode && !cam_obj->psram_mode) {
+                        //index the header while it is still hot in cache
+                        cam_index_jpeg_header(&cam_obj->frames[frame_pos]);
                     }
                     cnt++;
 
@@ -197,6 +244,9 @@ static void cam_task(void *arg)
                             }
                         }
                         //send frame
+                        if (!cam_obj->frames[frame_pos].en) {
+                            CAM_TRACE(CAM_TRACE_DMA_DONE, frame_buffer_event);
+                        }
                         if(!cam_obj->frames[frame_pos].en && xQueueSend(cam_obj->frame_buffer_queue, (void *)&frame_buffer_event, 0) != pdTRUE) {
                             //pop frame buffer from the queue
                             camera_fb_t * fb2 = NULL;
@@ -423,6 +473,25 @@ err:
     return ESP_FAIL;
 }
 
+esp_err_t cam_check_frame_size(framesize_t frame_size)
+{
+    if (!cam_obj) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    size_t pixels = (size_t)resolution[frame_size].width * resolution[frame_size].height;
+    if (cam_obj->jpeg_mode) {
+        // The same estimate cam_config() sized the buffers with
+#ifdef CONFIG_CAMERA_JPEG_MODE_FRAME_SIZE_AUTO
+        size_t need = pixels / 5;
+#else
+        size_t need = CONFIG_CAMERA_JPEG_MODE_FRAME_SIZE;
+#endif
+        return need <= cam_obj->fb_size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+    }
+    // Raw frames must fill the buffer exactly, and the DMA copies are counted for it
+    return pixels * cam_obj->fb_bytes_per_pixel == cam_obj->fb_size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
 esp_err_t cam_deinit(void)
 {
     if (!cam_obj) {
@@ -490,12 +559,21 @@ camera_fb_t *cam_take(TickType_t timeout)
     }
 #endif
     if (dma_buffer) {
+        CAM_TRACE(CAM_TRACE_TAKE, dma_buffer);
         if(cam_obj->jpeg_mode){
             // find the end marker for JPEG. Data after that can be discarded
+            CAM_TRACE(CAM_TRACE_EOI_BEGIN, dma_buffer);
             int offset_e = cam_verify_jpeg_eoi(dma_buffer->buf, dma_buffer->len);
+            CAM_TRACE(CAM_TRACE_EOI_END, dma_buffer);
             if (offset_e >= 0) {
                 // adjust buffer length
                 dma_buffer->len = offset_e + sizeof(JPEG_EOI_MARKER);
+                // in PSRAM mode DMA wrote the header directly, index it now
+                cam_frame_t *frame = (cam_frame_t *)((uint8_t *)dma_buffer - offsetof(cam_frame_t, fb));
+                cam_index_jpeg_header(frame);
+                camera_jpeg_index_t *idx = &dma_buffer->jpeg;
+                idx->eoi = offset_e;
+                idx->valid = idx->dqt && idx->sof && idx->sos && idx->sos < idx->eoi;
                 return dma_buffer;
             } else {
                 ESP_LOGW(TAG, "NO-EOI");
@@ -522,6 +600,7 @@ camera_fb_t *cam_take(TickType_t timeout)
 
 void cam_give(camera_fb_t *dma_buffer)
 {
+    CAM_TRACE(CAM_TRACE_FB_RETURN, dma_buffer);
     for (int x = 0; x < cam_obj->frame_cnt; x++) {
         if (&cam_obj->frames[x].fb == dma_buffer) {
             cam_obj->frames[x].en = 1;
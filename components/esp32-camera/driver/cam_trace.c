@@ -0,0 +1,236 @@
+// Lock-free ring of frame stage events, exported as Chrome trace JSON
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "cam_trace.h"
+
+#if CONFIG_CAMERA_TRACE
+
+#define TRACE_ENTRIES      CONFIG_CAMERA_TRACE_ENTRIES
+#define TRACE_MASK         (TRACE_ENTRIES - 1)
+// Each core pairs its cycle counter with esp_timer this often, well inside
+// the time the 32-bit counter takes to wrap
+#define TRACE_SYNC_US      1000000
+#define TRACE_MAX_BUFFERS  16
+#define TRACE_LINE_SIZE    192
+
+_Static_assert((TRACE_ENTRIES & TRACE_MASK) == 0, "CONFIG_CAMERA_TRACE_ENTRIES must be a power of two");
+
+typedef struct {
+    uint32_t cycles;
+    uint32_t arg;        // frame, or esp_timer time for CAM_TRACE_SYNC
+    uint8_t event;
+    uint8_t core;
+} trace_entry_t;
+
+static trace_entry_t ring[TRACE_ENTRIES];
+static atomic_uint head;     // events recorded so far; the next goes to head & TRACE_MASK
+static atomic_bool paused;
+// Written only by the core they belong to
+static uint32_t last_sync[portNUM_PROCESSORS];
+static bool synced[portNUM_PROCESSORS];
+
+static const char *const event_names[CAM_TRACE_EVENT_MAX] = {
+    [CAM_TRACE_SYNC] = "sync",
+    [CAM_TRACE_VSYNC] = "vsync",
+    [CAM_TRACE_DMA_DONE] = "dma_done",
+    [CAM_TRACE_TAKE] = "cam_take",
+    [CAM_TRACE_EOI_BEGIN] = "eoi_search",
+    [CAM_TRACE_EOI_END] = "eoi_search",
+    [CAM_TRACE_TX_DEQUEUE] = "tx_dequeue",
+    [CAM_TRACE_FIRST_PACKET] = "first_packet",
+    [CAM_TRACE_LAST_PACKET] = "last_packet",
+    [CAM_TRACE_FB_RETURN] = "fb_return",
+};
+
+static inline void trace_put(uint8_t event, uint8_t core, uint32_t cycles, uint32_t arg)
+{
+    unsigned slot = atomic_fetch_add_explicit(&head, 1, memory_order_relaxed) & TRACE_MASK;
+    trace_entry_t *e = &ring[slot];
+    e->cycles = cycles;
+    e->arg = arg;
+    e->event = event;
+    e->core = core;
+}
+
+void cam_trace_record(cam_trace_event_t event, uint32_t frame)
+{
+    if (atomic_load_explicit(&paused, memory_order_relaxed)) {
+        return;
+    }
+    // Core and counter must match; retry if the task moved in between
+    uint32_t core, cycles;
+    do {
+        core = esp_cpu_get_core_id();
+        cycles = esp_cpu_get_cycle_count();
+    } while (core != (uint32_t)esp_cpu_get_core_id());
+
+    // The cores' counters are not aligned to each other: every core's
+    // events are placed on the esp_timer timeline by its own sync points
+    if (!synced[core] || cycles - last_sync[core] > TRACE_SYNC_US * esp_rom_get_cpu_ticks_per_us()) {
+        uint32_t now_us = (uint32_t)esp_timer_get_time();
+        uint32_t sync_cycles = esp_cpu_get_cycle_count();
+        trace_put(CAM_TRACE_SYNC, core, sync_cycles, now_us);
+        last_sync[core] = sync_cycles;
+        synced[core] = true;
+    }
+    trace_put(event, core, cycles, frame);
+}
+
+void cam_trace_clear(void)
+{
+    atomic_store(&paused, true);
+    atomic_store(&head, 0);
+    memset(ring, 0, sizeof(ring));
+    memset(synced, 0, sizeof(synced));
+    atomic_store(&paused, false);
+}
+
+typedef struct {
+    cam_trace_write_t write;
+    void *ctx;
+    bool failed;
+    bool first;
+} trace_out_t;
+
+static void trace_emit(trace_out_t *out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void trace_emit(trace_out_t *out, const char *fmt, ...)
+{
+    if (out->failed) {
+        return;
+    }
+    char line[TRACE_LINE_SIZE];
+    int n = out->first ? 0 : snprintf(line, sizeof(line), ",\n");
+    va_list args;
+    va_start(args, fmt);
+    n += vsnprintf(line + n, sizeof(line) - n, fmt, args);
+    va_end(args);
+    if (n >= (int)sizeof(line)) {
+        n = sizeof(line) - 1;
+    }
+    out->first = false;
+    out->failed = out->write(out->ctx, line, n) != 0;
+}
+
+// Small stable number for a frame buffer, instead of its address
+static int trace_buffer_index(uint32_t *buffers, int *count, uint32_t frame)
+{
+    for (int i = 0; i < *count; i++) {
+        if (buffers[i] == frame) {
+            return i;
+        }
+    }
+    if (*count == TRACE_MAX_BUFFERS) {
+        return -1;
+    }
+    buffers[*count] = frame;
+    return (*count)++;
+}
+
+esp_err_t cam_trace_export(cam_trace_write_t write, void *ctx)
+{
+    atomic_store(&paused, true);
+    unsigned end = atomic_load(&head);
+    unsigned count = end < TRACE_ENTRIES ? end : TRACE_ENTRIES;
+    unsigned start = end - count;
+    double ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+
+    // Events older than a core's first remaining sync point are placed by it
+    int sync_idx[portNUM_PROCESSORS];
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+        sync_idx[c] = -1;
+    }
+    for (unsigned i = start; i != end; i++) {
+        const trace_entry_t *e = &ring[i & TRACE_MASK];
+        if (e->event == CAM_TRACE_SYNC && e->core < portNUM_PROCESSORS && sync_idx[e->core] < 0) {
+            sync_idx[e->core] = i & TRACE_MASK;
+        }
+    }
+    // Times are relative to the oldest sync point
+    uint32_t ref_us = 0;
+    for (unsigned i = start; i != end; i++) {
+        const trace_entry_t *e = &ring[i & TRACE_MASK];
+        if (e->event == CAM_TRACE_SYNC) {
+            ref_us = e->arg;
+            break;
+        }
+    }
+
+    trace_out_t out = { .write = write, .ctx = ctx, .first = true };
+    out.failed = write(ctx, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", 40) != 0;
+    trace_emit(&out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"camera\"}}");
+    for (int c = 0; c < portNUM_PROCESSORS; c++) {
+        trace_emit(&out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                   "\"args\":{\"name\":\"core %d\"}}", c, c);
+    }
+
+    uint32_t buffers[TRACE_MAX_BUFFERS];
+    int buffer_count = 0;
+    uint32_t span_id[TRACE_MAX_BUFFERS] = {0};  // open frame span per buffer, 0 = none
+    uint32_t next_span = 1;
+
+    for (unsigned i = start; i != end && !out.failed; i++) {
+        const trace_entry_t *e = &ring[i & TRACE_MASK];
+        if (e->core >= portNUM_PROCESSORS || e->event >= CAM_TRACE_EVENT_MAX) {
+            continue;  // torn by a record that raced the pause
+        }
+        if (e->event == CAM_TRACE_SYNC) {
+            sync_idx[e->core] = i & TRACE_MASK;
+            continue;
+        }
+        if (sync_idx[e->core] < 0) {
+            continue;
+        }
+        const trace_entry_t *sync = &ring[sync_idx[e->core]];
+        double ts = (int32_t)(sync->arg - ref_us) + (int32_t)(e->cycles - sync->cycles) / ticks_per_us;
+
+        int fb = trace_buffer_index(buffers, &buffer_count, e->arg);
+        const char *name = event_names[e->event];
+        switch (e->event) {
+        case CAM_TRACE_EOI_BEGIN:
+        case CAM_TRACE_EOI_END:
+            trace_emit(&out, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+                       name, e->event == CAM_TRACE_EOI_BEGIN ? 'B' : 'E', ts, e->core);
+            break;
+        default:
+            trace_emit(&out, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,"
+                       "\"args\":{\"fb\":%d}}", name, ts, e->core, fb);
+            break;
+        }
+
+        // One async span per frame, from VSYNC (or the first sight of the
+        // buffer) until it is returned
+        if (fb < 0) {
+            continue;
+        }
+        if (e->event == CAM_TRACE_VSYNC || (!span_id[fb] && e->event != CAM_TRACE_FB_RETURN)) {
+            if (span_id[fb]) {
+                trace_emit(&out, "{\"name\":\"fb%d\",\"cat\":\"frame\",\"ph\":\"e\",\"id\":%lu,"
+                           "\"ts\":%.3f,\"pid\":1,\"tid\":%d}", fb, (unsigned long)span_id[fb], ts, e->core);
+            }
+            span_id[fb] = next_span++;
+            trace_emit(&out, "{\"name\":\"fb%d\",\"cat\":\"frame\",\"ph\":\"b\",\"id\":%lu,"
+                       "\"ts\":%.3f,\"pid\":1,\"tid\":%d}", fb, (unsigned long)span_id[fb], ts, e->core);
+        } else if (e->event == CAM_TRACE_FB_RETURN && span_id[fb]) {
+            trace_emit(&out, "{\"name\":\"fb%d\",\"cat\":\"frame\",\"ph\":\"e\",\"id\":%lu,"
+                       "\"ts\":%.3f,\"pid\":1,\"tid\":%d}", fb, (unsigned long)span_id[fb], ts, e->core);
+            span_id[fb] = 0;
+        }
+    }
+    atomic_store(&paused, false);
+
+    if (!out.failed) {
+        out.failed = write(ctx, "\n]}\n", 4) != 0;
+    }
+    return out.failed ? ESP_FAIL : ESP_OK;
+}
+
+#endif
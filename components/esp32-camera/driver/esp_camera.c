@@ -483,6 +483,18 @@ esp_err_t esp_camera_load_from_nvs(const char *key)
     }
 }
 
+esp_err_t esp_camera_check_framesize(framesize_t framesize)
+{
+    if (s_state == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    camera_sensor_info_t *info = esp_camera_sensor_get_info(&s_state->sensor.id);
+    if ((unsigned)framesize >= FRAMESIZE_INVALID || (info && framesize > info->max_size)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return cam_check_frame_size(framesize);
+}
+
 void esp_camera_return_all(void) {
     if (s_state == NULL) {
         return;
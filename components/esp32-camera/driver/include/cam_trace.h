@@ -0,0 +1,76 @@
+// Hot path trace: stages of every frame, from VSYNC to the buffer going
+// back to the driver, stamped with the CPU cycle counter into a lock-free
+// ring and exported as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+//
+// Compiled in with CONFIG_CAMERA_TRACE; otherwise CAM_TRACE() is empty and
+// costs nothing. Recording is a few dozen cycles and never logs or blocks.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    CAM_TRACE_SYNC = 0,       /*!< Internal: pairs the core's cycle counter with esp_timer */
+    CAM_TRACE_VSYNC,          /*!< DMA into a frame buffer started */
+    CAM_TRACE_DMA_DONE,       /*!< Frame complete in its buffer, handed to the frame queue */
+    CAM_TRACE_TAKE,           /*!< cam_take() returned the frame */
+    CAM_TRACE_EOI_BEGIN,      /*!< EOI search started */
+    CAM_TRACE_EOI_END,        /*!< EOI search done */
+    CAM_TRACE_TX_DEQUEUE,     /*!< Streaming stage picked the frame up */
+    CAM_TRACE_FIRST_PACKET,   /*!< First packet of the frame sent */
+    CAM_TRACE_LAST_PACKET,    /*!< Last packet of the frame sent to every viewer */
+    CAM_TRACE_FB_RETURN,      /*!< Buffer given back to the driver */
+    CAM_TRACE_EVENT_MAX,
+} cam_trace_event_t;
+
+/**
+ * @brief Receives the exported JSON in pieces
+ *
+ * @return 0 to continue, anything else aborts the export
+ */
+typedef int (*cam_trace_write_t)(void *ctx, const char *data, size_t len);
+
+#if CONFIG_CAMERA_TRACE
+
+/**
+ * @brief Record an event. Safe from any task on any core; not from ISRs.
+ *
+ * @param event Stage reached
+ * @param frame Identifies the frame across stages, normally its camera_fb_t pointer
+ */
+void cam_trace_record(cam_trace_event_t event, uint32_t frame);
+
+/**
+ * @brief Write the ring as Chrome trace JSON, oldest event first
+ *
+ * Recording pauses while the ring is read; events in that window are lost.
+ *
+ * @param write Output callback
+ * @param ctx   Passed to write
+ * @return ESP_OK, or ESP_FAIL if write aborted
+ */
+esp_err_t cam_trace_export(cam_trace_write_t write, void *ctx);
+
+/**
+ * @brief Drop every recorded event
+ */
+void cam_trace_clear(void);
+
+#define CAM_TRACE(event, frame) cam_trace_record((event), (uint32_t)(uintptr_t)(frame))
+
+#else
+
+#define CAM_TRACE(event, frame) ((void)0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
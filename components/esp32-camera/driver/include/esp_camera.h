@@ -157,6 +157,27 @@ typedef struct {
     int sccb_i2c_port;              /*!< If pin_sccb_sda is -1, use the already configured I2C bus by number */
 } camera_config_t;
 
+/**
+ * @brief Offsets of the JPEG markers in a frame buffer
+ *
+ * Filled in by the driver while the frame is received, so consumers can
+ * jump to the segments they need instead of scanning the buffer.
+ * SOI is always at offset 0; an offset of 0 for any other marker means
+ * it was not found.
+ */
+typedef struct {
+    uint32_t dqt;               /*!< First DQT segment */
+    uint32_t sof;               /*!< SOF0 segment */
+    uint32_t dht;               /*!< First DHT segment */
+    uint32_t dri;               /*!< DRI segment */
+    uint32_t sos;               /*!< SOS segment, entropy-coded data follows it */
+    uint32_t eoi;               /*!< EOI marker */
+    uint16_t width;             /*!< Width from SOF */
+    uint16_t height;            /*!< Height from SOF */
+    uint8_t sampling;           /*!< Luma sampling factors from SOF, (H << 4) | V */
+    bool valid;                 /*!< DQT, SOF, SOS and EOI were all found */
+} camera_jpeg_index_t;
+
 /**
  * @brief Data structure of camera frame buffer
  */
@@ -167,6 +188,7 @@ typedef struct {
     size_t height;              /*!< Height of the buffer in pixels */
     pixformat_t format;         /*!< Format of the pixel data */
     struct timeval timestamp;   /*!< Timestamp since boot of the first DMA buffer of the frame */
+    camera_jpeg_index_t jpeg;   /*!< JPEG marker index, only filled in PIXFORMAT_JPEG mode */
 } camera_fb_t;
 
 #define ESP_ERR_CAMERA_BASE 0x20000
@@ -221,6 +243,22 @@ void esp_camera_fb_return(camera_fb_t * fb);
  */
 sensor_t * esp_camera_sensor_get(void);
 
+/**
+ * @brief Check whether the sensor can switch to a frame size without a new esp_camera_init()
+ *
+ * Frame buffers are allocated for the frame size given at init; a larger
+ * size would overflow them.
+ *
+ * @param framesize Frame size for sensor->set_framesize()
+ *
+ * @return
+ *     - ESP_OK Frames of that size fit the buffers
+ *     - ESP_ERR_INVALID_ARG The sensor can't produce that size
+ *     - ESP_ERR_INVALID_SIZE The frame buffers are too small
+ *     - ESP_ERR_INVALID_STATE The camera is not initialized
+ */
+esp_err_t esp_camera_check_framesize(framesize_t framesize);
+
 /**
  * @brief Save camera settings to non-volatile-storage (NVS)
  *
@@ -47,6 +47,18 @@ esp_err_t cam_init(const camera_config_t *config);
 
 esp_err_t cam_config(const camera_config_t *config, framesize_t frame_size, uint16_t sensor_pid);
 
+/**
+ * @brief Check that frames of another size fit the buffers cam_config() allocated
+ *
+ * @param frame_size Frame size the sensor is about to be switched to
+ *
+ * @return
+ *     - ESP_OK The buffers are large enough
+ *     - ESP_ERR_INVALID_SIZE Frames would overflow the buffers, or not fill them in a raw format
+ *     - ESP_ERR_INVALID_STATE Not configured
+ */
+esp_err_t cam_check_frame_size(framesize_t frame_size);
+
 void cam_stop(void);
 
 void cam_start(void);
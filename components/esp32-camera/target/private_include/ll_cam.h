@@ -91,6 +91,8 @@ typedef struct {
     //for RGB/YUV modes
     lldesc_t *dma;
     size_t fb_offset;
+    //for JPEG mode, next header byte to index
+    uint32_t jpeg_pos;
 } cam_frame_t;
 
 typedef struct {
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "rfc2435.h"
+
+// RFC 2435 Appendix A, zig-zag order
+static const uint8_t jpeg_luma_quantizer[64] = {
+    16, 11, 12, 14, 12, 10, 16, 14,
+    13, 14, 18, 17, 16, 19, 24, 40,
+    26, 24, 22, 22, 24, 49, 35, 37,
+    29, 40, 58, 51, 61, 60, 57, 51,
+    56, 55, 64, 72, 92, 78, 64, 68,
+    87, 69, 55, 56, 80, 109, 81, 87,
+    95, 98, 103, 104, 103, 62, 77, 113,
+    121, 112, 100, 120, 92, 101, 103, 99
+};
+
+static const uint8_t jpeg_chroma_quantizer[64] = {
+    17, 18, 18, 24, 21, 24, 47, 26,
+    26, 47, 99, 66, 56, 66, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99
+};
+
+// ITU-T T.81 Annex K.3 tables, which RFC 2435 receivers always use
+static const uint8_t dc_luma_bits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t dc_luma_vals[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const uint8_t dc_chroma_bits[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t dc_chroma_vals[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const uint8_t ac_luma_bits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const uint8_t ac_luma_vals[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+static const uint8_t ac_chroma_bits[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const uint8_t ac_chroma_vals[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+void rfc2435_make_tables(rfc2435_params_t *params)
+{
+    int factor = params->q < 1 ? 1 : params->q > 99 ? 99 : params->q;
+    int q = factor < 50 ? 5000 / factor : 200 - factor * 2;
+
+    for (int i = 0; i < 64; i++) {
+        int lq = (jpeg_luma_quantizer[i] * q + 50) / 100;
+        int cq = (jpeg_chroma_quantizer[i] * q + 50) / 100;
+        params->tables[i] = lq < 1 ? 1 : lq > 255 ? 255 : lq;
+        params->tables[64 + i] = cq < 1 ? 1 : cq > 255 ? 255 : cq;
+    }
+    params->precision = 0;
+    params->table_len = 128;
+}
+
+static uint8_t *put_marker(uint8_t *p, uint8_t marker, uint16_t len)
+{
+    p[0] = 0xFF;
+    p[1] = marker;
+    p[2] = len >> 8;
+    p[3] = len;
+    return p + 4;
+}
+
+static uint8_t *put_dht(uint8_t *p, uint8_t class_id, const uint8_t *bits, const uint8_t *vals)
+{
+    size_t count = 0;
+    for (int i = 0; i < 16; i++) count += bits[i];
+    p = put_marker(p, 0xC4, 3 + 16 + count);
+    *p++ = class_id;
+    memcpy(p, bits, 16);
+    memcpy(p + 16, vals, count);
+    return p + 16 + count;
+}
+
+size_t rfc2435_make_headers(uint8_t *out, size_t size, const rfc2435_params_t *params)
+{
+    // SOI, two DQT, SOF, four DHT, DRI and SOS with room to spare
+    if (size < 2 + 2 * (5 + 128) + 19 + 4 * (5 + 16 + 162) + 6 + 14) {
+        return 0;
+    }
+    uint8_t *p = out;
+    *p++ = 0xFF;
+    *p++ = 0xD8;
+
+    // Luma table first; a table with 16-bit entries is 128 bytes long
+    size_t luma_len = (params->precision & 1) ? 128 : 64;
+    const uint8_t *t = params->tables;
+    for (int i = 0; i < 2; i++) {
+        size_t len = (params->precision & (1 << i)) ? 128 : 64;
+        if (t + len > params->tables + params->table_len) {
+            break;  // the tables header carried only one table
+        }
+        p = put_marker(p, 0xDB, 3 + len);
+        *p++ = ((params->precision >> i) & 1) << 4 | i;
+        memcpy(p, t, len);
+        p += len;
+        t = params->tables + luma_len;
+    }
+
+    uint8_t luma_sampling = (params->type & 0x3F) == 0 ? 0x21 : 0x22;
+    p = put_marker(p, 0xC0, 17);
+    *p++ = 8;
+    *p++ = params->height >> 8;
+    *p++ = params->height;
+    *p++ = params->width >> 8;
+    *p++ = params->width;
+    *p++ = 3;
+    *p++ = 0; *p++ = luma_sampling; *p++ = 0;
+    *p++ = 1; *p++ = 0x11; *p++ = 1;
+    *p++ = 2; *p++ = 0x11; *p++ = 1;
+
+    p = put_dht(p, 0x00, dc_luma_bits, dc_luma_vals);
+    p = put_dht(p, 0x10, ac_luma_bits, ac_luma_vals);
+    p = put_dht(p, 0x01, dc_chroma_bits, dc_chroma_vals);
+    p = put_dht(p, 0x11, ac_chroma_bits, ac_chroma_vals);
+
+    if (params->restart_interval) {
+        p = put_marker(p, 0xDD, 4);
+        *p++ = params->restart_interval >> 8;
+        *p++ = params->restart_interval;
+    }
+
+    p = put_marker(p, 0xDA, 12);
+    *p++ = 3;
+    *p++ = 0; *p++ = 0x00;
+    *p++ = 1; *p++ = 0x11;
+    *p++ = 2; *p++ = 0x11;
+    *p++ = 0;
+    *p++ = 63;
+    *p++ = 0;
+    return p - out;
+}
+
+//------------------------------------------------------------------------------
+// Scan check: canonical Huffman decoding as in T.81 F.2.2.3
+
+typedef struct {
+    int32_t maxcode[18];
+    int32_t valptr[17];
+    int32_t mincode[17];
+    const uint8_t *vals;
+} huff_table_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+    uint32_t bits;
+    int count;
+    bool marker;      // hit a marker, only 1 bits follow
+} bit_reader_t;
+
+static void huff_build(huff_table_t *h, const uint8_t *bits, const uint8_t *vals)
+{
+    int32_t code = 0;
+    int k = 0;
+    for (int l = 1; l <= 16; l++) {
+        h->valptr[l] = k;
+        h->mincode[l] = code;
+        code += bits[l - 1];
+        k += bits[l - 1];
+        h->maxcode[l] = bits[l - 1] ? code - 1 : -1;
+        code <<= 1;
+    }
+    h->maxcode[17] = 0x7FFFFFFF;
+    h->vals = vals;
+}
+
+static int read_bit(bit_reader_t *br)
+{
+    if (br->count == 0) {
+        if (br->marker || br->pos >= br->len) {
+            br->marker = true;
+            return -1;
+        }
+        uint8_t b = br->data[br->pos++];
+        if (b == 0xFF) {
+            uint8_t next = br->pos < br->len ? br->data[br->pos] : 0;
+            if (next == 0x00) {
+                br->pos++;
+            } else {
+                br->pos--;  // leave the marker for the caller
+                br->marker = true;
+                return -1;
+            }
+        }
+        br->bits = b;
+        br->count = 8;
+    }
+    br->count--;
+    return (br->bits >> br->count) & 1;
+}
+
+static int read_bits(bit_reader_t *br, int n)
+{
+    int v = 0;
+    for (int i = 0; i < n; i++) {
+        int b = read_bit(br);
+        if (b < 0) return -1;
+        v = (v << 1) | b;
+    }
+    return v;
+}
+
+static int huff_decode(bit_reader_t *br, const huff_table_t *h)
+{
+    int32_t code = 0;
+    for (int l = 1; l <= 16; l++) {
+        int b = read_bit(br);
+        if (b < 0) return -1;
+        code = (code << 1) | b;
+        if (code <= h->maxcode[l]) {
+            return h->vals[h->valptr[l] + code - h->mincode[l]];
+        }
+    }
+    return -2;  // no such code
+}
+
+// The bits left in the current byte before a marker are 1 padding (T.81 F.1.2.3)
+static bool padding_ok(const bit_reader_t *br)
+{
+    uint32_t mask = (1u << br->count) - 1;
+    return (br->bits & mask) == mask;
+}
+
+// Returns 0, -1 when the data ran out, -2 on a bad code
+static int decode_block(bit_reader_t *br, const huff_table_t *dc, const huff_table_t *ac)
+{
+    int s = huff_decode(br, dc);
+    if (s < 0) return s;
+    if (s > 11 || read_bits(br, s) < 0) return s > 11 ? -2 : -1;
+
+    for (int k = 1; k < 64; ) {
+        int rs = huff_decode(br, ac);
+        if (rs < 0) return rs;
+        int r = rs >> 4;
+        s = rs & 0x0F;
+        if (s == 0) {
+            if (r != 15) break;  // end of block
+            k += 16;
+        } else {
+            k += r;
+            if (read_bits(br, s) < 0) return -1;
+            k++;
+        }
+        if (k > 64) return -2;
+    }
+    return 0;
+}
+
+bool rfc2435_scan_valid(const uint8_t *scan, size_t len, const rfc2435_params_t *params,
+                        char *why, size_t why_len)
+{
+    static huff_table_t dc_l, ac_l, dc_c, ac_c;
+    static bool built;
+    if (!built) {
+        huff_build(&dc_l, dc_luma_bits, dc_luma_vals);
+        huff_build(&ac_l, ac_luma_bits, ac_luma_vals);
+        huff_build(&dc_c, dc_chroma_bits, dc_chroma_vals);
+        huff_build(&ac_c, ac_chroma_bits, ac_chroma_vals);
+        built = true;
+    }
+
+    int luma_blocks = (params->type & 0x3F) == 0 ? 2 : 4;
+    int mcu_h = (params->type & 0x3F) == 0 ? 8 : 16;
+    uint32_t mcus = ((params->width + 15) / 16) * ((params->height + mcu_h - 1) / mcu_h);
+    uint16_t ri = (params->type & 64) ? params->restart_interval : 0;
+
+    bit_reader_t br = { .data = scan, .len = len };
+    int rst = 0;
+    for (uint32_t m = 0; m < mcus; m++) {
+        if (ri && m && m % ri == 0) {
+            // Byte aligned RSTn, in sequence
+            if (!padding_ok(&br)) {
+                snprintf(why, why_len, "bad padding before MCU %lu", (unsigned long)m);
+                return false;
+            }
+            br.count = 0;
+            br.marker = false;
+            if (br.pos + 2 > len || scan[br.pos] != 0xFF || scan[br.pos + 1] != (0xD0 | rst)) {
+                snprintf(why, why_len, "RST%d missing before MCU %lu", rst, (unsigned long)m);
+                return false;
+            }
+            br.pos += 2;
+            rst = (rst + 1) & 7;
+        }
+        for (int b = 0; b < luma_blocks + 2; b++) {
+            bool luma = b < luma_blocks;
+            int err = decode_block(&br, luma ? &dc_l : &dc_c, luma ? &ac_l : &ac_c);
+            if (err) {
+                snprintf(why, why_len, "%s at MCU %lu of %lu",
+                         err == -1 ? "data ends" : "bad Huffman code",
+                         (unsigned long)m, (unsigned long)mcus);
+                return false;
+            }
+        }
+    }
+
+    if (!padding_ok(&br)) {
+        snprintf(why, why_len, "bad padding after the last MCU");
+        return false;
+    }
+    // Only the EOI may follow
+    size_t rest = len - br.pos;
+    if (rest > 0 && !(rest == 2 && scan[len - 2] == 0xFF && scan[len - 1] == 0xD9)) {
+        snprintf(why, why_len, "%lu bytes after the last MCU", (unsigned long)rest);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fields of the RFC 2435 main header, and tables from the quantization
+// table header or derived from Q
+typedef struct {
+    uint8_t type;              // 0 (4:2:2) or 1 (4:2:0), +64 with restart markers
+    uint8_t q;
+    uint16_t width;            // pixels
+    uint16_t height;
+    uint16_t restart_interval; // MCUs, 0 without restart markers
+    uint8_t precision;         // bit n set when table n has 16-bit entries
+    uint8_t tables[2 * 128];   // luma then chroma, zig-zag order
+    uint16_t table_len;
+} rfc2435_params_t;
+
+/**
+ * Fill params->tables from a Q of 1..99 as in RFC 2435 Appendix A
+ */
+void rfc2435_make_tables(rfc2435_params_t *params);
+
+/**
+ * Write the JPEG header a receiver prepends to the scan data: SOI, DQT,
+ * SOF0, DHT with the standard tables, DRI when restart markers are used,
+ * and SOS. Returns the header length, 0 if size is too small.
+ */
+size_t rfc2435_make_headers(uint8_t *out, size_t size, const rfc2435_params_t *params);
+
+/**
+ * Huffman-decode the scan with the standard tables, without the IDCT, to
+ * check that it holds exactly the MCUs the frame size calls for.
+ *
+ * @param why Receives the reason when the scan is not valid
+ */
+bool rfc2435_scan_valid(const uint8_t *scan, size_t len, const rfc2435_params_t *params,
+                        char *why, size_t why_len);
@@ -0,0 +1,954 @@
+// RTSP/RTP stream analyzer: plays an RTSP MJPEG stream, reassembles the
+// RFC 2435 fragments into JPEGs and reports loss, reordering, jitter,
+// frame completeness, decode validity and latency.
+//
+//   rtsp_analyze [-T] [-t seconds] [-n frames] [-o dir] [-v] rtsp://host[:port]/path
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rfc2435.h"
+
+#define RTP_HEADER_SIZE    12
+#define RTP_PT_JPEG        26
+#define INTERLEAVED_HDR    4
+#define MAX_SCAN_SIZE      (2 * 1024 * 1024)
+#define MAX_FRAGMENTS      2048
+#define ASSEMBLY_SLOTS     2     // a frame may still complete after the next one started
+#define LATENCY_SAMPLES    65536
+#define MAX_REPORTED_ISSUES 10
+
+typedef struct {
+    uint32_t offset;
+    uint32_t len;
+} fragment_t;
+
+// One frame being reassembled, keyed by RTP timestamp
+typedef struct {
+    bool used;
+    uint32_t ts;
+    int64_t first_us;
+    int64_t last_us;
+    uint32_t packets;
+    bool marker;
+    uint32_t end;            // scan length, known once the marker packet arrived
+    bool have_params;
+    rfc2435_params_t params;
+    bool have_tables;
+    fragment_t frags[MAX_FRAGMENTS];
+    uint32_t frag_count;
+    uint8_t *scan;
+} frame_asm_t;
+
+typedef struct {
+    // RTSP
+    char host[256];
+    int port;
+    char url[512];
+    int ctrl;
+    int cseq;
+    char session[64];
+    bool tcp;
+    int rtp;
+    int rtcp;
+    uint32_t blocksize;      // RTP payload size asked for, then the one granted
+    int64_t connect_us;
+    int64_t play_us;         // PLAY response received
+    int64_t first_frame_us;  // first decodable frame complete
+    uint8_t rx[INTERLEAVED_HDR + 65536];
+    size_t rx_len;
+
+    // Packets (RFC 3550 A.1, A.8)
+    uint32_t ssrc;
+    bool have_seq;
+    uint16_t max_seq;
+    uint32_t cycles;
+    uint32_t base_seq;
+    uint64_t received;
+    uint64_t reordered;
+    uint64_t duplicates;
+    size_t max_payload;
+    uint8_t seen[8192];      // bitmap of the last 65536 sequence numbers
+    double jitter;           // RTP units
+    bool have_transit;
+    int64_t last_transit;
+
+    // Frames
+    frame_asm_t slots[ASSEMBLY_SLOTS];
+    uint32_t frames;
+    uint32_t complete;
+    uint32_t invalid;
+    uint64_t frame_bytes;
+    uint64_t frame_packets;
+    bool have_last_ts;
+    uint32_t last_done_ts;
+
+    // Latency: arrival of the last packet minus the capture time in the
+    // RTP timestamp. Relative values need no clock sync; absolute ones map
+    // RTP time to wallclock through the last sender report.
+    bool have_origin;
+    uint32_t prev_ts;
+    int64_t ext_ts;
+    double *rel_ms;
+    double *abs_ms;
+    uint32_t rel_count;
+    uint32_t abs_count;
+    bool have_sr;
+    uint32_t sr_rtp;
+    int64_t sr_wall_us;
+    uint32_t srs;
+
+    // Last in-band quantization tables, for packets that leave them out
+    rfc2435_params_t cached;
+    bool have_cached;
+
+    uint32_t violations;
+    const char *out_dir;
+    bool verbose;
+} analyzer_t;
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static int64_t mono_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t wall_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void violation(analyzer_t *a, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void violation(analyzer_t *a, const char *fmt, ...)
+{
+    if (a->violations++ < MAX_REPORTED_ISSUES) {
+        va_list args;
+        va_start(args, fmt);
+        fprintf(stderr, "conformance: ");
+        vfprintf(stderr, fmt, args);
+        fprintf(stderr, "\n");
+        va_end(args);
+    }
+}
+
+//------------------------------------------------------------------------------
+// RTSP client
+
+static bool parse_url(analyzer_t *a, const char *url)
+{
+    if (strncmp(url, "rtsp://", 7) != 0) {
+        return false;
+    }
+    const char *host = url + 7;
+    size_t host_len = strcspn(host, ":/");
+    if (host_len == 0 || host_len >= sizeof(a->host)) {
+        return false;
+    }
+    memcpy(a->host, host, host_len);
+    a->host[host_len] = '\0';
+    a->port = host[host_len] == ':' ? atoi(host + host_len + 1) : 554;
+    snprintf(a->url, sizeof(a->url), "%s", url);
+    return a->port > 0;
+}
+
+static int rtsp_connect(const analyzer_t *a)
+{
+    char port[8];
+    snprintf(port, sizeof(port), "%d", a->port);
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    if (getaddrinfo(a->host, port, &hints, &res) != 0) {
+        return -1;
+    }
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(sock, res->ai_addr, res->ai_addrlen) != 0) {
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    return sock;
+}
+
+// Send a request, return the status and the response in resp
+static int rtsp_request(analyzer_t *a, const char *method, const char *url, const char *extra,
+                        char *resp, size_t resp_size)
+{
+    char req[1024];
+    int n = snprintf(req, sizeof(req),
+                     "%s %s RTSP/1.0\r\n"
+                     "CSeq: %d\r\n"
+                     "User-Agent: rtsp_analyze\r\n"
+                     "%s%s%s"
+                     "%s"
+                     "\r\n",
+                     method, url, ++a->cseq,
+                     a->session[0] ? "Session: " : "", a->session, a->session[0] ? "\r\n" : "",
+                     extra ? extra : "");
+    if (a->verbose) {
+        fprintf(stderr, ">> %s", req);
+    }
+    if (send(a->ctrl, req, n, 0) != n) {
+        return -1;
+    }
+
+    size_t len = 0;
+    char *end = NULL;
+    while (!end) {
+        if (len >= resp_size - 1) {
+            return -1;
+        }
+        int r = recv(a->ctrl, resp + len, resp_size - 1 - len, 0);
+        if (r <= 0) {
+            return -1;
+        }
+        len += r;
+        resp[len] = '\0';
+        // Interleaved data may precede the response once playing
+        while (a->tcp && len >= INTERLEAVED_HDR && resp[0] == '$') {
+            size_t pkt = INTERLEAVED_HDR + (((uint8_t)resp[2] << 8) | (uint8_t)resp[3]);
+            if (pkt > len) break;
+            memmove(resp, resp + pkt, len - pkt);
+            len -= pkt;
+            resp[len] = '\0';
+        }
+        end = strstr(resp, "\r\n\r\n");
+    }
+    size_t header_len = end + 4 - resp;
+    const char *cl = strstr(resp, "Content-Length:");
+    size_t body = cl && cl < end ? strtoul(cl + strlen("Content-Length:"), NULL, 10) : 0;
+    while (len < header_len + body && len < resp_size - 1) {
+        int r = recv(a->ctrl, resp + len, resp_size - 1 - len, 0);
+        if (r <= 0) {
+            return -1;
+        }
+        len += r;
+        resp[len] = '\0';
+    }
+    if (a->verbose) {
+        fprintf(stderr, "<< %s\n", resp);
+    }
+
+    const char *session = strstr(resp, "Session:");
+    if (session && !a->session[0]) {
+        sscanf(session + strlen("Session:"), " %63[^;\r\n]", a->session);
+    }
+    int status = 0;
+    sscanf(resp, "RTSP/1.0 %d", &status);
+    return status;
+}
+
+static bool open_udp_pair(analyzer_t *a, int *port)
+{
+    for (int p = 50000; p < 60000; p += 2) {
+        int rtp = socket(AF_INET, SOCK_DGRAM, 0);
+        int rtcp = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY) };
+        addr.sin_port = htons(p);
+        bool ok = bind(rtp, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        addr.sin_port = htons(p + 1);
+        ok = ok && bind(rtcp, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if (ok) {
+            int size = 4 << 20;
+            setsockopt(rtp, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+            a->rtp = rtp;
+            a->rtcp = rtcp;
+            *port = p;
+            return true;
+        }
+        close(rtp);
+        close(rtcp);
+    }
+    return false;
+}
+
+static bool rtsp_start(analyzer_t *a)
+{
+    static char resp[8192];
+
+    a->connect_us = mono_us();
+    a->ctrl = rtsp_connect(a);
+    if (a->ctrl < 0) {
+        fprintf(stderr, "Can't connect to %s:%d\n", a->host, a->port);
+        return false;
+    }
+
+    int status = rtsp_request(a, "OPTIONS", a->url, NULL, resp, sizeof(resp));
+    if (status != 200) {
+        fprintf(stderr, "OPTIONS failed: %d\n", status);
+        return false;
+    }
+    if (!strstr(resp, "DESCRIBE") || !strstr(resp, "SETUP") || !strstr(resp, "PLAY")) {
+        violation(a, "OPTIONS Public header lacks DESCRIBE, SETUP or PLAY");
+    }
+
+    status = rtsp_request(a, "DESCRIBE", a->url, "Accept: application/sdp\r\n", resp, sizeof(resp));
+    if (status != 200) {
+        fprintf(stderr, "DESCRIBE failed: %d\n", status);
+        return false;
+    }
+    // Track URL from a=control, absolute or relative to the request URL
+    char track[1024];
+    snprintf(track, sizeof(track), "%s", a->url);
+    const char *sdp = strstr(resp, "\r\n\r\n");
+    const char *m = sdp ? strstr(sdp, "m=video") : NULL;
+    if (!m) {
+        violation(a, "SDP has no video media");
+    } else {
+        int pt = -1;
+        sscanf(m, "m=video %*d RTP/AVP %d", &pt);
+        if (pt != RTP_PT_JPEG) {
+            violation(a, "SDP payload type %d, expected %d (JPEG)", pt, RTP_PT_JPEG);
+        }
+        const char *ctl = strstr(m, "a=control:");
+        if (ctl) {
+            char value[256];
+            sscanf(ctl + strlen("a=control:"), "%255[^\r\n]", value);
+            if (strncmp(value, "rtsp://", 7) == 0) {
+                snprintf(track, sizeof(track), "%s", value);
+            } else if (strcmp(value, "*") != 0) {
+                snprintf(track, sizeof(track), "%s%s%s", a->url,
+                         a->url[strlen(a->url) - 1] == '/' ? "" : "/", value);
+            }
+        }
+    }
+
+    char transport[160];
+    if (a->tcp) {
+        snprintf(transport, sizeof(transport), "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n");
+    } else {
+        int port;
+        if (!open_udp_pair(a, &port)) {
+            fprintf(stderr, "No free UDP port pair\n");
+            return false;
+        }
+        snprintf(transport, sizeof(transport),
+                 "Transport: RTP/AVP;unicast;client_port=%d-%d\r\n", port, port + 1);
+    }
+    if (a->blocksize) {
+        size_t used = strlen(transport);
+        snprintf(transport + used, sizeof(transport) - used, "Blocksize: %lu\r\n",
+                 (unsigned long)a->blocksize);
+    }
+    status = rtsp_request(a, "SETUP", track, transport, resp, sizeof(resp));
+    if (status != 200) {
+        fprintf(stderr, "SETUP failed: %d\n", status);
+        return false;
+    }
+    if (!a->session[0]) {
+        violation(a, "SETUP response has no Session header");
+    }
+    // Payloads are then checked against the size the server settled on; it
+    // may round up to a media-specific minimum (RFC 2326 12.7)
+    const char *bs = strstr(resp, "Blocksize:");
+    if (a->blocksize && bs) {
+        a->blocksize = strtoul(bs + strlen("Blocksize:"), NULL, 10);
+    }
+
+    status = rtsp_request(a, "PLAY", a->url, "Range: npt=0.000-\r\n", resp, sizeof(resp));
+    if (status != 200) {
+        fprintf(stderr, "PLAY failed: %d\n", status);
+        return false;
+    }
+    a->play_us = mono_us();
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Packet statistics
+
+static void seq_update(analyzer_t *a, uint16_t seq)
+{
+    bool dup = a->have_seq && (a->seen[seq >> 3] & (1 << (seq & 7)));
+    if (dup) {
+        a->duplicates++;
+        return;
+    }
+    if (!a->have_seq) {
+        a->have_seq = true;
+        a->max_seq = seq;
+        a->base_seq = seq;
+    } else {
+        uint16_t delta = seq - a->max_seq;
+        if (delta == 0) {
+            // unreachable: duplicates are filtered above
+        } else if (delta < 0x8000) {
+            // Forget what was seen for the numbers skipped, so the bitmap
+            // window slides with the stream
+            for (uint16_t s = a->max_seq + 1; s != seq; s++) {
+                a->seen[s >> 3] &= ~(1 << (s & 7));
+            }
+            if (seq < a->max_seq) {
+                a->cycles += 1 << 16;
+            }
+            a->max_seq = seq;
+        } else {
+            a->reordered++;
+        }
+    }
+    a->seen[seq >> 3] |= 1 << (seq & 7);
+    a->received++;
+}
+
+static uint64_t packets_expected(const analyzer_t *a)
+{
+    return a->have_seq ? a->cycles + a->max_seq - a->base_seq + 1 : 0;
+}
+
+// 64-bit RTP time, so wraps don't break latency arithmetic
+static int64_t extend_ts(analyzer_t *a, uint32_t ts)
+{
+    if (!a->have_origin) {
+        a->prev_ts = ts;
+        a->ext_ts = ts;
+    }
+    int32_t delta = (int32_t)(ts - a->prev_ts);
+    int64_t ext = a->ext_ts + delta;
+    if (delta > 0) {
+        a->prev_ts = ts;
+        a->ext_ts = ext;
+    }
+    return ext;
+}
+
+//------------------------------------------------------------------------------
+// Frame reassembly
+
+static int cmp_fragment(const void *x, const void *y)
+{
+    const fragment_t *a = x, *b = y;
+    return a->offset < b->offset ? -1 : a->offset > b->offset;
+}
+
+// Bytes of [0, end) not covered by any fragment
+static uint32_t frame_missing(frame_asm_t *f)
+{
+    qsort(f->frags, f->frag_count, sizeof(f->frags[0]), cmp_fragment);
+    uint32_t covered = 0, missing = 0;
+    for (uint32_t i = 0; i < f->frag_count; i++) {
+        if (f->frags[i].offset > covered) {
+            missing += f->frags[i].offset - covered;
+        }
+        uint32_t e = f->frags[i].offset + f->frags[i].len;
+        if (e > covered) covered = e;
+    }
+    uint32_t end = f->marker ? f->end : covered;
+    return missing + (end > covered ? end - covered : 0);
+}
+
+static void save_jpeg(analyzer_t *a, frame_asm_t *f)
+{
+    static uint8_t header[2048];
+    size_t hlen = rfc2435_make_headers(header, sizeof(header), &f->params);
+    char path[512];
+    snprintf(path, sizeof(path), "%s/frame_%06lu.jpg", a->out_dir, (unsigned long)a->frames);
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        fprintf(stderr, "Can't write %s: %s\n", path, strerror(errno));
+        return;
+    }
+    static const uint8_t eoi[2] = {0xFF, 0xD9};
+    fwrite(header, 1, hlen, out);
+    fwrite(f->scan, 1, f->end, out);
+    fwrite(eoi, 1, sizeof(eoi), out);
+    fclose(out);
+}
+
+static void latency_sample(analyzer_t *a, frame_asm_t *f)
+{
+    int64_t ext = extend_ts(a, f->ts);
+    int64_t rtp_us = ext * 100 / 9;
+    int64_t transit = f->last_us - rtp_us;
+    a->have_origin = true;
+    if (a->rel_count < LATENCY_SAMPLES) {
+        a->rel_ms[a->rel_count++] = transit / 1000.0;
+    }
+    if (a->have_sr && a->abs_count < LATENCY_SAMPLES) {
+        // Wallclock of the capture from the SR mapping, then how long ago
+        // that was when the frame completed
+        int64_t capture_wall = a->sr_wall_us + (int64_t)(int32_t)(f->ts - a->sr_rtp) * 100 / 9;
+        int64_t arrival_wall = wall_us() - (mono_us() - f->last_us);
+        a->abs_ms[a->abs_count++] = (arrival_wall - capture_wall) / 1000.0;
+    }
+}
+
+static void frame_finish(analyzer_t *a, frame_asm_t *f)
+{
+    a->frames++;
+    a->frame_packets += f->packets;
+
+    if (a->have_last_ts && (int32_t)(f->ts - a->last_done_ts) <= 0) {
+        violation(a, "frame timestamp %lu not after %lu",
+                  (unsigned long)f->ts, (unsigned long)a->last_done_ts);
+    }
+    a->have_last_ts = true;
+    a->last_done_ts = f->ts;
+
+    uint32_t missing = frame_missing(f);
+    bool complete = f->marker && missing == 0 && f->have_params && f->have_tables;
+    bool valid = false;
+    char why[96] = "";
+    if (complete) {
+        a->complete++;
+        a->frame_bytes += f->end;
+        valid = rfc2435_scan_valid(f->scan, f->end, &f->params, why, sizeof(why));
+        if (!valid) {
+            a->invalid++;
+        } else {
+            if (!a->first_frame_us) {
+                a->first_frame_us = f->last_us;
+            }
+            if (a->out_dir) {
+                save_jpeg(a, f);
+            }
+        }
+        latency_sample(a, f);
+    } else if (!f->have_tables && f->have_params) {
+        snprintf(why, sizeof(why), "no quantization tables");
+    }
+
+    if (a->verbose || (complete && !valid)) {
+        fprintf(stderr, "frame ts=%lu %ux%u type %u q %u: %lu packets, %lu bytes, "
+                "spread %lu us, %s%s%s\n",
+                (unsigned long)f->ts, f->params.width, f->params.height, f->params.type,
+                f->params.q, (unsigned long)f->packets, (unsigned long)f->end,
+                (unsigned long)(f->last_us - f->first_us),
+                complete ? (valid ? "ok" : "undecodable") : "incomplete",
+                why[0] ? ": " : "", why);
+        if (!complete && missing) {
+            fprintf(stderr, "  %lu bytes missing%s\n", (unsigned long)missing,
+                    f->marker ? "" : ", last fragment lost");
+        }
+    }
+    f->used = false;
+}
+
+static frame_asm_t *frame_slot(analyzer_t *a, uint32_t ts, int64_t now)
+{
+    frame_asm_t *oldest = NULL;
+    for (int i = 0; i < ASSEMBLY_SLOTS; i++) {
+        frame_asm_t *f = &a->slots[i];
+        if (f->used && f->ts == ts) {
+            return f;
+        }
+    }
+    for (int i = 0; i < ASSEMBLY_SLOTS; i++) {
+        frame_asm_t *f = &a->slots[i];
+        if (!f->used) {
+            oldest = f;
+            break;
+        }
+        if (!oldest || (int32_t)(f->ts - oldest->ts) < 0) {
+            oldest = f;
+        }
+    }
+    if (oldest->used) {
+        frame_finish(a, oldest);
+    }
+    uint8_t *scan = oldest->scan;
+    memset(oldest, 0, sizeof(*oldest));
+    oldest->scan = scan;
+    oldest->used = true;
+    oldest->ts = ts;
+    oldest->first_us = now;
+    return oldest;
+}
+
+static void on_rtp(analyzer_t *a, const uint8_t *pkt, size_t len, int64_t now)
+{
+    if (len < RTP_HEADER_SIZE + 8) {
+        violation(a, "%zu byte RTP packet", len);
+        return;
+    }
+    if ((pkt[0] >> 6) != 2) {
+        violation(a, "RTP version %d", pkt[0] >> 6);
+        return;
+    }
+    int pt = pkt[1] & 0x7F;
+    bool marker = pkt[1] & 0x80;
+    uint16_t seq = (pkt[2] << 8) | pkt[3];
+    uint32_t ts = ((uint32_t)pkt[4] << 24) | (pkt[5] << 16) | (pkt[6] << 8) | pkt[7];
+    uint32_t ssrc = ((uint32_t)pkt[8] << 24) | (pkt[9] << 16) | (pkt[10] << 8) | pkt[11];
+    if (pt != RTP_PT_JPEG) {
+        violation(a, "payload type %d", pt);
+    }
+    if (a->have_seq && ssrc != a->ssrc) {
+        violation(a, "SSRC changed from %08lX to %08lX", (unsigned long)a->ssrc, (unsigned long)ssrc);
+    }
+    a->ssrc = ssrc;
+
+    if (len - RTP_HEADER_SIZE > a->max_payload) {
+        a->max_payload = len - RTP_HEADER_SIZE;
+        if (a->blocksize && a->max_payload > a->blocksize) {
+            violation(a, "%zu byte RTP payload, Blocksize is %lu", a->max_payload,
+                      (unsigned long)a->blocksize);
+        }
+    }
+
+    size_t hdr = RTP_HEADER_SIZE + 4 * (pkt[0] & 0x0F);
+    if (pkt[0] & 0x10) {
+        if (len < hdr + 4) return;
+        hdr += 4 + 4 * ((pkt[hdr + 2] << 8) | pkt[hdr + 3]);
+    }
+    if (pkt[0] & 0x20) {
+        len -= pkt[len - 1];  // padding
+    }
+    if (len < hdr + 8) {
+        violation(a, "RTP packet too short for the JPEG header");
+        return;
+    }
+
+    seq_update(a, seq);
+
+    // Interarrival jitter, RFC 3550 A.8, in RTP units
+    int64_t arrival = now * 9 / 100;
+    int64_t transit = arrival - ts;
+    if (a->have_transit) {
+        int64_t d = transit - a->last_transit;
+        a->jitter += ((d < 0 ? -d : d) - a->jitter) / 16.0;
+    }
+    a->have_transit = true;
+    a->last_transit = transit;
+
+    // RFC 2435 §3.1 main header
+    const uint8_t *p = pkt + hdr;
+    const uint8_t *payload_end = pkt + len;
+    uint32_t offset = ((uint32_t)p[1] << 16) | (p[2] << 8) | p[3];
+    rfc2435_params_t params = {
+        .type = p[4],
+        .q = p[5],
+        .width = p[6] * 8,
+        .height = p[7] * 8,
+    };
+    p += 8;
+    if ((params.type & 0x3F) > 1) {
+        violation(a, "JPEG type %u", params.type);
+        return;
+    }
+    if (params.type & 64) {
+        if (payload_end - p < 4) return;
+        params.restart_interval = (p[0] << 8) | p[1];
+        p += 4;
+    }
+
+    frame_asm_t *f = frame_slot(a, ts, now);
+    f->packets++;
+    f->last_us = now;
+    bool have_tables = false;
+    if (offset == 0 && params.q >= 128) {
+        // §3.1.8 quantization table header
+        if (payload_end - p < 4) return;
+        params.precision = p[1];
+        params.table_len = (p[2] << 8) | p[3];
+        p += 4;
+        if (params.table_len > sizeof(params.tables) || payload_end - p < params.table_len) {
+            violation(a, "quantization table length %u", params.table_len);
+            return;
+        }
+        const uint8_t *table_data = p;
+        p += params.table_len;
+        if (params.table_len) {
+            memcpy(params.tables, table_data, params.table_len);
+            have_tables = true;
+            a->cached = params;
+            a->have_cached = true;
+        } else if (a->have_cached && a->cached.q == params.q) {
+            // Allowed for a Q whose tables were sent before (§3.1.8)
+            params.precision = a->cached.precision;
+            params.table_len = a->cached.table_len;
+            memcpy(params.tables, a->cached.tables, params.table_len);
+            have_tables = true;
+        }
+    } else if (params.q < 128) {
+        rfc2435_make_tables(&params);
+        have_tables = true;
+    }
+
+    if (offset == 0 || !f->have_params) {
+        if (f->have_params && (f->params.type != params.type || f->params.width != params.width ||
+                               f->params.height != params.height || f->params.q != params.q)) {
+            violation(a, "main header fields change within frame ts=%lu", (unsigned long)ts);
+        }
+        if (offset == 0 && have_tables) {
+            f->params = params;
+            f->have_tables = true;
+        } else if (!f->have_params) {
+            f->params = params;
+        }
+        f->have_params = true;
+    }
+
+    uint32_t frag_len = payload_end - p;
+    if (offset + frag_len > MAX_SCAN_SIZE || f->frag_count == MAX_FRAGMENTS) {
+        violation(a, "frame ts=%lu larger than %d bytes", (unsigned long)ts, MAX_SCAN_SIZE);
+        return;
+    }
+    memcpy(f->scan + offset, p, frag_len);
+    f->frags[f->frag_count++] = (fragment_t){ offset, frag_len };
+    if (marker) {
+        f->marker = true;
+        f->end = offset + frag_len;
+        // Complete frames are finished right away; reordered stragglers of
+        // an incomplete one may still arrive while the next frame starts
+        if (frame_missing(f) == 0) {
+            frame_finish(a, f);
+        }
+    }
+}
+
+// Sender reports map RTP time to the server's wallclock
+static void on_rtcp(analyzer_t *a, const uint8_t *buf, size_t len)
+{
+    size_t pos = 0;
+    while (pos + 8 <= len) {
+        const uint8_t *p = buf + pos;
+        size_t plen = 4 * (((p[2] << 8) | p[3]) + 1);
+        if ((p[0] >> 6) != 2 || pos + plen > len) {
+            violation(a, "malformed RTCP packet");
+            return;
+        }
+        if (p[1] == 200 && plen >= 28) {
+            uint32_t sec = ((uint32_t)p[8] << 24) | (p[9] << 16) | (p[10] << 8) | p[11];
+            uint32_t frac = ((uint32_t)p[12] << 24) | (p[13] << 16) | (p[14] << 8) | p[15];
+            a->sr_rtp = ((uint32_t)p[16] << 24) | (p[17] << 16) | (p[18] << 8) | p[19];
+            a->sr_wall_us = ((int64_t)sec - 2208988800LL) * 1000000 + ((uint64_t)frac * 1000000 >> 32);
+            a->have_sr = true;
+            a->srs++;
+        }
+        pos += plen;
+    }
+}
+
+static bool read_interleaved(analyzer_t *a, int64_t now)
+{
+    int r = recv(a->ctrl, a->rx + a->rx_len, sizeof(a->rx) - a->rx_len, MSG_DONTWAIT);
+    if (r <= 0) {
+        return r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    a->rx_len += r;
+
+    size_t pos = 0;
+    while (a->rx_len - pos >= INTERLEAVED_HDR) {
+        const uint8_t *p = a->rx + pos;
+        if (p[0] != '$') {
+            const uint8_t *end = memmem(p, a->rx_len - pos, "\r\n\r\n", 4);
+            if (!end) break;
+            pos = end + 4 - a->rx;
+            continue;
+        }
+        size_t len = (p[2] << 8) | p[3];
+        if (a->rx_len - pos < INTERLEAVED_HDR + len) break;
+        if (p[1] == 0) {
+            on_rtp(a, p + INTERLEAVED_HDR, len, now);
+        } else if (p[1] == 1) {
+            on_rtcp(a, p + INTERLEAVED_HDR, len);
+        }
+        pos += INTERLEAVED_HDR + len;
+    }
+    memmove(a->rx, a->rx + pos, a->rx_len - pos);
+    a->rx_len -= pos;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Report
+
+static int cmp_double(const void *x, const void *y)
+{
+    double a = *(const double *)x, b = *(const double *)y;
+    return a < b ? -1 : a > b;
+}
+
+static void print_distribution(const char *label, double *v, uint32_t n, bool relative)
+{
+    if (n == 0) return;
+    qsort(v, n, sizeof(v[0]), cmp_double);
+    for (uint32_t i = n; relative && i-- > 0;) {
+        v[i] -= v[0];
+    }
+    double sum = 0;
+    for (uint32_t i = 0; i < n; i++) sum += v[i];
+    printf("  %-26s min %.1f, avg %.1f, p95 %.1f, max %.1f ms\n",
+           label, v[0], sum / n, v[n * 95 / 100], v[n - 1]);
+}
+
+static void report(analyzer_t *a, double elapsed)
+{
+    uint64_t expected = packets_expected(a);
+    int64_t lost = (int64_t)expected - (int64_t)(a->received - a->reordered);
+    if (lost < 0) lost = 0;
+
+    printf("%s, %.1f s over %s\n", a->url, elapsed, a->tcp ? "TCP" : "UDP");
+    printf("packets\n");
+    printf("  received                   %llu (%.0f/s)\n",
+           (unsigned long long)a->received, a->received / elapsed);
+    printf("  lost                       %lld (%.2f%%)\n",
+           (long long)lost, expected ? lost * 100.0 / expected : 0.0);
+    printf("  reordered                  %llu\n", (unsigned long long)a->reordered);
+    printf("  duplicates                 %llu\n", (unsigned long long)a->duplicates);
+    printf("  interarrival jitter        %.2f ms\n", a->jitter / 90.0);
+    printf("  largest RTP payload        %zu bytes", a->max_payload);
+    if (a->blocksize) {
+        printf(" (Blocksize %lu)", (unsigned long)a->blocksize);
+    }
+    printf("\n");
+    printf("frames\n");
+    printf("  seen                       %lu (%.1f/s)\n", (unsigned long)a->frames, a->frames / elapsed);
+    printf("  complete                   %lu (%.1f%%)\n", (unsigned long)a->complete,
+           a->frames ? a->complete * 100.0 / a->frames : 0.0);
+    printf("  undecodable                %lu\n", (unsigned long)a->invalid);
+    if (a->frames) {
+        printf("  average                    %.1f packets, %.0f bytes\n",
+               (double)a->frame_packets / a->frames,
+               a->complete ? (double)a->frame_bytes / a->complete : 0.0);
+    }
+    printf("startup\n");
+    printf("  connect to PLAY response   %.1f ms\n", (a->play_us - a->connect_us) / 1000.0);
+    if (a->first_frame_us) {
+        printf("  connect to first frame     %.1f ms\n", (a->first_frame_us - a->connect_us) / 1000.0);
+    } else {
+        printf("  connect to first frame     no decodable frame\n");
+    }
+    printf("latency\n");
+    print_distribution("above the fastest frame", a->rel_ms, a->rel_count, true);
+    if (a->abs_count) {
+        print_distribution("capture to arrival", a->abs_ms, a->abs_count, false);
+        printf("  (from %lu sender reports; needs the camera clock in sync, e.g. SNTP)\n",
+               (unsigned long)a->srs);
+    } else {
+        printf("  capture to arrival         no sender report received\n");
+    }
+    printf("conformance violations       %lu\n", (unsigned long)a->violations);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-T] [-b bytes] [-t seconds] [-n frames] [-o dir] [-v] rtsp://host[:port]/path\n"
+            "  -T  RTP interleaved over the RTSP connection instead of UDP\n"
+            "  -b  ask for this RTP payload size with the Blocksize header\n"
+            "  -t  stop after this many seconds, default 10\n"
+            "  -n  stop after this many frames\n"
+            "  -o  write every decodable frame to dir as a JPEG file\n"
+            "  -v  print RTSP messages and one line per frame\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    static analyzer_t a;
+    double seconds = 10;
+    uint32_t max_frames = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "Tb:t:n:o:vh")) != -1) {
+        switch (opt) {
+        case 'T': a.tcp = true; break;
+        case 'b': a.blocksize = strtoul(optarg, NULL, 10); break;
+        case 't': seconds = atof(optarg); break;
+        case 'n': max_frames = strtoul(optarg, NULL, 10); break;
+        case 'o': a.out_dir = optarg; break;
+        case 'v': a.verbose = true; break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if (optind != argc - 1 || !parse_url(&a, argv[optind])) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    a.rtp = a.rtcp = -1;
+    for (int i = 0; i < ASSEMBLY_SLOTS; i++) {
+        a.slots[i].scan = malloc(MAX_SCAN_SIZE);
+    }
+    a.rel_ms = malloc(LATENCY_SAMPLES * sizeof(double));
+    a.abs_ms = malloc(LATENCY_SAMPLES * sizeof(double));
+
+    signal(SIGINT, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!rtsp_start(&a)) {
+        return 1;
+    }
+
+    int64_t start = mono_us();
+    int64_t end = start + (int64_t)(seconds * 1e6);
+    int64_t now = start;
+    while (!stop && now < end && (!max_frames || a.frames < max_frames)) {
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        int max_fd = a.ctrl;
+        FD_SET(a.ctrl, &rfds);
+        if (!a.tcp) {
+            FD_SET(a.rtp, &rfds);
+            FD_SET(a.rtcp, &rfds);
+            max_fd = a.rtp > max_fd ? a.rtp : max_fd;
+            max_fd = a.rtcp > max_fd ? a.rtcp : max_fd;
+        }
+        struct timeval tv = { .tv_sec = 0, .tv_usec = 100 * 1000 };
+        if (select(max_fd + 1, &rfds, NULL, NULL, &tv) < 0) {
+            if (errno == EINTR) continue;
+            perror("select");
+            return 1;
+        }
+        now = mono_us();
+        if (a.tcp) {
+            if (FD_ISSET(a.ctrl, &rfds) && !read_interleaved(&a, now)) {
+                fprintf(stderr, "Server closed the connection\n");
+                break;
+            }
+            continue;
+        }
+        uint8_t pkt[65536];
+        int r;
+        while ((r = recv(a.rtp, pkt, sizeof(pkt), MSG_DONTWAIT)) > 0) {
+            on_rtp(&a, pkt, r, now);
+        }
+        while ((r = recv(a.rtcp, pkt, sizeof(pkt), MSG_DONTWAIT)) > 0) {
+            on_rtcp(&a, pkt, r);
+        }
+        if (FD_ISSET(a.ctrl, &rfds)) {
+            r = recv(a.ctrl, pkt, sizeof(pkt), MSG_DONTWAIT);
+            if (r == 0) {
+                fprintf(stderr, "Server closed the connection\n");
+                break;
+            }
+        }
+    }
+
+    // Frames still missing their marker were cut off by the stop, not lost
+    for (int i = 0; i < ASSEMBLY_SLOTS; i++) {
+        if (a.slots[i].used && a.slots[i].marker) {
+            frame_finish(&a, &a.slots[i]);
+        }
+    }
+    report(&a, (mono_us() - start) / 1e6);
+
+    static char resp[8192];
+    rtsp_request(&a, "TEARDOWN", a.url, NULL, resp, sizeof(resp));
+
+    // Usable as a check: something decoded and nothing broke the spec
+    return (a.complete > 0 && a.invalid == 0 && a.violations == 0) ? 0 : 3;
+}
@@ -0,0 +1,873 @@
+// Loopback benchmark: runs the real server against replayed JPEG files and
+// receives the stream with minimal RTSP clients over UDP or interleaved TCP.
+//
+//   rtsp_mjpeg_bench [-t seconds] [-c clients] [-T] [-p | -s] [-r] [-l loss%] [-b bytes] [-m min_fps] [-v] [file.jpeg ...]
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "cam_trace.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "rtsp_mjpeg.h"
+#include "replay_camera.h"
+#include "sdkconfig.h"
+
+#define RTP_HEADER_SIZE      12
+#define UDP_IP_HEADER_SIZE   28
+#define INTERLEAVED_HDR_SIZE 4
+#define CONNECT_TIMEOUT_US   (2 * 1000000LL)
+#define PREVIEW_FPS          5
+#define SUB_FPS              10
+// -r switches to these halfway through
+#define RECONFIG_FRAMESIZE   FRAMESIZE_QQVGA
+#define RECONFIG_QUALITY     20
+// -l: RTCP packet types and the share of dropped packets NACKs must recover
+#define RTCP_RR              201
+#define RTCP_RTPFB           205
+#define RTPFB_NACK           1
+#define NACK_MAX_FCI         32
+#define LOSS_MIN_RECOVERED   0.8
+
+// The camera at every capture at the root, a rate capped preview and a
+// half size sub-stream
+static const rtsp_mjpeg_mount_t bench_mounts[] = {
+    { .path = "/" },
+    { .path = "/preview", .fps = PREVIEW_FPS },
+    { .path = "/sub", .source = RTSP_MJPEG_SOURCE_SCALED, .scale = 2, .fps = SUB_FPS },
+};
+
+typedef struct {
+    int ctrl;
+    int rtp;                 // -1 with TCP
+    int rtcp;
+    int server_rtcp_port;    // from the SETUP response, UDP only
+    uint32_t blocksize;      // -b: RTP payload size the server granted
+    size_t max_packet;       // largest RTP packet received
+    bool tcp;
+    const char *mount;       // "" for the root
+    int cseq;
+    char session[32];
+    uint8_t rx[INTERLEAVED_HDR_SIZE + 65536];
+    size_t rx_len;
+
+    uint64_t packets;
+    uint64_t rtp_bytes;      // RTP headers and payload
+    uint64_t wire_bytes;     // plus UDP/IP headers or interleaved framing
+    uint32_t frames;
+    uint32_t lost;
+    uint32_t ssrc_changes;
+    uint32_t ssrc;
+    uint32_t reconfig_frames; // frames received when -r reconfigured
+    uint8_t *seen;           // -l: per sequence number, SEEN_* bits
+    uint32_t dropped;        // -l: packets thrown away on arrival
+    uint32_t nacked;         // -l: packets asked for again
+    uint32_t recovered;      // -l: missing packets that arrived later
+    uint16_t first_seq;
+    uint16_t next_seq;
+    bool have_seq;
+    bool in_frame;
+    uint32_t frame_ts;
+    int64_t frame_start_us;
+    uint64_t spread_us;      // first to last packet of each frame, summed
+    uint32_t max_spread_us;
+} bench_client_t;
+
+#define SEEN_RECEIVED 1
+#define SEEN_MARKER   2
+
+// -l: share of arriving RTP packets treated as lost, in 1/1000
+static int loss_permille;
+// -b: RTP payload size asked for in SETUP
+static long blocksize_ask;
+
+static const char *default_pictures[] = {
+    BENCH_PICTURES_DIR "/test_inside.jpeg",
+    BENCH_PICTURES_DIR "/test_outside.jpeg",
+    BENCH_PICTURES_DIR "/testimg.jpeg",
+};
+
+static int64_t cpu_time_us(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (int64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+           ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static int connect_server(void)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_RTSP_MJPEG_PORT),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    int64_t deadline = esp_timer_get_time() + CONNECT_TIMEOUT_US;
+
+    // The server task opens its listener asynchronously
+    while (esp_timer_get_time() < deadline) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            return sock;
+        }
+        close(sock);
+        usleep(20 * 1000);
+    }
+    return -1;
+}
+
+// Bind an even/odd UDP port pair on loopback
+static bool open_udp_pair(bench_client_t *c, int *rtp_port)
+{
+    for (int port = 40000; port < 60000; port += 2) {
+        int rtp = socket(AF_INET, SOCK_DGRAM, 0);
+        int rtcp = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in addr = {
+            .sin_family = AF_INET,
+            .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        };
+        addr.sin_port = htons(port);
+        bool ok = bind(rtp, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        addr.sin_port = htons(port + 1);
+        ok = ok && bind(rtcp, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if (ok) {
+            int size = 1 << 20;
+            setsockopt(rtp, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+            c->rtp = rtp;
+            c->rtcp = rtcp;
+            *rtp_port = port;
+            return true;
+        }
+        close(rtp);
+        close(rtcp);
+    }
+    return false;
+}
+
+// Send a request and read its response; interleaved data that arrives
+// first is not expected before PLAY. The body goes to content, if given.
+// Returns the status code.
+static int rtsp_exchange(bench_client_t *c, const char *method, const char *extra,
+                         char *content, size_t content_size)
+{
+    char req[512];
+    int n = snprintf(req, sizeof(req),
+                     "%s rtsp://127.0.0.1:%d%s/track1 RTSP/1.0\r\n"
+                     "CSeq: %d\r\n"
+                     "%s%s%s"
+                     "%s"
+                     "\r\n",
+                     method, CONFIG_RTSP_MJPEG_PORT, c->mount, ++c->cseq,
+                     c->session[0] ? "Session: " : "", c->session, c->session[0] ? "\r\n" : "",
+                     extra ? extra : "");
+    if (send(c->ctrl, req, n, 0) != n) {
+        return -1;
+    }
+
+    char resp[2048];
+    size_t len = 0;
+    char *end = NULL;
+    while (!end && len < sizeof(resp) - 1) {
+        int r = recv(c->ctrl, resp + len, sizeof(resp) - 1 - len, 0);
+        if (r <= 0) {
+            return -1;
+        }
+        len += r;
+        resp[len] = '\0';
+        end = strstr(resp, "\r\n\r\n");
+    }
+    if (!end) {
+        return -1;
+    }
+    // Read the whole body (SDP) so the next read starts at the next message
+    size_t body = 0;
+    const char *cl = strstr(resp, "Content-Length:");
+    if (cl && cl < end) {
+        body = strtoul(cl + strlen("Content-Length:"), NULL, 10);
+    }
+    size_t have = len - (end + 4 - resp);
+    size_t kept = 0;
+    if (content && content_size) {
+        kept = have < content_size - 1 ? have : content_size - 1;
+        memcpy(content, end + 4, kept);
+    }
+    while (have < body) {
+        char skip[512];
+        size_t want = body - have < sizeof(skip) ? body - have : sizeof(skip);
+        int r = recv(c->ctrl, skip, want, 0);
+        if (r <= 0) {
+            return -1;
+        }
+        have += r;
+        if (content && content_size && kept < content_size - 1) {
+            size_t n = (size_t)r < content_size - 1 - kept ? (size_t)r : content_size - 1 - kept;
+            memcpy(content + kept, skip, n);
+            kept += n;
+        }
+    }
+    if (content && content_size) {
+        content[kept] = '\0';
+    }
+
+    const char *session = strstr(resp, "Session:");
+    if (session && !c->session[0]) {
+        sscanf(session + strlen("Session:"), " %31[^;\r\n]", c->session);
+    }
+    const char *server_port = strstr(resp, "server_port=");
+    int rtp_port, rtcp_port;
+    if (server_port && sscanf(server_port + strlen("server_port="), "%d-%d", &rtp_port, &rtcp_port) == 2) {
+        c->server_rtcp_port = rtcp_port;
+    }
+    const char *blocksize = strstr(resp, "Blocksize:");
+    if (blocksize && blocksize < end) {
+        c->blocksize = strtoul(blocksize + strlen("Blocksize:"), NULL, 10);
+    }
+    int status = 0;
+    sscanf(resp, "RTSP/1.0 %d", &status);
+    return status;
+}
+
+static int rtsp_request(bench_client_t *c, const char *method, const char *extra)
+{
+    return rtsp_exchange(c, method, extra, NULL, 0);
+}
+
+// The SDP a new client of mount would get
+static bool describe(const char *mount, char *sdp, size_t size)
+{
+    bench_client_t *c = calloc(1, sizeof(*c));
+    c->rtp = c->rtcp = -1;
+    c->mount = mount;
+    c->ctrl = connect_server();
+    bool ok = c->ctrl >= 0 &&
+              rtsp_exchange(c, "DESCRIBE", "Accept: application/sdp\r\n", sdp, size) == 200;
+    if (c->ctrl >= 0) {
+        close(c->ctrl);
+    }
+    free(c);
+    return ok;
+}
+
+static bool client_start(bench_client_t *c, bool tcp, const char *mount)
+{
+    memset(c, 0, sizeof(*c));
+    c->rtp = c->rtcp = -1;
+    c->tcp = tcp;
+    c->mount = mount;
+    c->ctrl = connect_server();
+    if (c->ctrl < 0) {
+        fprintf(stderr, "Can't connect to the server on port %d\n", CONFIG_RTSP_MJPEG_PORT);
+        return false;
+    }
+
+    char transport[128];
+    if (tcp) {
+        snprintf(transport, sizeof(transport),
+                 "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n");
+    } else {
+        int port;
+        if (!open_udp_pair(c, &port)) {
+            fprintf(stderr, "No free UDP port pair\n");
+            return false;
+        }
+        snprintf(transport, sizeof(transport),
+                 "Transport: RTP/AVP;unicast;client_port=%d-%d\r\n", port, port + 1);
+        if (loss_permille) {
+            c->seen = calloc(65536, 1);
+        }
+    }
+
+    if (blocksize_ask) {
+        size_t used = strlen(transport);
+        snprintf(transport + used, sizeof(transport) - used, "Blocksize: %ld\r\n", blocksize_ask);
+    }
+    if (rtsp_request(c, "DESCRIBE", "Accept: application/sdp\r\n") != 200 ||
+        rtsp_request(c, "SETUP", transport) != 200 ||
+        rtsp_request(c, "PLAY", "Range: npt=0.000-\r\n") != 200) {
+        fprintf(stderr, "RTSP setup failed\n");
+        return false;
+    }
+    return true;
+}
+
+static void put_be16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    put_be16(p, v >> 16);
+    put_be16(p + 2, v);
+}
+
+// Ask for count packets from first on with a Generic NACK (RFC 4585 §6.2.1),
+// behind an empty receiver report as ffmpeg sends it
+static void client_send_nack(bench_client_t *c, uint16_t first, uint16_t count)
+{
+    uint8_t pkt[8 + 12 + 4 * NACK_MAX_FCI];
+    pkt[0] = 0x80;
+    pkt[1] = RTCP_RR;
+    put_be16(pkt + 2, 1);
+    put_be32(pkt + 4, c->ssrc + 1);
+
+    uint8_t *fb = pkt + 8;
+    size_t fci = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        uint16_t seq = first + i;
+        if (c->seen[seq] & SEEN_RECEIVED) continue;
+        uint8_t *f = fb + 12 + 4 * (fci - 1);
+        uint16_t since = fci ? seq - ((f[0] << 8) | f[1]) : 0;
+        if (fci && since <= 16) {
+            put_be16(f + 2, ((f[2] << 8) | f[3]) | (1 << (since - 1)));
+        } else if (fci < NACK_MAX_FCI) {
+            f = fb + 12 + 4 * fci++;
+            put_be16(f, seq);
+            put_be16(f + 2, 0);
+        } else {
+            break;
+        }
+        c->nacked++;
+    }
+    if (!fci) {
+        return;
+    }
+    fb[0] = 0x80 | RTPFB_NACK;
+    fb[1] = RTCP_RTPFB;
+    put_be16(fb + 2, 2 + fci);
+    put_be32(fb + 4, c->ssrc + 1);
+    put_be32(fb + 8, c->ssrc);
+
+    struct sockaddr_in to = {
+        .sin_family = AF_INET,
+        .sin_port = htons(c->server_rtcp_port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    sendto(c->rtcp, pkt, 8 + 12 + 4 * fci, 0, (struct sockaddr *)&to, sizeof(to));
+}
+
+static void client_on_rtp(bench_client_t *c, const uint8_t *pkt, size_t len, int64_t now)
+{
+    if (len < RTP_HEADER_SIZE || (pkt[0] >> 6) != 2) {
+        return;
+    }
+    if (loss_permille && rand() % 1000 < loss_permille) {
+        c->dropped++;
+        return;
+    }
+    uint16_t seq = (pkt[2] << 8) | pkt[3];
+    if (c->seen) {
+        if (c->seen[seq] & SEEN_RECEIVED) {
+            return;  // a resend of a packet that was there already
+        }
+        // Only the half of the sequence space behind the newest packet is tracked
+        c->seen[(uint16_t)(seq + 0x8000)] = 0;
+        c->seen[seq] = SEEN_RECEIVED | ((pkt[1] & 0x80) ? SEEN_MARKER : 0);
+    }
+    c->packets++;
+    c->rtp_bytes += len;
+    if (len > c->max_packet) {
+        c->max_packet = len;
+    }
+    c->wire_bytes += len + (c->tcp ? INTERLEAVED_HDR_SIZE : UDP_IP_HEADER_SIZE);
+
+    uint32_t ts = ((uint32_t)pkt[4] << 24) | (pkt[5] << 16) | (pkt[6] << 8) | pkt[7];
+    uint32_t ssrc = ((uint32_t)pkt[8] << 24) | (pkt[9] << 16) | (pkt[10] << 8) | pkt[11];
+    if (c->have_seq && ssrc != c->ssrc) {
+        c->ssrc_changes++;
+    }
+    c->ssrc = ssrc;
+    uint16_t gap = seq - c->next_seq;
+    if (c->have_seq && gap >= 0x8000) {
+        // Behind the newest packet: with -l, a resend of one counted as lost
+        if (c->seen && (uint16_t)(seq - c->first_seq) < (uint16_t)(c->next_seq - c->first_seq)) {
+            c->recovered++;
+            c->lost--;
+            if (pkt[1] & 0x80) {
+                c->frames++;
+            }
+        }
+        return;
+    }
+    if (c->have_seq && gap) {
+        c->lost += gap;
+        if (c->seen && c->server_rtcp_port) {
+            client_send_nack(c, c->next_seq, gap);
+        }
+    }
+    if (!c->have_seq) {
+        c->first_seq = seq;
+    }
+    c->next_seq = seq + 1;
+    c->have_seq = true;
+
+    if (!c->in_frame || ts != c->frame_ts) {
+        c->in_frame = true;
+        c->frame_ts = ts;
+        c->frame_start_us = now;
+    }
+    if (pkt[1] & 0x80) {
+        uint32_t spread = now - c->frame_start_us;
+        c->frames++;
+        c->spread_us += spread;
+        if (spread > c->max_spread_us) {
+            c->max_spread_us = spread;
+        }
+        c->in_frame = false;
+    }
+}
+
+// -l: frames of the last half of the sequence space, and how many of them
+// are whole. The first frame may have begun before PLAY and is left out.
+static void client_frames_whole(const bench_client_t *c, uint32_t *whole, uint32_t *total)
+{
+    *whole = *total = 0;
+    uint16_t span = c->next_seq - c->first_seq;
+    if (span > 0x7FFF) {
+        span = 0x7FFF;
+    }
+    bool started = false, complete = true;
+    for (uint16_t seq = c->next_seq - span; seq != c->next_seq; seq++) {
+        uint8_t f = c->seen[seq];
+        if (!started) {
+            started = f & SEEN_MARKER;
+            continue;
+        }
+        complete = complete && (f & SEEN_RECEIVED);
+        if (f & SEEN_MARKER) {
+            (*total)++;
+            *whole += complete;
+            complete = true;
+        }
+    }
+}
+
+static bool client_read(bench_client_t *c, int64_t now)
+{
+    if (!c->tcp) {
+        uint8_t pkt[2048];
+        int r;
+        while ((r = recv(c->rtp, pkt, sizeof(pkt), MSG_DONTWAIT)) > 0) {
+            client_on_rtp(c, pkt, r, now);
+        }
+        return true;
+    }
+
+    int r = recv(c->ctrl, c->rx + c->rx_len, sizeof(c->rx) - c->rx_len, MSG_DONTWAIT);
+    if (r <= 0) {
+        return r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    c->rx_len += r;
+
+    size_t pos = 0;
+    while (c->rx_len - pos >= INTERLEAVED_HDR_SIZE) {
+        const uint8_t *p = c->rx + pos;
+        if (p[0] != '$') {
+            // An RTSP message (none are expected while playing); skip it
+            const char *end = memmem(p, c->rx_len - pos, "\r\n\r\n", 4);
+            if (!end) break;
+            pos = (const uint8_t *)end + 4 - c->rx;
+            continue;
+        }
+        size_t len = (p[2] << 8) | p[3];
+        if (c->rx_len - pos < INTERLEAVED_HDR_SIZE + len) break;
+        if (p[1] == 0) {
+            client_on_rtp(c, p + INTERLEAVED_HDR_SIZE, len, now);
+        }
+        pos += INTERLEAVED_HDR_SIZE + len;
+    }
+    memmove(c->rx, c->rx + pos, c->rx_len - pos);
+    c->rx_len -= pos;
+    return true;
+}
+
+static int trace_write(void *ctx, const char *data, size_t len)
+{
+    return fwrite(data, 1, len, ctx) == len ? 0 : -1;
+}
+
+// Frame stage timeline of the run, for chrome://tracing or ui.perfetto.dev
+static bool trace_save(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    bool ok = cam_trace_export(trace_write, f) == ESP_OK;
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        fprintf(stderr, "Can't write %s\n", path);
+    }
+    return ok;
+}
+
+// Switch frame size, quality and rate under the playing clients, and wait
+// until new clients are told
+static bool bench_reconfigure(uint8_t fps)
+{
+    rtsp_mjpeg_reconfig_t rc = RTSP_MJPEG_RECONFIG_KEEP();
+    rc.framesize = FRAMESIZE_UXGA;
+    esp_err_t err = rtsp_mjpeg_reconfigure(&rc);
+    if (err != ESP_ERR_INVALID_SIZE) {
+        fprintf(stderr, "Reconfiguring beyond the frame buffers gave %s\n", esp_err_to_name(err));
+        return false;
+    }
+    rc.framesize = RECONFIG_FRAMESIZE;
+    rc.quality = RECONFIG_QUALITY;
+    rc.fps = fps;
+    err = rtsp_mjpeg_reconfigure(&rc);
+    if (err != ESP_OK) {
+        fprintf(stderr, "Reconfiguring failed: %s\n", esp_err_to_name(err));
+        return false;
+    }
+
+    char want_size[48], want_rate[32], sdp[1024] = "";
+    snprintf(want_size, sizeof(want_size), "a=framesize:26 %u-%u\r\n",
+             resolution[RECONFIG_FRAMESIZE].width, resolution[RECONFIG_FRAMESIZE].height);
+    snprintf(want_rate, sizeof(want_rate), "a=framerate:%u\r\n", fps);
+    for (int tries = 0; tries < 50; tries++) {
+        if (describe("", sdp, sizeof(sdp)) && strstr(sdp, want_size) && strstr(sdp, want_rate)) {
+            return true;
+        }
+        usleep(20 * 1000);
+    }
+    fprintf(stderr, "DESCRIBE after reconfiguring has no %.*s or %.*s:\n%s",
+            (int)strlen(want_size) - 2, want_size, (int)strlen(want_rate) - 2, want_rate, sdp);
+    return false;
+}
+
+static int open_fds(void)
+{
+    DIR *d = opendir("/proc/self/fd");
+    if (!d) {
+        return -1;
+    }
+    int n = 0;
+    while (readdir(d)) {
+        n++;
+    }
+    closedir(d);
+    return n;
+}
+
+// Stop the server under a playing client. It must close that client's
+// connection and every socket of its own, give every frame back to the
+// camera, and then start again on the same ports.
+static bool stop_check(bench_client_t *c, int clients, int fds_before,
+                       const rtsp_mjpeg_config_t *config)
+{
+    if (rtsp_mjpeg_server_stop() != ESP_OK) {
+        fprintf(stderr, "FAILED: server didn't stop\n");
+        return false;
+    }
+    bool closed = false;
+    int64_t deadline = esp_timer_get_time() + CONNECT_TIMEOUT_US;
+    while (!closed && esp_timer_get_time() < deadline) {
+        char buf[4096];
+        int r = recv(c[0].ctrl, buf, sizeof(buf), MSG_DONTWAIT);
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            usleep(10 * 1000);
+        } else if (r <= 0) {
+            closed = true;
+        }
+    }
+    for (int i = 0; i < clients; i++) {
+        close(c[i].ctrl);
+        if (c[i].rtp >= 0) close(c[i].rtp);
+        if (c[i].rtcp >= 0) close(c[i].rtcp);
+        free(c[i].seen);
+    }
+    int leaked = open_fds() - fds_before;
+    size_t held = replay_camera_buffers_out();
+    printf("  stop              client %s, %d sockets left open, %zu camera buffers held\n",
+           closed ? "disconnected" : "still connected", leaked, held);
+
+    bool restarted = rtsp_mjpeg_server_start_config(config) == ESP_OK;
+    int sock = restarted ? connect_server() : -1;
+    restarted = sock >= 0;
+    if (sock >= 0) {
+        close(sock);
+    }
+    restarted = rtsp_mjpeg_server_stop() == ESP_OK && restarted;
+    int leaked_restart = open_fds() - fds_before;
+    printf("  restart           %s, %d sockets left open\n", restarted ? "ok" : "failed", leaked_restart);
+
+    if (!closed || leaked || held || !restarted || leaked_restart) {
+        fprintf(stderr, "FAILED: server stop left state behind\n");
+        return false;
+    }
+    return true;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-t seconds] [-c clients] [-T] [-p | -s] [-r] [-l loss%%] [-m min_fps] [-S] [-x trace.json] [-v]"
+            " [file.jpeg ...]\n"
+            "  -t  measurement time, default 5 s\n"
+            "  -c  concurrent clients, default 1\n"
+            "  -T  RTP interleaved over the RTSP connection instead of UDP\n"
+            "  -p  watch /preview, capped at %d fps (fails when faster), instead of /\n"
+            "  -s  watch /sub, scaled to half size at %d fps (fails when faster), instead of /\n"
+            "  -r  halfway through, halve the frame rate and change frame size and quality;\n"
+            "      fails when a client sees a sequence gap, a new SSRC or the old rate\n"
+            "  -l  UDP clients drop this share of packets and ask for them again with RTCP NACK;\n"
+            "      fails when fewer than %.0f%% of them come back\n"
+            "  -b  ask for this RTP payload size with the Blocksize header; fails when the\n"
+            "      server grants more, more than interleaved framing can carry, or sends more\n"
+            "  -m  exit with an error when a client gets fewer frames per second\n"
+            "  -S  only serve for -t seconds, for external clients such as rtsp_analyze\n"
+            "  -x  write the frame stage trace of the last seconds as Chrome trace JSON\n"
+            "  -v  show the server's log\n", prog, PREVIEW_FPS, SUB_FPS, LOSS_MIN_RECOVERED * 100);
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = 5;
+    int clients = 1;
+    bool tcp = false;
+    double min_fps = 0;
+    bool verbose = false;
+    bool serve_only = false;
+    const char *trace_path = NULL;
+    const char *mount = "";
+    int mount_fps = 0;
+    bool reconfig = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:c:Tpsrl:b:m:Sx:vh")) != -1) {
+        switch (opt) {
+        case 't': seconds = atoi(optarg); break;
+        case 'c': clients = atoi(optarg); break;
+        case 'T': tcp = true; break;
+        case 'p': mount = bench_mounts[1].path; mount_fps = PREVIEW_FPS; break;
+        case 's': mount = bench_mounts[2].path; mount_fps = SUB_FPS; break;
+        case 'r': reconfig = true; break;
+        case 'l': loss_permille = atof(optarg) * 10; break;
+        case 'b': blocksize_ask = atol(optarg); break;
+        case 'm': min_fps = atof(optarg); break;
+        case 'S': serve_only = true; break;
+        case 'x': trace_path = optarg; break;
+        case 'v': verbose = true; break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    // -r needs a free session to check DESCRIBE
+    if (seconds <= 0 || clients <= 0 || clients > CONFIG_RTSP_MJPEG_MAX_SESSIONS - reconfig ||
+        loss_permille < 0 || loss_permille >= 1000 || (loss_permille && tcp) || blocksize_ask < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // lwIP reports a closed peer with an error, not a signal
+    signal(SIGPIPE, SIG_IGN);
+    esp_log_level_set("*", verbose ? ESP_LOG_INFO : ESP_LOG_WARN);
+
+    const char *const *files = default_pictures;
+    size_t file_count = sizeof(default_pictures) / sizeof(default_pictures[0]);
+    if (optind < argc) {
+        files = (const char *const *)&argv[optind];
+        file_count = argc - optind;
+    }
+    if (replay_camera_init(files, file_count) != ESP_OK) {
+        fprintf(stderr, "No usable JPEG files\n");
+        return 1;
+    }
+    rtsp_mjpeg_config_t config = RTSP_MJPEG_DEFAULT_CONFIG();
+    config.stack_size = 16 * 1024;
+    config.mounts = bench_mounts;
+    config.mount_count = sizeof(bench_mounts) / sizeof(bench_mounts[0]);
+    int fds_before = open_fds();
+    if (rtsp_mjpeg_server_start_config(&config) != ESP_OK) {
+        fprintf(stderr, "Server failed to start\n");
+        return 1;
+    }
+    if (serve_only) {
+        sleep(seconds);
+        return trace_path && !trace_save(trace_path);
+    }
+
+    bench_client_t *c = calloc(clients, sizeof(*c));
+    for (int i = 0; i < clients; i++) {
+        if (!client_start(&c[i], tcp, mount)) {
+            return 1;
+        }
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    int64_t start_cpu = cpu_time_us();
+    uint32_t start_captured = replay_camera_frames();
+    int64_t end_us = start_us + seconds * 1000000LL;
+    int64_t now = start_us;
+    int64_t reconfig_at = start_us + seconds * 500000LL;
+    int64_t reconfigured_us = 0;
+    uint8_t reconfig_fps = config.fps / 2;
+
+    while (now < end_us) {
+        if (reconfig && !reconfigured_us && now >= reconfig_at) {
+            if (!bench_reconfigure(reconfig_fps)) {
+                return 1;
+            }
+            // Rates after are counted from when new clients saw the change
+            reconfigured_us = esp_timer_get_time();
+            for (int i = 0; i < clients; i++) {
+                client_read(&c[i], reconfigured_us);
+                c[i].reconfig_frames = c[i].frames;
+            }
+        }
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        int max_fd = 0;
+        for (int i = 0; i < clients; i++) {
+            int fd = c[i].tcp ? c[i].ctrl : c[i].rtp;
+            FD_SET(fd, &rfds);
+            if (fd > max_fd) max_fd = fd;
+        }
+        struct timeval tv = { .tv_sec = 0, .tv_usec = 100 * 1000 };
+        if (select(max_fd + 1, &rfds, NULL, NULL, &tv) < 0 && errno != EINTR) {
+            perror("select");
+            return 1;
+        }
+        now = esp_timer_get_time();
+        for (int i = 0; i < clients; i++) {
+            int fd = c[i].tcp ? c[i].ctrl : c[i].rtp;
+            if (FD_ISSET(fd, &rfds) && !client_read(&c[i], now)) {
+                fprintf(stderr, "Client %d: connection closed by the server\n", i);
+                return 1;
+            }
+        }
+    }
+
+    double elapsed = (now - start_us) / 1e6;
+    int64_t cpu_us = cpu_time_us() - start_cpu;
+    uint32_t captured = replay_camera_frames() - start_captured;
+    rtsp_mjpeg_pacing_stats_t ps;
+    rtsp_mjpeg_get_pacing_stats(&ps);
+
+    printf("rtsp_mjpeg loopback benchmark: %.1f s, %d %s client%s of %s, %d fps configured\n",
+           elapsed, clients, tcp ? "TCP" : "UDP", clients > 1 ? "s" : "", mount[0] ? mount : "/",
+           mount_fps ? mount_fps : config.fps);
+
+    int status = 0;
+    bool reconfig_failed = false;
+    bool loss_failed = false;
+    bool blocksize_failed = false;
+    uint32_t total_frames = 0;
+    for (int i = 0; i < clients; i++) {
+        bench_client_t *b = &c[i];
+        double fps = b->frames / elapsed;
+        printf("client %d:\n", i);
+        printf("  frames/s          %.1f (%lu frames)\n", fps, (unsigned long)b->frames);
+        printf("  packets/s         %.0f (%llu packets, %lu lost)\n", b->packets / elapsed,
+               (unsigned long long)b->packets, (unsigned long)b->lost);
+        printf("  frame send time   %lu us avg, %lu us max (first to last packet)\n",
+               (unsigned long)(b->frames ? b->spread_us / b->frames : 0),
+               (unsigned long)b->max_spread_us);
+        printf("  bytes on the wire %llu (%.0f kbit/s), RTP %llu, %lu per frame\n",
+               (unsigned long long)b->wire_bytes, b->wire_bytes * 8 / elapsed / 1000,
+               (unsigned long long)b->rtp_bytes,
+               (unsigned long)(b->frames ? b->wire_bytes / b->frames : 0));
+        if (b->frames == 0 || fps < min_fps || (mount_fps && fps > mount_fps * 1.2)) {
+            status = 1;
+        }
+        if (blocksize_ask) {
+            printf("  blocksize         %ld asked for, %lu granted, %zu byte largest packet\n",
+                   blocksize_ask, (unsigned long)b->blocksize, b->max_packet);
+            if (!b->blocksize || b->blocksize > blocksize_ask ||
+                (tcp && b->blocksize + RTP_HEADER_SIZE > 0xFFFF) ||
+                b->max_packet > b->blocksize + RTP_HEADER_SIZE) {
+                blocksize_failed = true;
+            }
+        }
+        if (b->seen) {
+            uint32_t whole, total;
+            client_frames_whole(b, &whole, &total);
+            printf("  loss              %lu dropped, %lu asked for, %lu recovered, %lu of %lu frames whole\n",
+                   (unsigned long)b->dropped, (unsigned long)b->nacked, (unsigned long)b->recovered,
+                   (unsigned long)whole, (unsigned long)total);
+#ifdef CONFIG_RTSP_MJPEG_NACK
+            if (b->recovered < b->dropped * LOSS_MIN_RECOVERED) {
+                loss_failed = true;
+            }
+#endif
+        }
+        if (reconfigured_us) {
+            uint32_t after = b->frames - b->reconfig_frames;
+            double after_fps = after / ((now - reconfigured_us) / 1e6);
+            int want_fps = mount_fps && mount_fps < reconfig_fps ? mount_fps : reconfig_fps;
+            printf("  after reconfig    %.1f fps (%lu frames, %d configured), %lu SSRC changes\n",
+                   after_fps, (unsigned long)after, want_fps, (unsigned long)b->ssrc_changes);
+            if (!after || after_fps > want_fps * 1.2 || b->lost || b->ssrc_changes) {
+                reconfig_failed = true;
+            }
+        }
+        total_frames += b->frames;
+    }
+    printf("server:\n");
+    printf("  frames captured   %lu, %lu sent since start\n",
+           (unsigned long)captured, (unsigned long)ps.frames);
+    printf("  pacing            %lu kbit/s, %lu us max frame, %lu waits, %lu ENOBUFS\n",
+           (unsigned long)ps.rate_kbps, (unsigned long)ps.max_frame_us,
+           (unsigned long)ps.waits, (unsigned long)ps.enobufs);
+    rtsp_mjpeg_server_metrics_t sm;
+    rtsp_mjpeg_session_metrics_t sess[CONFIG_RTSP_MJPEG_MAX_SESSIONS + 1];
+    size_t sess_count;
+    rtsp_mjpeg_get_metrics(&sm, sess, sizeof(sess) / sizeof(sess[0]), &sess_count);
+    printf("  capture failures  %lu, %lu frames overrun\n",
+           (unsigned long)sm.capture_failures, (unsigned long)sm.frames_overrun);
+    printf("  scaled frames     %lu, %lu skipped while busy, %lu failed\n",
+           (unsigned long)sm.frames_scaled, (unsigned long)sm.scale_skipped,
+           (unsigned long)sm.scale_failures);
+    for (size_t i = 0; i < sess_count; i++) {
+        printf("  session %08lX  %s, %.1f fps, %lu frames, %lu us avg send, %lu failures, %lu resent\n",
+               (unsigned long)sess[i].session_id, sess[i].mount, sess[i].fps,
+               (unsigned long)sess[i].frames_sent,
+               (unsigned long)sess[i].avg_frame_us, (unsigned long)sess[i].send_failures,
+               (unsigned long)sess[i].packets_resent);
+    }
+    printf("  CPU               %.1f%%, %lu us per received frame (server and clients)\n",
+           cpu_us * 100.0 / (now - start_us),
+           (unsigned long)(total_frames ? cpu_us / total_frames : 0));
+
+    // The first client is left playing for the server to close
+    for (int i = 1; i < clients; i++) {
+        rtsp_request(&c[i], "TEARDOWN", NULL);
+    }
+    if (status) {
+        fprintf(stderr, "FAILED: a client got %s\n",
+                min_fps > 0 ? "fewer frames per second than -m" : "no frames");
+    }
+    if (reconfig_failed) {
+        fprintf(stderr, "FAILED: after reconfiguring, a client lost packets, saw a new SSRC "
+                "or got no frames or too many\n");
+        status = 1;
+    }
+    if (blocksize_failed) {
+        fprintf(stderr, "FAILED: a Blocksize the client can't take was granted or exceeded\n");
+        status = 1;
+    }
+    if (loss_failed) {
+        fprintf(stderr, "FAILED: NACKs recovered fewer than %.0f%% of the dropped packets\n",
+                LOSS_MIN_RECOVERED * 100);
+        status = 1;
+    }
+    if (!stop_check(c, clients, fds_before, &config)) {
+        status = 1;
+    }
+    if (trace_path && !trace_save(trace_path)) {
+        status = 1;
+    }
+    return status;
+}
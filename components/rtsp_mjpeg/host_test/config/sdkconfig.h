@@ -0,0 +1,50 @@
+#pragma once
+// Host build configuration. Mirrors the example's sdkconfig except for
+// unprivileged ports, a higher frame rate and a TCP send queue at the top of
+// its range, so a large Blocksize reaches the 16-bit interleaved length; edit
+// to benchmark others.
+
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+
+#define CONFIG_RTSP_MJPEG_PORT 8554
+#define CONFIG_RTSP_MJPEG_CHUNK_SIZE 1400
+#define CONFIG_RTSP_MJPEG_DEFAULT_FPS 25
+#define CONFIG_RTSP_MJPEG_MAX_SESSIONS 4
+#define CONFIG_RTSP_MJPEG_TCP_TXQ_SIZE 262144
+#define CONFIG_RTSP_MJPEG_RTP_PORT_BASE 16970
+#define CONFIG_RTSP_MJPEG_HTTP 1
+#define CONFIG_RTSP_MJPEG_HTTP_PORT 8080
+#define CONFIG_RTSP_MJPEG_SNAPSHOT_MAX_AGE_MS 1000
+#define CONFIG_RTSP_MJPEG_METRICS_HTTP 1
+#define CONFIG_RTSP_MJPEG_PACING 1
+#define CONFIG_RTSP_MJPEG_PACING_SPREAD_PERCENT 75
+#define CONFIG_RTSP_MJPEG_PACING_MAX_KBPS 20000
+#define CONFIG_RTSP_MJPEG_PACING_BURST 8400
+#define CONFIG_RTSP_MJPEG_NACK 1
+#define CONFIG_RTSP_MJPEG_NACK_HISTORY_KB 128
+#define CONFIG_RTSP_MJPEG_NACK_DEADLINE_MS 200
+#define CONFIG_RTSP_MJPEG_FRAME_QUEUE_LEN 1
+#define CONFIG_RTSP_MJPEG_MAX_FRAME_AGE_MS 0
+#define CONFIG_RTSP_MJPEG_QUEUE_DROP_OLDEST 1
+#define CONFIG_RTSP_MJPEG_CAPTURE_CORE 1
+#define CONFIG_RTSP_MJPEG_TX_CORE 0
+#define CONFIG_RTSP_MJPEG_SCALER_CORE 1
+#define CONFIG_RTSP_MJPEG_ABR 1
+#define CONFIG_RTSP_MJPEG_ABR_LADDER "6,4,1"
+#define CONFIG_RTSP_MJPEG_ABR_MAX_QUALITY 45
+#define CONFIG_RTSP_MJPEG_ABR_QUALITY_STEP 5
+#define CONFIG_RTSP_MJPEG_ABR_UPGRADE_PERIODS 5
+
+// esp_jpeg, built from source: the host has no ROM decoder
+#define CONFIG_JD_SZBUF 512
+#define CONFIG_JD_FORMAT 0
+#define CONFIG_JD_USE_SCALE 1
+#define CONFIG_JD_TBLCLIP 1
+#define CONFIG_JD_FASTDECODE 1
+
+#define CONFIG_CAMERA_JPEG_QUALITY 20
+#define CONFIG_CAMERA_FB_COUNT 2
+#define CONFIG_CAMERA_FRAME_SIZE_ENUM 2
+#define CONFIG_CAMERA_TRACE 1
+#define CONFIG_CAMERA_TRACE_ENTRIES 4096
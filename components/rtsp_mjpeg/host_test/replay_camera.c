@@ -0,0 +1,235 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_camera.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "camera_config.h"
+#include "cam_trace.h"
+#include "rtp_jpeg.h"
+#include "replay_camera.h"
+
+static const char *TAG = "replay_camera";
+
+// esp_camera_fb_get() gives up after this long, like FB_GET_TIMEOUT in the driver
+#define FB_GET_TIMEOUT_MS 4000
+#define MAX_IMAGES        16
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    camera_jpeg_index_t index;
+} replay_image_t;
+
+static replay_image_t images[MAX_IMAGES];
+static size_t image_count;
+static size_t next_image;
+
+static camera_fb_t fbs[CAMERA_FB_COUNT];
+static bool fb_out[CAMERA_FB_COUNT];
+static uint32_t frames;
+static pthread_mutex_t fb_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fb_free = PTHREAD_COND_INITIALIZER;
+
+static sensor_t sensor;
+
+static int sensor_set_quality(sensor_t *s, int quality)
+{
+    s->status.quality = quality;
+    return 0;
+}
+
+static int sensor_set_framesize(sensor_t *s, framesize_t framesize)
+{
+    s->status.framesize = framesize;
+    return 0;
+}
+
+// Same walk as cam_index_jpeg_header() over a complete frame
+static void index_jpeg(const uint8_t *buf, size_t len, camera_jpeg_index_t *idx)
+{
+    memset(idx, 0, sizeof(*idx));
+    size_t pos = 0;
+
+    while (!idx->sos && pos + 4 <= len) {
+        const uint8_t *p = &buf[pos];
+        if (p[0] != 0xFF) {
+            return;
+        }
+        if (p[1] == 0xD8 || p[1] == 0xFF) {
+            pos += (p[1] == 0xD8) ? 2 : 1;
+            continue;
+        }
+        switch (p[1]) {
+            case 0xDB: if (!idx->dqt) idx->dqt = pos; break;
+            case 0xC4: if (!idx->dht) idx->dht = pos; break;
+            case 0xDD: idx->dri = pos; break;
+            case 0xDA: idx->sos = pos; break;
+            case 0xC0:
+                if (pos + 12 > len) return;
+                idx->sof = pos;
+                idx->height = (p[5] << 8) | p[6];
+                idx->width = (p[7] << 8) | p[8];
+                idx->sampling = p[11];
+                break;
+            default: break;
+        }
+        pos += 2 + ((p[2] << 8) | p[3]);
+    }
+    for (size_t i = len; idx->sos && i >= idx->sos + 2; i--) {
+        if (buf[i - 2] == 0xFF && buf[i - 1] == 0xD9) {
+            idx->eoi = i - 2;
+            break;
+        }
+    }
+    idx->valid = idx->dqt && idx->sof && idx->sos && idx->eoi;
+}
+
+static bool load_image(const char *path, replay_image_t *img)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        ESP_LOGE(TAG, "Can't open %s", path);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    img->buf = len > 0 ? malloc(len) : NULL;
+    bool ok = img->buf && fread(img->buf, 1, len, f) == (size_t)len;
+    fclose(f);
+    if (!ok) {
+        ESP_LOGE(TAG, "Can't read %s", path);
+        free(img->buf);
+        return false;
+    }
+    img->len = len;
+
+    rtp_jpeg_frame_t jf;
+    esp_err_t err = rtp_jpeg_parse(img->buf, img->len, &jf);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Skipping %s: %s", path, esp_err_to_name(err));
+        free(img->buf);
+        return false;
+    }
+    index_jpeg(img->buf, img->len, &img->index);
+    ESP_LOGI(TAG, "%s: %ux%u, %zu bytes, %zu scan bytes%s", path, jf.width, jf.height,
+             img->len, jf.scan_len, jf.std_huffman ? "" : ", custom Huffman tables");
+    return true;
+}
+
+esp_err_t replay_camera_init(const char *const *paths, size_t count)
+{
+    for (size_t i = 0; i < count && image_count < MAX_IMAGES; i++) {
+        if (load_image(paths[i], &images[image_count])) {
+            image_count++;
+        }
+    }
+    if (!image_count) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    sensor.status.framesize = CAMERA_FRAME_SIZE_ENUM;
+    sensor.status.quality = CAMERA_JPEG_QUALITY;
+    sensor.set_quality = sensor_set_quality;
+    sensor.set_framesize = sensor_set_framesize;
+    return ESP_OK;
+}
+
+uint32_t replay_camera_frames(void)
+{
+    pthread_mutex_lock(&fb_lock);
+    uint32_t n = frames;
+    pthread_mutex_unlock(&fb_lock);
+    return n;
+}
+
+size_t replay_camera_buffers_out(void)
+{
+    pthread_mutex_lock(&fb_lock);
+    size_t n = 0;
+    for (int i = 0; i < CAMERA_FB_COUNT; i++) {
+        n += fb_out[i];
+    }
+    pthread_mutex_unlock(&fb_lock);
+    return n;
+}
+
+camera_fb_t *esp_camera_fb_get(void)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += FB_GET_TIMEOUT_MS / 1000;
+
+    pthread_mutex_lock(&fb_lock);
+    camera_fb_t *fb = NULL;
+    while (!fb) {
+        for (int i = 0; i < CAMERA_FB_COUNT; i++) {
+            if (!fb_out[i]) {
+                fb_out[i] = true;
+                fb = &fbs[i];
+                break;
+            }
+        }
+        if (!fb && pthread_cond_timedwait(&fb_free, &fb_lock, &deadline) != 0) {
+            break;
+        }
+    }
+    if (fb) {
+        // The buffer points at the file data: the driver's DMA is not what
+        // is being measured
+        const replay_image_t *img = &images[next_image];
+        next_image = (next_image + 1) % image_count;
+        int64_t now = esp_timer_get_time();
+        fb->buf = img->buf;
+        fb->len = img->len;
+        fb->width = img->index.width;
+        fb->height = img->index.height;
+        fb->format = PIXFORMAT_JPEG;
+        fb->timestamp.tv_sec = now / 1000000;
+        fb->timestamp.tv_usec = now % 1000000;
+        fb->jpeg = img->index;
+        frames++;
+    }
+    pthread_mutex_unlock(&fb_lock);
+    if (fb) {
+        CAM_TRACE(CAM_TRACE_TAKE, fb);
+    }
+
+    if (!fb) {
+        ESP_LOGW(TAG, "Failed to get the frame on time!");
+    }
+    return fb;
+}
+
+void esp_camera_fb_return(camera_fb_t *fb)
+{
+    CAM_TRACE(CAM_TRACE_FB_RETURN, fb);
+    pthread_mutex_lock(&fb_lock);
+    fb_out[fb - fbs] = false;
+    pthread_cond_signal(&fb_free);
+    pthread_mutex_unlock(&fb_lock);
+}
+
+sensor_t *esp_camera_sensor_get(void)
+{
+    return image_count ? &sensor : NULL;
+}
+
+esp_err_t esp_camera_check_framesize(framesize_t framesize)
+{
+    if (!image_count) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if ((unsigned)framesize >= FRAMESIZE_INVALID) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // As if cam_config() had sized JPEG buffers for the configured frame size
+    size_t need = (size_t)resolution[framesize].width * resolution[framesize].height / 5;
+    size_t have = (size_t)resolution[CAMERA_FRAME_SIZE_ENUM].width *
+                  resolution[CAMERA_FRAME_SIZE_ENUM].height / 5;
+    return need <= have ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
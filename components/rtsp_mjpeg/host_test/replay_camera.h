@@ -0,0 +1,35 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Stand in for the camera driver with JPEG files
+ *
+ * esp_camera_fb_get() then hands out the files in turn, from a pool of
+ * CAMERA_FB_COUNT buffers that blocks like the driver's when all are out.
+ * Frames are indexed the way cam_hal does, so the server takes the same
+ * parsing path as on the target.
+ *
+ * @param paths JPEG files; ones RFC 2435 can't carry are skipped
+ * @return ESP_OK, or ESP_ERR_NOT_FOUND if no file was usable
+ */
+esp_err_t replay_camera_init(const char *const *paths, size_t count);
+
+/**
+ * @brief Frames handed out by esp_camera_fb_get() so far
+ */
+uint32_t replay_camera_frames(void);
+
+/**
+ * @brief Buffers taken with esp_camera_fb_get() and not returned yet
+ */
+size_t replay_camera_buffers_out(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,371 @@
+// FreeRTOS tasks, semaphores, queues and notifications on pthreads.
+// Only what rtsp_mjpeg uses; priorities and core affinity are ignored.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+
+struct host_task {
+    pthread_t thread;
+    TaskFunction_t fn;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify;
+};
+
+struct host_sem {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    UBaseType_t count;
+    UBaseType_t max;
+};
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint8_t *items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+static __thread struct host_task *current_task;
+static struct timespec start_time;
+
+__attribute__((constructor))
+static void host_clock_init(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+}
+
+static int64_t host_elapsed_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - start_time.tv_sec) * 1000000 +
+           (now.tv_nsec - start_time.tv_nsec) / 1000;
+}
+
+// Absolute CLOCK_MONOTONIC time of a tick count
+static struct timespec tick_to_timespec(uint64_t tick)
+{
+    uint64_t ns = tick * (1000000000ULL / configTICK_RATE_HZ);
+    struct timespec ts = {
+        .tv_sec = start_time.tv_sec + ns / 1000000000ULL,
+        .tv_nsec = start_time.tv_nsec + ns % 1000000000ULL,
+    };
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+static void cond_init_monotonic(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// Wait on cond until signalled or the deadline; false on timeout.
+// deadline NULL waits forever.
+static bool cond_wait_until(pthread_cond_t *cond, pthread_mutex_t *lock,
+                            const struct timespec *deadline)
+{
+    if (!deadline) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+// Deadline for a wait of ticks, NULL for portMAX_DELAY
+static const struct timespec *deadline_after(TickType_t ticks, struct timespec *ts)
+{
+    if (ticks == portMAX_DELAY) {
+        return NULL;
+    }
+    *ts = tick_to_timespec(xTaskGetTickCount() + (uint64_t)ticks);
+    return ts;
+}
+
+//------------------------------------------------------------------------------
+// Tasks
+
+static struct host_task *task_alloc(void)
+{
+    struct host_task *t = calloc(1, sizeof(*t));
+    if (t) {
+        pthread_mutex_init(&t->lock, NULL);
+        cond_init_monotonic(&t->cond);
+    }
+    return t;
+}
+
+// Threads not created by xTaskCreate() get a task on first use
+static struct host_task *task_self(void)
+{
+    if (!current_task) {
+        current_task = task_alloc();
+        current_task->thread = pthread_self();
+    }
+    return current_task;
+}
+
+static void *task_entry(void *arg)
+{
+    current_task = arg;
+    current_task->fn(current_task->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_size,
+                       void *arg, UBaseType_t priority, TaskHandle_t *handle)
+{
+    (void)name;
+    (void)stack_size;
+    (void)priority;
+
+    struct host_task *t = task_alloc();
+    if (!t) {
+        return pdFAIL;
+    }
+    t->fn = fn;
+    t->arg = arg;
+    if (pthread_create(&t->thread, NULL, task_entry, t) != 0) {
+        free(t);
+        return pdFAIL;
+    }
+    pthread_detach(t->thread);
+    if (handle) {
+        *handle = t;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_size,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t core)
+{
+    (void)core;
+    return xTaskCreate(fn, name, stack_size, arg, priority, handle);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (!task || task == current_task) {
+        pthread_exit(NULL);
+    }
+    // Like on the target, whatever the task holds stays held
+    pthread_cancel(task->thread);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(host_elapsed_us() / (1000000 / configTICK_RATE_HZ));
+}
+
+static void sleep_until_tick(uint64_t tick)
+{
+    struct timespec ts = tick_to_timespec(tick);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    // Ends on a tick boundary, so a delay of 1 may be shorter than a tick
+    sleep_until_tick((uint64_t)xTaskGetTickCount() + ticks);
+}
+
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t increment)
+{
+    *previous_wake += increment;
+    sleep_until_tick(*previous_wake);
+}
+
+void xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    struct host_task *t = task_self();
+    struct timespec ts;
+    const struct timespec *deadline = deadline_after(ticks, &ts);
+
+    pthread_mutex_lock(&t->lock);
+    while (t->notify == 0 && cond_wait_until(&t->cond, &t->lock, deadline)) {
+    }
+    uint32_t value = t->notify;
+    if (value) {
+        t->notify = clear_on_exit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return value;
+}
+
+//------------------------------------------------------------------------------
+// Semaphores. A mutex is a binary semaphore that starts out given; there
+// is no priority inheritance.
+
+static SemaphoreHandle_t sem_create(UBaseType_t count, UBaseType_t max)
+{
+    struct host_sem *s = calloc(1, sizeof(*s));
+    if (s) {
+        pthread_mutex_init(&s->lock, NULL);
+        cond_init_monotonic(&s->cond);
+        s->count = count;
+        s->max = max;
+    }
+    return s;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return sem_create(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return sem_create(0, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    struct timespec ts;
+    const struct timespec *deadline = deadline_after(ticks, &ts);
+
+    pthread_mutex_lock(&sem->lock);
+    while (sem->count == 0 && cond_wait_until(&sem->cond, &sem->lock, deadline)) {
+    }
+    BaseType_t taken = sem->count > 0;
+    if (taken) {
+        sem->count--;
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return taken ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    pthread_mutex_lock(&sem->lock);
+    BaseType_t given = sem->count < sem->max;
+    if (given) {
+        sem->count++;
+        pthread_cond_signal(&sem->cond);
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return given ? pdTRUE : pdFALSE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    pthread_cond_destroy(&sem->cond);
+    pthread_mutex_destroy(&sem->lock);
+    free(sem);
+}
+
+//------------------------------------------------------------------------------
+// Queues, copying items like FreeRTOS does
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct host_queue *q = calloc(1, sizeof(*q));
+    if (!q) {
+        return NULL;
+    }
+    q->items = calloc(length, item_size);
+    if (!q->items) {
+        free(q);
+        return NULL;
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    cond_init_monotonic(&q->not_empty);
+    cond_init_monotonic(&q->not_full);
+    q->length = length;
+    q->item_size = item_size;
+    return q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks)
+{
+    struct timespec ts;
+    const struct timespec *deadline = deadline_after(ticks, &ts);
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->length && cond_wait_until(&q->not_full, &q->lock, deadline)) {
+    }
+    BaseType_t sent = q->count < q->length;
+    if (sent) {
+        UBaseType_t tail = (q->head + q->count) % q->length;
+        memcpy(q->items + tail * q->item_size, item, q->item_size);
+        q->count++;
+        pthread_cond_signal(&q->not_empty);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return sent ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks)
+{
+    struct timespec ts;
+    const struct timespec *deadline = deadline_after(ticks, &ts);
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && cond_wait_until(&q->not_empty, &q->lock, deadline)) {
+    }
+    BaseType_t received = q->count > 0;
+    if (received) {
+        memcpy(item, q->items + q->head * q->item_size, q->item_size);
+        q->head = (q->head + 1) % q->length;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return received ? pdTRUE : pdFALSE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    UBaseType_t count = q->count;
+    pthread_mutex_unlock(&q->lock);
+    return count;
+}
+
+BaseType_t xQueueReset(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->head = 0;
+    q->count = 0;
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return pdPASS;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+    pthread_mutex_destroy(&q->lock);
+    free(q->items);
+    free(q);
+}
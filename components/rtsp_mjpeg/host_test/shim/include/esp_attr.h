@@ -0,0 +1,5 @@
+#pragma once
+
+// Placement attributes mean nothing without IRAM
+#define IRAM_ATTR
+#define DRAM_ATTR
@@ -0,0 +1,12 @@
+#pragma once
+#include <stdint.h>
+
+typedef uint32_t esp_cpu_cycle_count_t;
+
+// Nanoseconds from CLOCK_MONOTONIC, as if the CPU ran at 1 GHz
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void);
+
+static inline int esp_cpu_get_core_id(void)
+{
+    return 0;
+}
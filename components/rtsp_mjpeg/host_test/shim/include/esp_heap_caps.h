@@ -0,0 +1,21 @@
+#pragma once
+#include <stddef.h>
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT    (1 << 2)
+#define MALLOC_CAP_DMA     (1 << 3)
+#define MALLOC_CAP_SPIRAM  (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+// One heap on the host; capabilities are ignored
+static inline void *heap_caps_malloc(size_t size, unsigned int caps)
+{
+    (void)caps;
+    return malloc(size);
+}
+
+static inline void heap_caps_free(void *ptr)
+{
+    free(ptr);
+}
@@ -0,0 +1,2 @@
+#pragma once
+// No ROM on the host: esp_jpeg builds TJpgDec from source (CONFIG_JD_USE_ROM unset)
@@ -0,0 +1,8 @@
+#pragma once
+#include <stdint.h>
+
+// Matches the 1 GHz esp_cpu_get_cycle_count()
+static inline uint32_t esp_rom_get_cpu_ticks_per_us(void)
+{
+    return 1000;
+}
@@ -0,0 +1,5 @@
+#pragma once
+#include <stdint.h>
+
+// The host has no fixed heap to report; always 0
+uint32_t esp_get_free_heap_size(void);
@@ -0,0 +1,5 @@
+#pragma once
+#include <stdint.h>
+
+// Microseconds since the process started, from CLOCK_MONOTONIC
+int64_t esp_timer_get_time(void);
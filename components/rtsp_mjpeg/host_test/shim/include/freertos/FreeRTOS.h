@@ -0,0 +1,29 @@
+#pragma once
+// Host build: the subset of the FreeRTOS API rtsp_mjpeg uses, on pthreads.
+// Ticks run at CONFIG_FREERTOS_HZ like on the target so delays round the same.
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <assert.h>
+#include "sdkconfig.h"
+// Like the target's port layer, which components rely on for heap_caps_malloc()
+#include "esp_heap_caps.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define configTICK_RATE_HZ  CONFIG_FREERTOS_HZ
+#define portTICK_PERIOD_MS  (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY       ((TickType_t)0xffffffffUL)
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+
+#define pdFALSE  0
+#define pdTRUE   1
+#define pdFAIL   pdFALSE
+#define pdPASS   pdTRUE
+
+#define tskNO_AFFINITY  0x7FFFFFFF
+#define tskIDLE_PRIORITY 0
+// Every task runs on "core 0"
+#define portNUM_PROCESSORS  1
@@ -0,0 +1,2 @@
+#pragma once
+// Included by the camera's JPEG encoder; no registers are used
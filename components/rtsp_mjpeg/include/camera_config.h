@@ -1,5 +1,6 @@
 #pragma once
 #include "esp_camera.h"
+#include "sdkconfig.h"
 
 // Pin configuration for Freenove ESP32S3-EYE (edit if needed)
 #define CAMERA_PIN_PWDN      -1
@@ -22,7 +23,7 @@
 #define CAMERA_PIN_PCLK      13
 
 #define CAMERA_JPEG_QUALITY  20   // Lower is better quality (try 20-40)
-#define CAMERA_FB_COUNT      1
+#define CAMERA_FB_COUNT      CONFIG_CAMERA_FB_COUNT
 
 #define CAMERA_FRAME_SIZE_ENUM FRAMESIZE_QVGA
 #define CAMERA_FRAME_WIDTH   320
@@ -1,12 +1,198 @@
 #pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
 #include "esp_err.h"
+#include "sensor.h"
+#include "sdkconfig.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 /**
- * @brief Start the RTSP MJPEG server (includes camera init)
+ * @brief Packet pacing statistics, accumulated since the server started
+ */
+typedef struct {
+    uint32_t rate_kbps;        /*!< Pacing rate chosen for the last frame, 0 when unpaced */
+    uint32_t frames;           /*!< Frames sent to at least one viewer */
+    uint32_t packets;          /*!< RTP packets handed to the network stack */
+    uint64_t bytes;            /*!< RTP bytes handed to the network stack */
+    uint32_t packets_dropped;  /*!< Packets the stack refused even after waiting */
+    uint32_t frames_skipped;   /*!< Frames an RTP-over-TCP viewer's queue had no room for */
+    uint32_t frames_stale;     /*!< Frames not sent to a viewer because they were older than its max age */
+    uint32_t enobufs;          /*!< UDP sends that hit ENOBUFS */
+    uint32_t waits;            /*!< Times the stream task slept for tokens */
+    uint64_t wait_us;          /*!< Total time slept for tokens */
+    uint32_t last_frame_us;    /*!< Time to send the last frame to every viewer */
+    uint32_t max_frame_us;     /*!< Longest time to send one frame */
+    uint32_t txq_peak;         /*!< Highest RTP-over-TCP send queue occupancy, bytes */
+} rtsp_mjpeg_pacing_stats_t;
+
+/**
+ * @brief Stream health of one session, from our counters and its RTCP receiver reports
+ *
+ * Report fields stay 0 until the client sent its first receiver report.
+ */
+typedef struct {
+    uint32_t session_id;
+    char client_ip[16];
+    uint32_t ssrc;
+    uint32_t packets_sent;     /*!< RTP packets sent, as in our sender reports */
+    uint32_t octets_sent;      /*!< RTP payload octets sent */
+    uint32_t reports;          /*!< Receiver reports received */
+    uint32_t last_report_ms;   /*!< Age of the last receiver report */
+    float loss_fraction;       /*!< Share of packets lost since the previous report, 0..1 */
+    int32_t cumulative_lost;   /*!< Packets lost since PLAY */
+    uint32_t highest_seq;      /*!< Extended highest sequence number received */
+    uint32_t jitter_us;        /*!< Interarrival jitter */
+    uint32_t rtt_us;           /*!< Round trip time from LSR/DLSR, 0 if unknown */
+} rtsp_mjpeg_rtcp_stats_t;
+
+#define RTSP_MJPEG_MAX_MOUNTS      4
+#define RTSP_MJPEG_MOUNT_PATH_MAX  32   /*!< Including the terminating NUL */
+
+typedef enum {
+    RTSP_MJPEG_TRANSPORT_UDP = 0,
+    RTSP_MJPEG_TRANSPORT_TCP,        /*!< RTP interleaved on the RTSP connection */
+    RTSP_MJPEG_TRANSPORT_MULTICAST,  /*!< Group member; traffic is counted on the group sender */
+    RTSP_MJPEG_TRANSPORT_HTTP,       /*!< HTTP MJPEG stream or snapshot */
+} rtsp_mjpeg_transport_t;
+
+/**
+ * @brief Delivery counters of one session, since it connected
+ *
+ * The multicast group sender is listed as a session of its own, with the
+ * group address as client_ip.
+ */
+typedef struct {
+    uint32_t session_id;
+    char client_ip[16];
+    rtsp_mjpeg_transport_t transport;
+    char mount[RTSP_MJPEG_MOUNT_PATH_MAX];  /*!< Path of the stream it watches, "" before choosing one */
+    bool playing;
+    uint32_t connected_ms;     /*!< Time since the client connected */
+    uint32_t frames_sent;      /*!< Frames completely handed to the network stack */
+    uint32_t frames_dropped;   /*!< Frames skipped because the viewer was still busy with an older one */
+    uint32_t frames_stale;     /*!< Frames skipped for being older than the session's max age */
+    uint32_t packets_sent;     /*!< RTP packets, or HTTP parts */
+    uint64_t bytes_sent;       /*!< Bytes on the wire, RTP, interleaving and HTTP headers included */
+    uint32_t send_failures;    /*!< Packets the stack refused, or failed HTTP writes */
+    uint32_t enobufs;          /*!< UDP sends that hit ENOBUFS and were retried */
+    uint32_t nacks;            /*!< Packets the client asked for again with RTCP NACK */
+    uint32_t packets_resent;   /*!< Of those, packets sent again from the history */
+    uint32_t resend_misses;    /*!< Of those, packets no longer kept, past the deadline or over the NACK's burst */
+    uint32_t avg_frame_us;     /*!< Average time from first to last byte of a frame */
+    uint32_t max_frame_us;     /*!< Longest time to send one frame */
+    float fps;                 /*!< Current delivery rate, 0 when frames stopped arriving */
+} rtsp_mjpeg_session_metrics_t;
+
+/**
+ * @brief Server-wide counters, since the server started
+ */
+typedef struct {
+    uint32_t uptime_ms;
+    uint32_t frames_captured;
+    uint32_t capture_failures;  /*!< esp_camera_fb_get() returned no frame */
+    uint32_t frames_overrun;    /*!< Captured frames dropped because the transmit stage was behind */
+    uint32_t frames_scaled;     /*!< Frames encoded for the scaled mount */
+    uint32_t scale_skipped;     /*!< Frames due on the scaled mount while the scaler was still busy */
+    uint32_t scale_failures;    /*!< Frames the scaler could not decode, encode or fit in its buffer */
+    uint32_t sessions_active;   /*!< Client sessions in use, playing or not */
+    uint32_t sessions_playing;
+    uint32_t sessions_accepted; /*!< Connections accepted on the RTSP and HTTP ports */
+    uint32_t sessions_rejected; /*!< Connections turned away because every session was in use */
+    uint32_t free_heap;
+} rtsp_mjpeg_server_metrics_t;
+
+/**
+ * @brief The most recently captured JPEG, held until released
+ */
+typedef struct {
+    const uint8_t *buf;        /*!< Complete JPEG, valid until rtsp_mjpeg_snapshot_release() */
+    size_t len;
+    uint16_t width;
+    uint16_t height;
+    int64_t capture_us;        /*!< esp_timer time the frame was captured */
+    void *ref;                 /*!< Internal */
+} rtsp_mjpeg_snapshot_t;
+
+/**
+ * @brief Where a mount point's frames come from
+ */
+typedef enum {
+    RTSP_MJPEG_SOURCE_CAMERA = 0,    /*!< JPEG frames as captured by esp_camera */
+    RTSP_MJPEG_SOURCE_SCALED,        /*!< Captured frames decoded at 1/scale size and encoded again,
+                                          on the scaler task; one such mount per server */
+} rtsp_mjpeg_source_t;
+
+/** Bit for a transport in rtsp_mjpeg_mount_t::transports */
+#define RTSP_MJPEG_ALLOW(transport)  (1u << (transport))
+#define RTSP_MJPEG_ALLOW_ALL         0
+
+/**
+ * @brief A named stream, e.g. rtsp://camera/main
+ */
+typedef struct {
+    const char *path;          /*!< URL path starting with '/'; "/" takes every URL no other mount matches */
+    rtsp_mjpeg_source_t source;
+    uint8_t fps;               /*!< Frame rate cap, 0 = every captured frame */
+    uint8_t quality;           /*!< Camera mounts: sensor JPEG quality (lower is better), 0 = unchanged. The
+                                    camera has one quality: the best one asked by a camera mount is used.
+                                    Scaled mounts: encoder quality 1-100 (higher is better), 0 = 70 */
+    uint8_t transports;        /*!< RTSP_MJPEG_ALLOW() bits of the transports viewers may use, 0 = all. Listing
+                                    multicast puts the group in the SDP, so clients following it join */
+    uint8_t scale;             /*!< Scaled mounts: 2, 4 or 8; width and height are then cut to multiples of 16 */
+} rtsp_mjpeg_mount_t;
+
+/**
+ * @brief Server settings, fixed while it runs
+ *
+ * Start from RTSP_MJPEG_DEFAULT_CONFIG(), which holds the Kconfig values,
+ * and change what the deployment needs.
+ */
+typedef struct {
+    uint16_t port;             /*!< RTSP port */
+    uint16_t http_port;        /*!< HTTP MJPEG/snapshot/metrics port, 0 = none */
+    uint8_t fps;               /*!< Capture rate; mounts can only lower it */
+    uint16_t packet_size;      /*!< RTP packet size unless a client asks otherwise with Blocksize */
+    uint8_t max_sessions;      /*!< Concurrent RTSP and HTTP clients, up to CONFIG_RTSP_MJPEG_MAX_SESSIONS */
+    const char *name;          /*!< SDP session name */
+    size_t stack_size;         /*!< Stack of the server and transmit tasks */
+    UBaseType_t priority;      /*!< Priority of the server, transmit and capture tasks */
+    int8_t server_core;        /*!< Core for the RTSP/HTTP server task, -1 = any */
+    int8_t tx_core;            /*!< Core for the transmit task, -1 = any */
+    int8_t capture_core;       /*!< Core for the capture task, -1 = any */
+    int8_t scaler_core;        /*!< Core for the scaler task of a scaled mount, -1 = any */
+    const rtsp_mjpeg_mount_t *mounts;  /*!< Copied at start; NULL serves the camera at "/" */
+    size_t mount_count;        /*!< Up to RTSP_MJPEG_MAX_MOUNTS */
+} rtsp_mjpeg_config_t;
+
+#ifdef CONFIG_RTSP_MJPEG_HTTP
+#define RTSP_MJPEG_DEFAULT_HTTP_PORT CONFIG_RTSP_MJPEG_HTTP_PORT
+#else
+#define RTSP_MJPEG_DEFAULT_HTTP_PORT 0
+#endif
+
+#define RTSP_MJPEG_DEFAULT_CONFIG() {                       \
+    .port = CONFIG_RTSP_MJPEG_PORT,                         \
+    .http_port = RTSP_MJPEG_DEFAULT_HTTP_PORT,              \
+    .fps = CONFIG_RTSP_MJPEG_DEFAULT_FPS,                   \
+    .packet_size = CONFIG_RTSP_MJPEG_CHUNK_SIZE,            \
+    .max_sessions = CONFIG_RTSP_MJPEG_MAX_SESSIONS,         \
+    .name = "ESP32 MJPEG",                                  \
+    .stack_size = 8 * 1024,                                 \
+    .priority = 5,                                          \
+    .server_core = -1,                                      \
+    .tx_core = CONFIG_RTSP_MJPEG_TX_CORE,                   \
+    .capture_core = CONFIG_RTSP_MJPEG_CAPTURE_CORE,         \
+    .scaler_core = CONFIG_RTSP_MJPEG_SCALER_CORE,           \
+    .mounts = NULL,                                         \
+    .mount_count = 0,                                       \
+}
+
+/**
+ * @brief Start the RTSP MJPEG server with the Kconfig settings
  *
  * @param stack_size FreeRTOS stack size for the server task
  * @param priority   FreeRTOS priority for the server task
@@ -14,13 +200,121 @@ extern "C" {
  */
 esp_err_t rtsp_mjpeg_server_start(size_t stack_size, UBaseType_t priority);
 
+/**
+ * @brief Start the RTSP MJPEG server
+ *
+ * The camera must be initialized. Requests are routed to a mount by the
+ * path of their URL: rtsp://camera/preview/track1 belongs to "/preview".
+ * On the HTTP port, a mount's path serves it as an MJPEG stream.
+ *
+ * @param config Settings, copied
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for an unusable setting,
+ *         ESP_ERR_INVALID_STATE if the server runs, ESP_ERR_NO_MEM
+ */
+esp_err_t rtsp_mjpeg_server_start_config(const rtsp_mjpeg_config_t *config);
+
 /**
  * @brief Stop the RTSP MJPEG server
  *
- * @return ESP_OK on success
+ * The server's tasks finish what they are doing and exit. Every session is
+ * closed, the listening sockets too, and all frames go back to the camera
+ * driver. Takes up to a second, or as long as a capture in progress.
+ *
+ * @return ESP_OK, or ESP_ERR_INVALID_STATE if the server does not run
  */
 esp_err_t rtsp_mjpeg_server_stop(void);
 
+/**
+ * @brief Capture settings to change on a running server
+ */
+typedef struct {
+    framesize_t framesize;     /*!< Sensor frame size, FRAMESIZE_INVALID to keep it */
+    int quality;               /*!< Sensor JPEG quality, 0 (best) to 63, -1 to keep it */
+    uint8_t fps;               /*!< Capture rate, 0 to keep it; mount caps still apply */
+} rtsp_mjpeg_reconfig_t;
+
+#define RTSP_MJPEG_RECONFIG_KEEP() {                        \
+    .framesize = FRAMESIZE_INVALID,                         \
+    .quality = -1,                                          \
+    .fps = 0,                                               \
+}
+
+/**
+ * @brief Change frame size, JPEG quality or frame rate without dropping viewers
+ *
+ * Sessions keep their SSRC, RTP sequence numbers and timestamp clock. Every
+ * RTP/JPEG packet carries the size of its frame, and new quantization tables
+ * go in-band, so players follow without reconnecting. DESCRIBE answers with
+ * the new size and rate. Frames captured before the change are still sent as
+ * they are. The change is made by the transmit task before its next frame,
+ * where bitrate adaptation (CONFIG_RTSP_MJPEG_ABR) also drives the sensor;
+ * adaptation then starts over from the new settings.
+ *
+ * @param rc Settings to change
+ * @return ESP_OK,
+ *         ESP_ERR_INVALID_ARG for a quality or frame size the sensor doesn't have,
+ *         ESP_ERR_INVALID_SIZE if frames of that size would not fit the camera's
+ *         frame buffers, which esp_camera_init() sized,
+ *         ESP_ERR_NOT_SUPPORTED if the sensor can't change the setting,
+ *         ESP_ERR_INVALID_STATE if the server does not run
+ */
+esp_err_t rtsp_mjpeg_reconfigure(const rtsp_mjpeg_reconfig_t *rc);
+
+/**
+ * @brief Get a snapshot of the packet pacing statistics
+ *
+ * @param[out] stats Filled with the current counters
+ * @return ESP_OK, or ESP_ERR_INVALID_ARG if stats is NULL
+ */
+esp_err_t rtsp_mjpeg_get_pacing_stats(rtsp_mjpeg_pacing_stats_t *stats);
+
+/**
+ * @brief Get RTCP statistics of every session that has set up a transport
+ *
+ * @param[out] stats Array receiving one entry per session
+ * @param max        Number of entries in stats
+ * @param[out] count Number of entries filled
+ * @return ESP_OK, or ESP_ERR_INVALID_ARG on NULL arguments
+ */
+esp_err_t rtsp_mjpeg_get_rtcp_stats(rtsp_mjpeg_rtcp_stats_t *stats, size_t max, size_t *count);
+
+/**
+ * @brief Get server-wide and per-session streaming metrics
+ *
+ * Also served as text at /metrics on the HTTP port when
+ * CONFIG_RTSP_MJPEG_METRICS_HTTP is set.
+ *
+ * @param[out] server   Server counters, or NULL
+ * @param[out] sessions Array receiving one entry per session, or NULL
+ * @param max           Number of entries in sessions
+ * @param[out] count    Number of entries filled, or NULL
+ * @return ESP_OK, or ESP_ERR_INVALID_ARG if sessions is given without count
+ */
+esp_err_t rtsp_mjpeg_get_metrics(rtsp_mjpeg_server_metrics_t *server,
+                                 rtsp_mjpeg_session_metrics_t *sessions, size_t max, size_t *count);
+
+/**
+ * @brief Take a reference to the latest captured frame
+ *
+ * No capture is made: the frame is the one the server last handed to its
+ * viewers, so it is as old as the last time anyone watched. The camera
+ * buffer stays out of the driver's hands until released. With the default
+ * CONFIG_CAMERA_FB_COUNT of 2 that leaves the capture task one buffer at
+ * most, so holding the frame stalls capture and every viewer. Release it
+ * within one frame period (1 / the server's fps); copy buf to keep the
+ * JPEG longer.
+ *
+ * @param[out] snap Filled with the frame
+ * @return ESP_OK, ESP_ERR_NOT_FOUND if no frame was captured yet,
+ *         ESP_ERR_INVALID_STATE if the server never started
+ */
+esp_err_t rtsp_mjpeg_snapshot_get(rtsp_mjpeg_snapshot_t *snap);
+
+/**
+ * @brief Give back a frame from rtsp_mjpeg_snapshot_get()
+ */
+void rtsp_mjpeg_snapshot_release(rtsp_mjpeg_snapshot_t *snap);
+
 #ifdef __cplusplus
 }
 #endif
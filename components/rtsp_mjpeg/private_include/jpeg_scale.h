@@ -0,0 +1,56 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Buffers kept from one scaled frame to the next
+ *
+ * Zero-initialize before first use. The picture buffer grows to the
+ * largest scaled frame seen and is never shrunk.
+ */
+typedef struct {
+    uint8_t *pixels;           /*!< Decoded picture, RGB565 big-endian */
+    size_t pixels_size;
+    uint8_t *work;             /*!< Decoder scratch area */
+} jpeg_scaler_t;
+
+/**
+ * @brief Decode a JPEG at 1/scale of its size and encode it again
+ *
+ * The output is baseline 4:2:0 with the standard Huffman tables, i.e. RFC 2435
+ * type 1. Its width and height are cut down to multiples of 16 so they fit
+ * the 8 pixel units of the RTP/JPEG header and whole MCUs.
+ *
+ * @param sc       Buffers, reused between calls
+ * @param jpeg     Input JPEG
+ * @param len      Bytes in jpeg
+ * @param scale    2, 4 or 8
+ * @param quality  Encoder quality, 1 (worst) to 100
+ * @param out      Receives the encoded frame
+ * @param out_size Room in out
+ * @param out_len  Bytes written to out
+ * @param width    Width of the output
+ * @param height   Height of the output
+ * @return ESP_OK,
+ *         ESP_ERR_INVALID_ARG for a bad scale,
+ *         ESP_ERR_NOT_SUPPORTED if the input is smaller than one MCU once scaled,
+ *         ESP_ERR_INVALID_SIZE if the output did not fit in out,
+ *         ESP_ERR_NO_MEM, ESP_FAIL for an input that does not decode
+ */
+esp_err_t jpeg_scaler_run(jpeg_scaler_t *sc, const uint8_t *jpeg, size_t len, uint8_t scale,
+                          uint8_t quality, uint8_t *out, size_t out_size, size_t *out_len,
+                          uint16_t *width, uint16_t *height);
+
+/**
+ * @brief Release the buffers
+ */
+void jpeg_scaler_free(jpeg_scaler_t *sc);
+
+#ifdef __cplusplus
+}
+#endif
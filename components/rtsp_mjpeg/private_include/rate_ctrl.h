@@ -0,0 +1,72 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "sensor.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RATE_CTRL_MAX_RUNGS 8
+
+/**
+ * @brief Network feedback collected over one control period
+ */
+typedef struct {
+    uint32_t packets;          /*!< RTP packets sent */
+    uint32_t send_errors;      /*!< ENOBUFS and dropped packets */
+    uint32_t frames;           /*!< Frames sent */
+    uint32_t frames_skipped;   /*!< Frames a TCP viewer's queue had no room for */
+    uint32_t max_frame_us;     /*!< Longest time to send one frame */
+    uint32_t frame_budget_us;  /*!< Time the pacer was given per frame */
+    uint32_t frame_period_us;
+    int32_t rtcp_loss;         /*!< Worst fraction lost in new receiver reports (1/256), -1 if none */
+    uint32_t rtcp_jitter_us;   /*!< Worst jitter in new receiver reports */
+} rate_ctrl_input_t;
+
+/**
+ * @brief Closed-loop JPEG quality and frame size controller
+ *
+ * Degrades one step as soon as a period shows congestion, first by
+ * raising the JPEG quality number, then by stepping down the frame size
+ * ladder. Upgrades only after several clean periods in a row, so the
+ * stream does not oscillate around the link capacity.
+ */
+typedef struct {
+    framesize_t ladder[RATE_CTRL_MAX_RUNGS]; /*!< Largest frame size first */
+    int rungs;
+    int rung;
+    int quality;               /*!< Current sensor quality, lower is better */
+    int base_quality;
+    int max_quality;
+    int quality_step;
+    int upgrade_periods;       /*!< Clean periods needed before stepping up */
+    int clean_periods;
+    uint32_t changes;
+} rate_ctrl_t;
+
+/**
+ * @brief Set up the controller at full quality
+ *
+ * @param ladder  Comma separated framesize_t values, largest first. Sizes
+ *                above top are skipped since frame buffers are sized for top.
+ * @param top     Frame size to start from; the frame buffers must hold it
+ */
+void rate_ctrl_init(rate_ctrl_t *rc, const char *ladder, framesize_t top,
+                    int base_quality, int max_quality, int quality_step, int upgrade_periods);
+
+/**
+ * @brief Feed one period of feedback
+ *
+ * @return true if rc->quality or the current frame size changed
+ */
+bool rate_ctrl_update(rate_ctrl_t *rc, const rate_ctrl_input_t *in);
+
+static inline framesize_t rate_ctrl_framesize(const rate_ctrl_t *rc)
+{
+    return rc->ladder[rc->rung];
+}
+
+#ifdef __cplusplus
+}
+#endif
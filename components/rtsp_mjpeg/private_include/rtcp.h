@@ -0,0 +1,71 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Sender report plus an SDES chunk with a CNAME of up to 50 characters
+#define RTCP_SR_MAX_SIZE  (28 + 8 + 64)
+
+/**
+ * @brief Report block (RFC 3550 §6.4.1) a receiver sent about our stream
+ */
+typedef struct {
+    uint8_t fraction_lost;     /*!< Lost since the previous report, in 1/256 */
+    int32_t cumulative_lost;
+    uint32_t highest_seq;      /*!< Extended highest sequence number received */
+    uint32_t jitter;           /*!< Interarrival jitter in RTP timestamp units */
+    uint32_t lsr;              /*!< Middle 32 bits of the NTP time of our last SR */
+    uint32_t dlsr;             /*!< Delay since that SR, in 1/65536 s */
+} rtcp_report_block_t;
+
+/**
+ * @brief Current wallclock as a 64-bit NTP timestamp
+ */
+uint64_t rtcp_ntp_now(void);
+
+/**
+ * @brief Middle 32 bits of an NTP timestamp, the unit of LSR and DLSR
+ */
+static inline uint32_t rtcp_ntp_middle(uint64_t ntp)
+{
+    return (uint32_t)(ntp >> 16);
+}
+
+/**
+ * @brief Build a compound RTCP packet: SR without report blocks, then SDES CNAME
+ *
+ * @return Bytes written to out, 0 if size is too small
+ */
+size_t rtcp_build_sr(uint8_t *out, size_t size, uint32_t ssrc, uint64_t ntp,
+                     uint32_t rtp_ts, uint32_t packets, uint32_t octets, const char *cname);
+
+/**
+ * @brief Find the report block about ssrc in a compound SR/RR packet
+ *
+ * @return ESP_OK when found, ESP_ERR_NOT_FOUND if the packet holds none
+ *         for ssrc, ESP_ERR_INVALID_ARG if it is malformed
+ */
+esp_err_t rtcp_parse_report(const uint8_t *buf, size_t len, uint32_t ssrc,
+                            rtcp_report_block_t *rb);
+
+/**
+ * @brief Collect the sequence numbers Generic NACKs (RFC 4585 §6.2.1) about ssrc ask for
+ *
+ * Every NACK in the compound packet counts, in the order given.
+ *
+ * @param seqs  Receives the sequence numbers
+ * @param max   Room in seqs; later ones are left out
+ * @param count Sequence numbers written
+ * @return ESP_OK when at least one NACK about ssrc was found, ESP_ERR_NOT_FOUND
+ *         if there is none, ESP_ERR_INVALID_ARG if the packet is malformed
+ */
+esp_err_t rtcp_parse_nack(const uint8_t *buf, size_t len, uint32_t ssrc,
+                          uint16_t *seqs, size_t max, size_t *count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,90 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A packet kept for retransmission
+ */
+typedef struct {
+    uint16_t seq;
+    uint16_t hdr_len;          /*!< RTP and RTP/JPEG headers, always copied */
+    uint16_t payload_len;
+    uint8_t resends;
+    bool used;
+    int64_t sent_us;
+    const uint8_t *payload;    /*!< In the frame buffer while it is held, else NULL */
+    uint32_t hdr_pos;          /*!< Position of the headers in the data ring */
+    uint32_t payload_pos;      /*!< Position of the copied payload, once payload is NULL */
+} rtp_history_entry_t;
+
+/**
+ * @brief Recently sent RTP packets of one stream, within a fixed memory budget
+ *
+ * Headers are copied into a byte ring as packets are sent; payloads are
+ * only referenced in the frame buffer while the sender holds the frame.
+ * Before the frame goes back, rtp_history_detach() copies them into the
+ * ring too. The ring overwrites the oldest packets, so what is kept is
+ * always the newest that fit. Zero-initialize before rtp_history_init().
+ */
+typedef struct {
+    rtp_history_entry_t *entries;  /*!< Indexed by sequence number modulo the count */
+    uint16_t entry_mask;
+    uint8_t *data;
+    uint32_t size;
+    uint32_t head;             /*!< Offset in data where the next bytes go */
+    uint32_t end;              /*!< Bytes ever written, wrap gaps included */
+    uint16_t frame_first;      /*!< First packet still referencing the frame buffer */
+    uint16_t frame_packets;
+} rtp_history_t;
+
+/**
+ * @brief Allocate the data ring and the entry table for it
+ *
+ * @param size Data ring bytes: headers and payloads of the packets kept
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for a size too small to hold a
+ *         packet, ESP_ERR_NO_MEM
+ */
+esp_err_t rtp_history_init(rtp_history_t *h, size_t size);
+
+/**
+ * @brief Release the buffers; the history may be initialized again
+ */
+void rtp_history_free(rtp_history_t *h);
+
+/**
+ * @brief Record a packet just sent
+ *
+ * @param hdr     Headers, copied
+ * @param payload Bytes in the current frame buffer, referenced until
+ *                rtp_history_detach()
+ * @param sent_us When the packet, or its frame, was sent
+ */
+void rtp_history_add(rtp_history_t *h, uint16_t seq, const uint8_t *hdr, size_t hdr_len,
+                     const uint8_t *payload, size_t payload_len, int64_t sent_us);
+
+/**
+ * @brief Copy the payloads that still reference the frame buffer into the ring
+ *
+ * Call before the frame buffer passed to rtp_history_add() is released.
+ */
+void rtp_history_detach(rtp_history_t *h);
+
+/**
+ * @brief Look a packet up for retransmission
+ *
+ * @param hdr     Set to the headers
+ * @param payload Set to the payload
+ * @return The entry, to count resends on, or NULL if seq is no longer kept
+ */
+rtp_history_entry_t *rtp_history_find(rtp_history_t *h, uint16_t seq,
+                                      const uint8_t **hdr, const uint8_t **payload);
+
+#ifdef __cplusplus
+}
+#endif
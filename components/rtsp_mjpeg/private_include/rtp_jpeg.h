@@ -0,0 +1,93 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_camera.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Largest RFC 2435 payload header: main (8) + restart marker (4) +
+// quantization table header (4) + two 16-bit precision tables (2*128)
+#define RTP_JPEG_HDR_MAX      (8 + 4 + 4 + 2 * 128)
+// Header size of any fragment other than the first one
+#define RTP_JPEG_HDR_MIN_MAX  (8 + 4)
+
+/**
+ * @brief Result of parsing one baseline JPEG frame for RFC 2435
+ *
+ * Pointers reference the frame buffer, nothing is copied.
+ */
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    uint8_t type;               /*!< RFC 2435 type, 0 (4:2:2) or 1 (4:2:0), +64 with restart markers */
+    uint16_t restart_interval;  /*!< From DRI, 0 if absent */
+    uint8_t qt_precision;       /*!< Bit n set when table n has 16-bit entries */
+    const uint8_t *qt[2];       /*!< Luma and chroma tables in zig-zag order */
+    uint16_t qt_len[2];
+    bool std_huffman;           /*!< DHT absent or equal to ITU-T T.81 Annex K tables */
+    const uint8_t *scan;        /*!< Entropy-coded data, SOS header and EOI excluded */
+    size_t scan_len;
+} rtp_jpeg_frame_t;
+
+/**
+ * @brief Quantization tables last seen, and the Q value announcing them
+ *
+ * Q cycles through 128..254 whenever the tables change so receivers that
+ * cache tables per Q never apply stale ones.
+ */
+typedef struct {
+    uint8_t q;
+    uint8_t precision;
+    uint16_t len;
+    uint8_t tables[2 * 128];
+} rtp_jpeg_qt_cache_t;
+
+/**
+ * @brief Parse the markers of a JPEG frame (SOF0, DQT, DHT, DRI, SOS)
+ *
+ * @param buf   Frame starting with SOI
+ * @param len   Frame length
+ * @param frame Filled on success
+ * @return
+ *     - ESP_OK on success
+ *     - ESP_ERR_INVALID_ARG if the frame is malformed
+ *     - ESP_ERR_NOT_SUPPORTED if the frame can't be carried by RFC 2435
+ */
+esp_err_t rtp_jpeg_parse(const uint8_t *buf, size_t len, rtp_jpeg_frame_t *frame);
+
+/**
+ * @brief Parse a camera frame, using the driver's marker index when valid
+ *
+ * Jumps straight to the indexed segments instead of walking the header.
+ * Falls back to rtp_jpeg_parse() for frames without an index.
+ */
+esp_err_t rtp_jpeg_parse_fb(const camera_fb_t *fb, rtp_jpeg_frame_t *frame);
+
+/**
+ * @brief Record the frame's quantization tables
+ *
+ * @return Q value (128..254) to put in the payload headers of this frame
+ */
+uint8_t rtp_jpeg_qt_update(rtp_jpeg_qt_cache_t *cache, const rtp_jpeg_frame_t *frame);
+
+/**
+ * @brief Build the RFC 2435 payload header for one fragment
+ *
+ * @param out         At least RTP_JPEG_HDR_MAX bytes
+ * @param frame       Parsed frame
+ * @param qt          Tables and Q of the frame, from rtp_jpeg_qt_update()
+ * @param offset      Fragment offset into the scan data
+ * @param with_tables Include the table data in the first fragment; when false
+ *                    the Quantization Table header is sent with Length 0
+ * @return Header length in bytes
+ */
+size_t rtp_jpeg_build_header(uint8_t *out, const rtp_jpeg_frame_t *frame,
+                             const rtp_jpeg_qt_cache_t *qt, uint32_t offset, bool with_tables);
+
+#ifdef __cplusplus
+}
+#endif
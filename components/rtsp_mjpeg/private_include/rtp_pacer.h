@@ -0,0 +1,79 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "rtsp_mjpeg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Token bucket spreading each frame's packets over the frame interval
+ *
+ * Tokens are bytes. The rate is chosen per frame so the frame fits in a
+ * fraction of the frame interval, capped at a maximum bitrate. Waits
+ * shorter than min_wait_us (one scheduler tick) are not taken; the deficit
+ * is carried into the next wait so the average rate still holds.
+ */
+typedef struct {
+    uint32_t byte_rate;        /*!< Bytes per second, 0 = unpaced */
+    int32_t tokens;
+    int32_t burst;             /*!< Bucket depth in bytes */
+    uint32_t min_wait_us;
+    int64_t last_us;
+    int64_t frame_start_us;
+    rtsp_mjpeg_pacing_stats_t stats;
+} rtp_pacer_t;
+
+/**
+ * @brief Reset the pacer and its statistics
+ *
+ * @param burst       Bytes that may be sent back to back without waiting
+ * @param min_wait_us Shortest wait the caller can sleep
+ */
+void rtp_pacer_init(rtp_pacer_t *p, int32_t burst, uint32_t min_wait_us);
+
+/**
+ * @brief Pick the rate for a new frame
+ *
+ * @param frame_bytes Bytes about to be sent for this frame, all viewers together
+ * @param budget_us   Time the frame may take; 0 disables pacing
+ * @param max_rate    Upper bound on the rate in bytes per second, 0 = none
+ */
+void rtp_pacer_begin_frame(rtp_pacer_t *p, size_t frame_bytes, uint32_t budget_us,
+                           uint32_t max_rate, int64_t now_us);
+
+/**
+ * @brief Take tokens for bytes just sent
+ *
+ * @return Microseconds to wait before sending more, 0 to continue immediately
+ */
+uint32_t rtp_pacer_consume(rtp_pacer_t *p, size_t bytes, int64_t now_us);
+
+/**
+ * @brief Take tokens for bytes sent outside the frame, e.g. retransmissions
+ *
+ * The frame being sent waits for them at its next rtp_pacer_consume().
+ * Not counted in the frame statistics.
+ */
+void rtp_pacer_charge(rtp_pacer_t *p, size_t bytes, int64_t now_us);
+
+/**
+ * @brief Account a wait of wait_us that was actually slept
+ */
+void rtp_pacer_waited(rtp_pacer_t *p, uint32_t wait_us);
+
+/**
+ * @brief The stack refused a packet; drain the bucket so sending slows down
+ */
+void rtp_pacer_stall(rtp_pacer_t *p);
+
+/**
+ * @brief Record the send time of the frame begun last
+ */
+void rtp_pacer_end_frame(rtp_pacer_t *p, int64_t now_us);
+
+#ifdef __cplusplus
+}
+#endif
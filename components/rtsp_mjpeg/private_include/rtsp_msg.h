@@ -0,0 +1,87 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RTSP_MSG_MAX_HEADERS 24
+
+typedef enum {
+    RTSP_METHOD_UNKNOWN = 0,
+    RTSP_METHOD_OPTIONS,
+    RTSP_METHOD_DESCRIBE,
+    RTSP_METHOD_SETUP,
+    RTSP_METHOD_PLAY,
+    RTSP_METHOD_PAUSE,
+    RTSP_METHOD_TEARDOWN,
+    RTSP_METHOD_GET_PARAMETER,
+    RTSP_METHOD_SET_PARAMETER,
+    RTSP_METHOD_GET,           /*!< HTTP, on the HTTP port */
+} rtsp_method_t;
+
+/**
+ * @brief One request, parsed in place: every string points into the receive buffer
+ */
+typedef struct {
+    rtsp_method_t method;
+    const char *method_name;
+    const char *uri;
+    const char *version;       /*!< "RTSP/1.0", "HTTP/1.1", ... */
+    struct {
+        const char *name;
+        const char *value;     /*!< Surrounding whitespace removed, folded lines joined */
+    } headers[RTSP_MSG_MAX_HEADERS];
+    size_t header_count;
+    const char *body;          /*!< Content-Length bytes, not terminated */
+    size_t content_length;
+    size_t len;                /*!< Bytes the message takes in the buffer, body included */
+} rtsp_msg_t;
+
+/**
+ * @brief Incremental request parser over a connection's receive buffer
+ *
+ * Lines are examined as they arrive; bytes already looked at are not
+ * scanned again when more data comes in. Once the headers are complete
+ * they are split in place, so only the body length is checked afterwards.
+ */
+typedef struct {
+    size_t line_start;         /*!< Start of the first line not yet complete */
+    size_t start;              /*!< Request line, after empty lines between messages */
+    bool started;
+    size_t header_len;         /*!< Up to and including the blank line, 0 until seen */
+    rtsp_msg_t msg;
+} rtsp_parser_t;
+
+/**
+ * @brief Start over at the beginning of the buffer, for the next message
+ */
+void rtsp_parser_reset(rtsp_parser_t *p);
+
+/**
+ * @brief Continue parsing the message at the start of buf
+ *
+ * Call whenever data was appended to buf. After ESP_OK the message is in
+ * p->msg and occupies the first p->msg.len bytes; remove them and reset
+ * the parser before calling again. The header part of buf is modified.
+ *
+ * @param buf Receive buffer, message first
+ * @param len Bytes in buf
+ * @return ESP_OK when a message is complete,
+ *         ESP_ERR_NOT_FINISHED when more data is needed,
+ *         ESP_ERR_INVALID_ARG for a malformed request line or header; p->msg.len
+ *         is still set so the message can be answered and skipped,
+ *         ESP_ERR_INVALID_SIZE for too many headers or an unusable Content-Length
+ */
+esp_err_t rtsp_parser_run(rtsp_parser_t *p, char *buf, size_t len);
+
+/**
+ * @brief Value of a header, name compared without case, or NULL
+ */
+const char *rtsp_msg_header(const rtsp_msg_t *msg, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
@@ -37,7 +37,8 @@ esp_err_t init_camera(void) {
 #if defined(CONFIG_IDF_TARGET_ESP32S3)
         .fb_location    = CAMERA_FB_IN_DRAM,
 #endif
-        .grab_mode      = CAMERA_GRAB_WHEN_EMPTY,
+        // With spare buffers, hand out the newest frame rather than a queued one
+        .grab_mode      = (CAMERA_FB_COUNT > 1) ? CAMERA_GRAB_LATEST : CAMERA_GRAB_WHEN_EMPTY,
     };
 
     esp_err_t err = esp_camera_init(&config);
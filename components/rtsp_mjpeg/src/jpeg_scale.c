@@ -0,0 +1,128 @@
+// Reduced size copy of a JPEG frame: scaled decode with esp_jpeg (TJpgDec
+// skips the IDCT terms the smaller picture can't show), then a jpge encode
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "jpeg_decoder.h"
+#include "img_converters.h"
+#include "jpeg_scale.h"
+#include "sdkconfig.h"
+
+// Scratch area for TJpgDec. esp_jpeg's 3100 byte default is short for 4:2:0
+// frames with two quantization tables; the Huffman lookup tables need much more
+#if defined(CONFIG_JD_FASTDECODE) && CONFIG_JD_FASTDECODE == 2
+#define JPEG_SCALE_WORK_SIZE 65472
+#else
+#define JPEG_SCALE_WORK_SIZE 4096
+#endif
+// RFC 2435 sizes are in 8 pixel units, and 4:2:0 MCUs are 16x16
+#define JPEG_SCALE_ALIGN 16
+
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+} scale_out_t;
+
+static uint8_t *scale_alloc(size_t size)
+{
+    // Pictures are large and touched once per frame; keep them out of internal RAM
+    uint8_t *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return p ? p : heap_caps_malloc(size, MALLOC_CAP_8BIT);
+}
+
+static size_t scale_write(void *arg, size_t index, const void *data, size_t len)
+{
+    scale_out_t *out = arg;
+    if (out->overflow || len > out->size - out->len) {
+        out->overflow = true;
+        return 0;
+    }
+    memcpy(out->buf + out->len, data, len);
+    out->len += len;
+    return len;
+}
+
+esp_err_t jpeg_scaler_run(jpeg_scaler_t *sc, const uint8_t *jpeg, size_t len, uint8_t scale,
+                          uint8_t quality, uint8_t *out, size_t out_size, size_t *out_len,
+                          uint16_t *width, uint16_t *height)
+{
+    esp_jpeg_image_scale_t jscale;
+    switch (scale) {
+    case 2: jscale = JPEG_IMAGE_SCALE_1_2; break;
+    case 4: jscale = JPEG_IMAGE_SCALE_1_4; break;
+    case 8: jscale = JPEG_IMAGE_SCALE_1_8; break;
+    default: return ESP_ERR_INVALID_ARG;
+    }
+    if (!sc->work) {
+        sc->work = malloc(JPEG_SCALE_WORK_SIZE);
+        if (!sc->work) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    // Big-endian RGB565 is what the encoder's PIXFORMAT_RGB565 reads
+    esp_jpeg_image_cfg_t cfg = {
+        .indata = (uint8_t *)jpeg,
+        .indata_size = len,
+        .out_format = JPEG_IMAGE_FORMAT_RGB565,
+        .out_scale = jscale,
+        .flags.swap_color_bytes = 1,
+        .advanced.working_buffer = sc->work,
+        .advanced.working_buffer_size = JPEG_SCALE_WORK_SIZE,
+    };
+    esp_jpeg_image_output_t img;
+    if (esp_jpeg_get_image_info(&cfg, &img) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (img.output_len > sc->pixels_size) {
+        free(sc->pixels);
+        sc->pixels = scale_alloc(img.output_len);
+        sc->pixels_size = sc->pixels ? img.output_len : 0;
+        if (!sc->pixels) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    cfg.outbuf = sc->pixels;
+    cfg.outbuf_size = sc->pixels_size;
+    esp_err_t err = esp_jpeg_decode(&cfg, &img);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // Crop right and bottom edges to whole MCUs; rows are packed to the
+    // new width in place, front to back
+    uint16_t w = img.width & ~(JPEG_SCALE_ALIGN - 1);
+    uint16_t h = img.height & ~(JPEG_SCALE_ALIGN - 1);
+    if (!w || !h) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (w != img.width) {
+        for (uint16_t y = 1; y < h; y++) {
+            memmove(sc->pixels + (size_t)y * w * 2, sc->pixels + (size_t)y * img.width * 2, (size_t)w * 2);
+        }
+    }
+
+    scale_out_t o = { .buf = out, .size = out_size };
+    if (!fmt2jpg_cb(sc->pixels, (size_t)w * h * 2, w, h, PIXFORMAT_RGB565, quality, scale_write, &o)) {
+        return ESP_FAIL;
+    }
+    if (o.overflow) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *out_len = o.len;
+    *width = w;
+    *height = h;
+    return ESP_OK;
+}
+
+void jpeg_scaler_free(jpeg_scaler_t *sc)
+{
+    free(sc->pixels);
+    free(sc->work);
+    memset(sc, 0, sizeof(*sc));
+}
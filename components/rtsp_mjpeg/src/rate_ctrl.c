@@ -0,0 +1,144 @@
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "rate_ctrl.h"
+
+static const char *TAG = "rate_ctrl";
+
+// Congested: any of these in a period
+#define CONGESTED_ERROR_PERMILLE  20    // send errors per packet
+#define CONGESTED_BACKLOG_PERCENT 125   // frame send time vs pacing budget
+#define CONGESTED_LOSS            13    // 1/256, about 5%
+// Clean: all of these in a period; in between the level is held
+#define CLEAN_BACKLOG_PERCENT     105
+#define CLEAN_LOSS                3     // about 1%
+
+void rate_ctrl_init(rate_ctrl_t *rc, const char *ladder, framesize_t top,
+                    int base_quality, int max_quality, int quality_step, int upgrade_periods)
+{
+    rc->rungs = 0;
+    const char *p = ladder;
+    while (p && *p && rc->rungs < RATE_CTRL_MAX_RUNGS) {
+        char *end;
+        long fs = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        if (fs >= 0 && fs <= top && fs < FRAMESIZE_INVALID &&
+            (rc->rungs == 0 || fs < rc->ladder[rc->rungs - 1])) {
+            rc->ladder[rc->rungs++] = fs;
+        } else {
+            ESP_LOGW(TAG, "Skipping frame size %ld in ladder", fs);
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+    // Never scale above the size the camera was set up for
+    if (rc->rungs == 0 || rc->ladder[0] != top) {
+        if (rc->rungs == RATE_CTRL_MAX_RUNGS) {
+            rc->rungs--;
+        }
+        for (int i = rc->rungs; i > 0; i--) {
+            rc->ladder[i] = rc->ladder[i - 1];
+        }
+        rc->ladder[0] = top;
+        rc->rungs++;
+    }
+
+    rc->rung = 0;
+    rc->base_quality = base_quality;
+    rc->max_quality = max_quality > base_quality ? max_quality : base_quality;
+    rc->quality_step = quality_step > 0 ? quality_step : 1;
+    rc->quality = base_quality;
+    rc->upgrade_periods = upgrade_periods;
+    rc->clean_periods = 0;
+    rc->changes = 0;
+}
+
+static bool rate_ctrl_degrade(rate_ctrl_t *rc)
+{
+    if (rc->quality < rc->max_quality) {
+        rc->quality += rc->quality_step;
+        if (rc->quality > rc->max_quality) {
+            rc->quality = rc->max_quality;
+        }
+        return true;
+    }
+    if (rc->rung + 1 < rc->rungs) {
+        // A smaller frame at full quality is usually smaller than the
+        // current frame at the worst quality
+        rc->rung++;
+        rc->quality = rc->base_quality;
+        return true;
+    }
+    return false;
+}
+
+static bool rate_ctrl_upgrade(rate_ctrl_t *rc)
+{
+    if (rc->quality > rc->base_quality) {
+        rc->quality -= rc->quality_step;
+        if (rc->quality < rc->base_quality) {
+            rc->quality = rc->base_quality;
+        }
+        return true;
+    }
+    if (rc->rung > 0) {
+        // Step up at the worst quality and improve from there
+        rc->rung--;
+        rc->quality = rc->max_quality;
+        return true;
+    }
+    return false;
+}
+
+bool rate_ctrl_update(rate_ctrl_t *rc, const rate_ctrl_input_t *in)
+{
+    if (in->frames == 0 && in->frames_skipped == 0) {
+        return false;  // nothing was sent, nothing was learned
+    }
+
+    uint32_t error_permille = in->packets ? in->send_errors * 1000 / in->packets : 0;
+    // Paced frames take about their whole budget; running over means the
+    // rate cap or stalls in the stack held them back
+    uint32_t backlog_percent = in->frame_budget_us ?
+        (uint64_t)in->max_frame_us * 100 / in->frame_budget_us : 0;
+
+    bool congested = error_permille >= CONGESTED_ERROR_PERMILLE ||
+                     backlog_percent >= CONGESTED_BACKLOG_PERCENT ||
+                     in->frames_skipped > 0 ||
+                     in->rtcp_loss >= CONGESTED_LOSS ||
+                     in->rtcp_jitter_us > in->frame_period_us;
+    bool clean = in->send_errors == 0 &&
+                 backlog_percent < CLEAN_BACKLOG_PERCENT &&
+                 in->rtcp_loss < CLEAN_LOSS &&
+                 in->rtcp_jitter_us < in->frame_period_us / 2;
+
+    bool changed = false;
+    if (congested) {
+        rc->clean_periods = 0;
+        changed = rate_ctrl_degrade(rc);
+        if (changed) {
+            ESP_LOGI(TAG, "Congestion (errors %lu/1000, backlog %lu%%, skipped %lu, loss %ld/256), "
+                     "stepping down to frame size %d, quality %d",
+                     (unsigned long)error_permille, (unsigned long)backlog_percent,
+                     (unsigned long)in->frames_skipped, (long)in->rtcp_loss,
+                     rate_ctrl_framesize(rc), rc->quality);
+        }
+    } else if (clean) {
+        if (++rc->clean_periods >= rc->upgrade_periods) {
+            rc->clean_periods = 0;
+            changed = rate_ctrl_upgrade(rc);
+            if (changed) {
+                ESP_LOGI(TAG, "Link clean, stepping up to frame size %d, quality %d",
+                         rate_ctrl_framesize(rc), rc->quality);
+            }
+        }
+    } else {
+        rc->clean_periods = 0;
+    }
+
+    if (changed) {
+        rc->changes++;
+    }
+    return changed;
+}
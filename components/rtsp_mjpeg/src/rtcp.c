@@ -0,0 +1,158 @@
+#include <stdbool.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "rtcp.h"
+
+#define RTCP_SR    200
+#define RTCP_RR    201
+#define RTCP_SDES  202
+#define RTCP_RTPFB 205
+
+#define RTPFB_NACK 1
+
+#define SDES_CNAME 1
+
+// Seconds from 1900 (NTP epoch) to 1970 (Unix epoch)
+#define NTP_UNIX_OFFSET 2208988800ULL
+
+static inline uint32_t be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+uint64_t rtcp_ntp_now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    uint64_t frac = ((uint64_t)tv.tv_usec << 32) / 1000000;
+    return ((uint64_t)(tv.tv_sec + NTP_UNIX_OFFSET) << 32) | frac;
+}
+
+size_t rtcp_build_sr(uint8_t *out, size_t size, uint32_t ssrc, uint64_t ntp,
+                     uint32_t rtp_ts, uint32_t packets, uint32_t octets, const char *cname)
+{
+    size_t cname_len = strlen(cname);
+    if (cname_len > 255) {
+        cname_len = 255;
+    }
+    // SDES chunk: SSRC, CNAME item, at least one zero byte, padded to 32 bits
+    size_t sdes_len = (4 + 4 + 2 + cname_len + 1 + 3) & ~3;
+    if (size < 28 + sdes_len) {
+        return 0;
+    }
+
+    // Sender report (RFC 3550 §6.4.1), no report blocks since we receive nothing
+    out[0] = 0x80;
+    out[1] = RTCP_SR;
+    out[2] = 0;
+    out[3] = 6;                 // length in 32-bit words minus one
+    put_be32(out + 4, ssrc);
+    put_be32(out + 8, ntp >> 32);
+    put_be32(out + 12, (uint32_t)ntp);
+    put_be32(out + 16, rtp_ts);
+    put_be32(out + 20, packets);
+    put_be32(out + 24, octets);
+
+    // Source description with the CNAME every compound packet must carry (§6.5)
+    uint8_t *p = out + 28;
+    memset(p, 0, sdes_len);
+    p[0] = 0x81;                // one chunk
+    p[1] = RTCP_SDES;
+    p[2] = 0;
+    p[3] = sdes_len / 4 - 1;
+    put_be32(p + 4, ssrc);
+    p[8] = SDES_CNAME;
+    p[9] = cname_len;
+    memcpy(p + 10, cname, cname_len);
+    return 28 + sdes_len;
+}
+
+esp_err_t rtcp_parse_report(const uint8_t *buf, size_t len, uint32_t ssrc,
+                            rtcp_report_block_t *rb)
+{
+    size_t pos = 0;
+
+    while (pos + 4 <= len) {
+        const uint8_t *pkt = &buf[pos];
+        if ((pkt[0] >> 6) != 2) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        size_t pkt_len = 4 * (((pkt[2] << 8) | pkt[3]) + 1);
+        if (pos + pkt_len > len) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        // Report blocks follow the sender SSRC (RR) or the sender info (SR)
+        size_t blocks = 0;
+        if (pkt[1] == RTCP_RR) {
+            blocks = 8;
+        } else if (pkt[1] == RTCP_SR) {
+            blocks = 28;
+        }
+        if (blocks) {
+            int count = pkt[0] & 0x1F;
+            for (int i = 0; i < count && blocks + 24 <= pkt_len; i++, blocks += 24) {
+                const uint8_t *b = &pkt[blocks];
+                if (be32(b) != ssrc) continue;
+                rb->fraction_lost = b[4];
+                // 24-bit two's complement
+                int32_t lost = ((int32_t)b[5] << 16) | (b[6] << 8) | b[7];
+                rb->cumulative_lost = (lost & 0x800000) ? lost - 0x1000000 : lost;
+                rb->highest_seq = be32(b + 8);
+                rb->jitter = be32(b + 12);
+                rb->lsr = be32(b + 16);
+                rb->dlsr = be32(b + 20);
+                return ESP_OK;
+            }
+        }
+        pos += pkt_len;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t rtcp_parse_nack(const uint8_t *buf, size_t len, uint32_t ssrc,
+                          uint16_t *seqs, size_t max, size_t *count)
+{
+    size_t pos = 0;
+    bool found = false;
+
+    *count = 0;
+    while (pos + 4 <= len) {
+        const uint8_t *pkt = &buf[pos];
+        if ((pkt[0] >> 6) != 2) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        size_t pkt_len = 4 * (((pkt[2] << 8) | pkt[3]) + 1);
+        if (pos + pkt_len > len) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        // Sender SSRC, media SSRC, then FCI entries: a lost packet ID and a
+        // bitmask of the 16 packets after it that were lost as well
+        if (pkt[1] == RTCP_RTPFB && (pkt[0] & 0x1F) == RTPFB_NACK && pkt_len >= 12 &&
+            be32(pkt + 8) == ssrc) {
+            found = true;
+            for (size_t f = 12; f + 4 <= pkt_len; f += 4) {
+                uint16_t pid = (pkt[f] << 8) | pkt[f + 1];
+                uint16_t blp = (pkt[f + 2] << 8) | pkt[f + 3];
+                for (int bit = -1; bit < 16; bit++) {
+                    if (bit >= 0 && !(blp & (1 << bit))) continue;
+                    if (*count < max) {
+                        seqs[(*count)++] = pid + bit + 1;
+                    }
+                }
+            }
+        }
+        pos += pkt_len;
+    }
+    return found ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
@@ -0,0 +1,144 @@
+// Sent RTP packets kept for NACK retransmission (RFC 4585 §6.2.1)
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "rtp_history.h"
+
+// One entry per this many ring bytes: small packets still find a slot, and
+// a table of 2^n entries is indexed by the low bits of the sequence number
+#define HISTORY_BYTES_PER_ENTRY 256
+#define HISTORY_ENTRIES_MIN     32
+#define HISTORY_ENTRIES_MAX     1024
+// At least one UDP packet of the largest size
+#define HISTORY_SIZE_MIN        1472
+
+esp_err_t rtp_history_init(rtp_history_t *h, size_t size)
+{
+    if (size < HISTORY_SIZE_MIN || size > UINT32_MAX / 2) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t count = HISTORY_ENTRIES_MIN;
+    while (count < HISTORY_ENTRIES_MAX && count * HISTORY_BYTES_PER_ENTRY < size) {
+        count *= 2;
+    }
+
+    memset(h, 0, sizeof(*h));
+    // Read back only on loss; the ring can live in slower PSRAM
+    h->data = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!h->data) {
+        h->data = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    }
+    h->entries = calloc(count, sizeof(*h->entries));
+    if (!h->data || !h->entries) {
+        rtp_history_free(h);
+        return ESP_ERR_NO_MEM;
+    }
+    h->size = size;
+    h->entry_mask = count - 1;
+    return ESP_OK;
+}
+
+void rtp_history_free(rtp_history_t *h)
+{
+    free(h->data);
+    free(h->entries);
+    memset(h, 0, sizeof(*h));
+}
+
+// Contiguous room for len bytes; skips the rest of the ring at its end
+static uint8_t *history_alloc(rtp_history_t *h, size_t len, uint32_t *pos)
+{
+    if (len > h->size) {
+        return NULL;
+    }
+    if (h->head + len > h->size) {
+        h->end += h->size - h->head;
+        h->head = 0;
+    }
+    uint8_t *p = h->data + h->head;
+    *pos = h->end;
+    h->head += len;
+    h->end += len;
+    return p;
+}
+
+// Bytes written at pos are intact until the ring has gone once around
+static bool history_valid(const rtp_history_t *h, uint32_t pos)
+{
+    return h->end - pos <= h->size;
+}
+
+static uint8_t *history_at(const rtp_history_t *h, uint32_t pos)
+{
+    // head is where end points to; pos lies less than one ring behind it
+    uint32_t back = h->end - pos;
+    return h->data + (back <= h->head ? h->head - back : h->size - (back - h->head));
+}
+
+void rtp_history_add(rtp_history_t *h, uint16_t seq, const uint8_t *hdr, size_t hdr_len,
+                     const uint8_t *payload, size_t payload_len, int64_t sent_us)
+{
+    rtp_history_entry_t *e = &h->entries[seq & h->entry_mask];
+    e->used = false;
+    uint32_t pos;
+    uint8_t *p = history_alloc(h, hdr_len, &pos);
+    if (!p) {
+        return;
+    }
+    memcpy(p, hdr, hdr_len);
+    e->seq = seq;
+    e->hdr_len = hdr_len;
+    e->payload_len = payload_len;
+    e->resends = 0;
+    e->sent_us = sent_us;
+    e->payload = payload;
+    e->hdr_pos = pos;
+    e->used = true;
+
+    if (!h->frame_packets) {
+        h->frame_first = seq;
+    }
+    h->frame_packets++;
+}
+
+void rtp_history_detach(rtp_history_t *h)
+{
+    for (uint16_t i = 0; i < h->frame_packets; i++) {
+        rtp_history_entry_t *e = &h->entries[(uint16_t)(h->frame_first + i) & h->entry_mask];
+        if (!e->used || !e->payload) {
+            continue;
+        }
+        uint32_t pos;
+        uint8_t *p = NULL;
+        // A frame larger than the ring overwrites its own first packets
+        if (history_valid(h, e->hdr_pos)) {
+            p = history_alloc(h, e->payload_len, &pos);
+        }
+        if (p) {
+            memcpy(p, e->payload, e->payload_len);
+            e->payload_pos = pos;
+        } else {
+            e->used = false;
+        }
+        e->payload = NULL;
+    }
+    h->frame_packets = 0;
+}
+
+rtp_history_entry_t *rtp_history_find(rtp_history_t *h, uint16_t seq,
+                                      const uint8_t **hdr, const uint8_t **payload)
+{
+    if (!h->entries) {
+        return NULL;
+    }
+    rtp_history_entry_t *e = &h->entries[seq & h->entry_mask];
+    // The payload was copied after the headers, so it is intact if they are
+    if (!e->used || e->seq != seq || !history_valid(h, e->hdr_pos)) {
+        return NULL;
+    }
+    *hdr = history_at(h, e->hdr_pos);
+    *payload = e->payload ? e->payload : history_at(h, e->payload_pos);
+    return e;
+}
@@ -0,0 +1,340 @@
+#include <string.h>
+
+#include "esp_log.h"
+#include "rtp_jpeg.h"
+
+static const char *TAG = "rtp_jpeg";
+
+#define JPEG_SOI   0xD8
+#define JPEG_EOI   0xD9
+#define JPEG_SOF0  0xC0
+#define JPEG_DHT   0xC4
+#define JPEG_DQT   0xDB
+#define JPEG_DRI   0xDD
+#define JPEG_SOS   0xDA
+
+// RFC 2435 carries width and height in 8-pixel units in one byte
+#define RTP_JPEG_MAX_DIMENSION 2040
+
+// Huffman tables of ITU-T T.81 Annex K.3: code length counts and symbol
+// values. RFC 2435 receivers rebuild these instead of receiving DHT.
+static const uint8_t std_dc_luma_bits[16]   = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t std_dc_chroma_bits[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t std_ac_luma_bits[16]   = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const uint8_t std_ac_chroma_bits[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const uint8_t std_dc_vals[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const uint8_t std_ac_luma_vals[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+static const uint8_t std_ac_chroma_vals[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+// By table class and destination, the first byte of each DHT table
+typedef struct {
+    uint8_t id;
+    const uint8_t *bits;
+    const uint8_t *vals;
+    size_t count;
+} std_table_t;
+
+static const std_table_t std_tables[] = {
+    { 0x00, std_dc_luma_bits,   std_dc_vals,        sizeof(std_dc_vals) },
+    { 0x01, std_dc_chroma_bits, std_dc_vals,        sizeof(std_dc_vals) },
+    { 0x10, std_ac_luma_bits,   std_ac_luma_vals,   sizeof(std_ac_luma_vals) },
+    { 0x11, std_ac_chroma_bits, std_ac_chroma_vals, sizeof(std_ac_chroma_vals) },
+};
+
+static inline uint16_t be16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+// Check a DHT segment body (may hold several tables) against Annex K
+static bool dht_is_standard(const uint8_t *seg, size_t len)
+{
+    size_t pos = 0;
+    while (pos + 17 <= len) {
+        const std_table_t *t = NULL;
+        for (size_t i = 0; i < sizeof(std_tables) / sizeof(std_tables[0]); i++) {
+            if (std_tables[i].id == seg[pos]) {
+                t = &std_tables[i];
+            }
+        }
+        // Same code lengths with other symbols would still decode wrongly
+        if (!t || pos + 17 + t->count > len || memcmp(&seg[pos + 1], t->bits, 16) != 0 ||
+            memcmp(&seg[pos + 17], t->vals, t->count) != 0) {
+            return false;
+        }
+        pos += 17 + t->count;
+    }
+    return pos == len;
+}
+
+// State collected from the header segments of one frame
+typedef struct {
+    const uint8_t *tables[4];
+    uint8_t table_precision[4];
+    uint8_t comp_hv[3];
+    uint8_t comp_tq[3];
+    int ncomp;
+} parse_ctx_t;
+
+// Interpret the segment at buf[pos]. Sets *next to the following segment.
+static esp_err_t parse_segment(parse_ctx_t *ctx, rtp_jpeg_frame_t *frame,
+                               const uint8_t *buf, size_t len, size_t pos, size_t *next)
+{
+    while (pos + 1 < len && buf[pos] == 0xFF && buf[pos + 1] == 0xFF) {
+        pos++;  // fill byte
+    }
+    if (pos + 4 > len || buf[pos] != 0xFF) {
+        ESP_LOGD(TAG, "Bad marker at %u", (unsigned)pos);
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint8_t marker = buf[pos + 1];
+    size_t seg_len = be16(&buf[pos + 2]);
+    if (seg_len < 2 || pos + 2 + seg_len > len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const uint8_t *seg = &buf[pos + 4];
+    size_t body_len = seg_len - 2;
+    *next = pos + 2 + seg_len;
+
+    switch (marker) {
+        case JPEG_DQT:
+            for (size_t p = 0; p < body_len; ) {
+                uint8_t pq = seg[p] >> 4;
+                uint8_t tq = seg[p] & 0x0F;
+                size_t size = pq ? 128 : 64;
+                if (tq > 3 || p + 1 + size > body_len) {
+                    return ESP_ERR_INVALID_ARG;
+                }
+                ctx->tables[tq] = &seg[p + 1];
+                ctx->table_precision[tq] = pq;
+                p += 1 + size;
+            }
+            break;
+
+        case JPEG_SOF0:
+            if (body_len < 6) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            frame->height = be16(&seg[1]);
+            frame->width = be16(&seg[3]);
+            ctx->ncomp = seg[5];
+            if (ctx->ncomp != 3 || body_len < 6 + 3 * 3) {
+                ESP_LOGD(TAG, "%d components not supported", ctx->ncomp);
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+            for (int i = 0; i < 3; i++) {
+                ctx->comp_hv[i] = seg[6 + 3 * i + 1];
+                ctx->comp_tq[i] = seg[6 + 3 * i + 2] & 0x03;
+            }
+            break;
+
+        case JPEG_DHT:
+            frame->std_huffman &= dht_is_standard(seg, body_len);
+            break;
+
+        case JPEG_DRI:
+            if (body_len < 2) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            frame->restart_interval = be16(seg);
+            break;
+
+        case JPEG_SOS:
+            frame->scan = &buf[*next];
+            frame->scan_len = len - *next;
+            break;
+
+        default:
+            // Progressive, lossless and arithmetic coded frames
+            if (marker > JPEG_SOF0 && marker <= 0xCF &&
+                marker != JPEG_DHT && marker != 0xC8 && marker != 0xCC) {
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+            break;  // APPn, COM: regenerated or ignored by the receiver
+    }
+    return ESP_OK;
+}
+
+// Derive type, size limits and table order once all segments are seen
+static esp_err_t parse_finish(const parse_ctx_t *ctx, rtp_jpeg_frame_t *frame)
+{
+    if (ctx->ncomp == 0 || !frame->scan) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Only 4:2:2 and 4:2:0 with 1x1 chroma are defined by RFC 2435
+    if (ctx->comp_hv[1] != 0x11 || ctx->comp_hv[2] != 0x11) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (ctx->comp_hv[0] == 0x21) {
+        frame->type = 0;
+    } else if (ctx->comp_hv[0] == 0x22) {
+        frame->type = 1;
+    } else {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (frame->restart_interval) {
+        frame->type += 64;
+    }
+
+    if (frame->width == 0 || frame->height == 0 ||
+        frame->width > RTP_JPEG_MAX_DIMENSION || frame->height > RTP_JPEG_MAX_DIMENSION) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        uint8_t tq = ctx->comp_tq[i];
+        if (!ctx->tables[tq]) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        frame->qt[i] = ctx->tables[tq];
+        frame->qt_len[i] = ctx->table_precision[tq] ? 128 : 64;
+        frame->qt_precision |= ctx->table_precision[tq] << i;
+    }
+    return ESP_OK;
+}
+
+esp_err_t rtp_jpeg_parse(const uint8_t *buf, size_t len, rtp_jpeg_frame_t *frame)
+{
+    parse_ctx_t ctx = {0};
+
+    memset(frame, 0, sizeof(*frame));
+    frame->std_huffman = true;
+
+    if (len < 4 || buf[0] != 0xFF || buf[1] != JPEG_SOI) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    size_t pos = 2;
+    while (!frame->scan) {
+        esp_err_t err = parse_segment(&ctx, frame, buf, len, pos, &pos);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    // The receiver appends EOI itself
+    if (frame->scan_len >= 2 && frame->scan[frame->scan_len - 2] == 0xFF &&
+        frame->scan[frame->scan_len - 1] == JPEG_EOI) {
+        frame->scan_len -= 2;
+    }
+    return parse_finish(&ctx, frame);
+}
+
+esp_err_t rtp_jpeg_parse_fb(const camera_fb_t *fb, rtp_jpeg_frame_t *frame)
+{
+    const camera_jpeg_index_t *idx = &fb->jpeg;
+    if (!idx->valid) {
+        return rtp_jpeg_parse(fb->buf, fb->len, frame);
+    }
+
+    parse_ctx_t ctx = {0};
+    memset(frame, 0, sizeof(*frame));
+    frame->std_huffman = true;
+
+    // Start at the first table or frame segment, skipping APPn/COM that
+    // precede them, and hop to SOS; the scan ends at the indexed EOI
+    size_t pos = idx->sof;
+    const uint32_t starts[] = { idx->dqt, idx->dht, idx->dri };
+    for (size_t i = 0; i < sizeof(starts) / sizeof(starts[0]); i++) {
+        if (starts[i] && starts[i] < pos) pos = starts[i];
+    }
+    while (!frame->scan) {
+        esp_err_t err = parse_segment(&ctx, frame, fb->buf, idx->eoi, pos, &pos);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    return parse_finish(&ctx, frame);
+}
+
+uint8_t rtp_jpeg_qt_update(rtp_jpeg_qt_cache_t *cache, const rtp_jpeg_frame_t *frame)
+{
+    uint16_t len0 = frame->qt_len[0];
+    uint16_t len1 = frame->qt_len[1];
+
+    if (cache->q >= 128 &&
+        cache->precision == frame->qt_precision &&
+        cache->len == len0 + len1 &&
+        memcmp(cache->tables, frame->qt[0], len0) == 0 &&
+        memcmp(cache->tables + len0, frame->qt[1], len1) == 0) {
+        return cache->q;
+    }
+
+    memcpy(cache->tables, frame->qt[0], len0);
+    memcpy(cache->tables + len0, frame->qt[1], len1);
+    cache->len = len0 + len1;
+    cache->precision = frame->qt_precision;
+    // Q 255 would mean "tables in every frame"; stay within the cacheable range
+    cache->q = (cache->q < 128 || cache->q >= 254) ? 128 : cache->q + 1;
+    ESP_LOGI(TAG, "Quantization tables changed, announcing as Q=%d", cache->q);
+    return cache->q;
+}
+
+size_t rtp_jpeg_build_header(uint8_t *out, const rtp_jpeg_frame_t *frame,
+                             const rtp_jpeg_qt_cache_t *qt, uint32_t offset, bool with_tables)
+{
+    uint8_t *p = out;
+
+    // Main JPEG header (RFC 2435 §3.1)
+    p[0] = 0;                       // type-specific
+    p[1] = (offset >> 16) & 0xFF;
+    p[2] = (offset >> 8)  & 0xFF;
+    p[3] =  offset        & 0xFF;
+    p[4] = frame->type;
+    p[5] = qt->q;
+    p[6] = (frame->width + 7) / 8;
+    p[7] = (frame->height + 7) / 8;
+    p += 8;
+
+    // Restart Marker header (§3.1.7). Fragments are not aligned to restart
+    // intervals, which is signalled with F=L=1 and count 0x3FFF.
+    if (frame->type >= 64) {
+        p[0] = frame->restart_interval >> 8;
+        p[1] = frame->restart_interval & 0xFF;
+        p[2] = 0xFF;
+        p[3] = 0xFF;
+        p += 4;
+    }
+
+    // Quantization Table header (§3.1.8), first fragment only
+    if (offset == 0) {
+        uint16_t len = with_tables ? qt->len : 0;
+        p[0] = 0;                   // MBZ
+        p[1] = qt->precision;
+        p[2] = len >> 8;
+        p[3] = len & 0xFF;
+        p += 4;
+        if (len) {
+            memcpy(p, qt->tables, len);
+            p += len;
+        }
+    }
+
+    return p - out;
+}
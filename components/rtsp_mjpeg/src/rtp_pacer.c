@@ -0,0 +1,98 @@
+#include <string.h>
+
+#include "rtp_pacer.h"
+
+void rtp_pacer_init(rtp_pacer_t *p, int32_t burst, uint32_t min_wait_us)
+{
+    memset(p, 0, sizeof(*p));
+    p->burst = burst;
+    p->tokens = burst;
+    p->min_wait_us = min_wait_us;
+}
+
+static void rtp_pacer_refill(rtp_pacer_t *p, int64_t now_us)
+{
+    if (!p->byte_rate) {
+        p->tokens = p->burst;
+        p->last_us = now_us;
+        return;
+    }
+    int64_t add = (now_us - p->last_us) * p->byte_rate / 1000000;
+    if (add > 0) {
+        p->tokens = (p->tokens + add > p->burst) ? p->burst : p->tokens + add;
+        p->last_us = now_us;
+    }
+}
+
+void rtp_pacer_begin_frame(rtp_pacer_t *p, size_t frame_bytes, uint32_t budget_us,
+                           uint32_t max_rate, int64_t now_us)
+{
+    // Idle time since the last frame refills at the old rate
+    rtp_pacer_refill(p, now_us);
+
+    uint64_t rate = 0;
+    if (budget_us && frame_bytes) {
+        rate = (uint64_t)frame_bytes * 1000000 / budget_us;
+        if (max_rate && rate > max_rate) {
+            rate = max_rate;   // frame runs over its budget rather than bursting
+        }
+        if (rate == 0) {
+            rate = 1;
+        }
+    }
+    p->byte_rate = rate;
+    p->last_us = now_us;
+    p->frame_start_us = now_us;
+    p->stats.rate_kbps = rate * 8 / 1000;
+    p->stats.frames++;
+}
+
+uint32_t rtp_pacer_consume(rtp_pacer_t *p, size_t bytes, int64_t now_us)
+{
+    p->stats.packets++;
+    p->stats.bytes += bytes;
+    if (!p->byte_rate) {
+        return 0;
+    }
+
+    rtp_pacer_refill(p, now_us);
+    p->tokens -= bytes;
+    if (p->tokens >= 0) {
+        return 0;
+    }
+    uint32_t wait_us = (uint64_t)(-p->tokens) * 1000000 / p->byte_rate;
+    return wait_us >= p->min_wait_us ? wait_us : 0;
+}
+
+void rtp_pacer_charge(rtp_pacer_t *p, size_t bytes, int64_t now_us)
+{
+    if (!p->byte_rate) {
+        return;
+    }
+    rtp_pacer_refill(p, now_us);
+    p->tokens -= bytes;
+}
+
+void rtp_pacer_waited(rtp_pacer_t *p, uint32_t wait_us)
+{
+    p->stats.waits++;
+    p->stats.wait_us += wait_us;
+}
+
+void rtp_pacer_stall(rtp_pacer_t *p)
+{
+    p->stats.enobufs++;
+    // The stack has no room for a burst right now
+    if (p->tokens > 0) {
+        p->tokens = 0;
+    }
+}
+
+void rtp_pacer_end_frame(rtp_pacer_t *p, int64_t now_us)
+{
+    uint32_t took = now_us - p->frame_start_us;
+    p->stats.last_frame_us = took;
+    if (took > p->stats.max_frame_us) {
+        p->stats.max_frame_us = took;
+    }
+}
@@ -1,6 +1,10 @@
 #include <string.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <unistd.h>
 #include <sys/socket.h>
+#include <sys/select.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
@@ -8,44 +12,344 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
 
 #include "esp_timer.h"
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_system.h"
+#include "esp_random.h"
+#include "esp_heap_caps.h"
 
 #include "esp_camera.h"
 #include "sensor.h"
 #include "rtsp_mjpeg.h"
 #include "camera_config.h"
+#include "rtp_jpeg.h"
+#include "rtp_pacer.h"
+#include "rtcp.h"
+#include "rtp_history.h"
+#include "rate_ctrl.h"
+#include "rtsp_msg.h"
+#include "jpeg_scale.h"
+#include "cam_trace.h"
 #include "sdkconfig.h"
 
 static const char *TAG = "rtsp_mjpeg";
 static TaskHandle_t rtsp_task_handle = NULL;
+static TaskHandle_t stream_task_handle = NULL;
+static TaskHandle_t capture_task_handle = NULL;
 static int rtsp_ctrl_sock = -1;
-
-static uint16_t global_seq = 0;
-static uint32_t global_timestamp = 0;
+static int http_listen_sock = -1;
+// Set by rtsp_mjpeg_server_stop(); each task stops when it next wakes up
+static volatile bool server_stopping;
+enum { TASK_SERVER, TASK_STREAM, TASK_SCALER, TASK_CAPTURE, TASK_COUNT };
+static uint8_t tasks_parked;  // 1 << TASK_x once stopped; sessions_lock
 
 #define RTP_HEADER_SIZE   12
 #define RTP_PAYLOAD_TYPE  26
-#define RTP_SSRC          0xCAFEBABE
-#define MAX_PACKET_SIZE   1400  // Increased for better efficiency
-#define MAX_SEND_RETRIES  5
-#define RETRY_DELAY_MS    5
-
-// Pre-allocated packet buffer to avoid malloc/free overhead
-static uint8_t packet_buffer[MAX_PACKET_SIZE];
+// RTP packets, header included, are server_cfg.packet_size unless the
+// client asks for another size with Blocksize in SETUP; never smaller
+// than room for the largest RFC 2435 headers plus some scan data
+#define PACKET_SIZE_MIN     (RTP_HEADER_SIZE + RTP_JPEG_HDR_MAX + 128)
+// Largest UDP payload that crosses a 1500 byte MTU unfragmented
+#define UDP_PACKET_SIZE_MAX 1472
+// ENOBUFS means the WiFi driver is full; wait a tick, then give the packet up
+#define ENOBUFS_RETRIES   2
+
+#ifdef CONFIG_RTSP_MJPEG_PACING
+#define PACING_SPREAD_PERCENT CONFIG_RTSP_MJPEG_PACING_SPREAD_PERCENT
+#define PACING_MAX_RATE       (CONFIG_RTSP_MJPEG_PACING_MAX_KBPS * 1000 / 8)
+#define PACING_BURST          CONFIG_RTSP_MJPEG_PACING_BURST
+#else
+#define PACING_SPREAD_PERCENT 0
+#define PACING_MAX_RATE       0
+#define PACING_BURST          UDP_PACKET_SIZE_MAX
+#endif
+
+// Size of the session table; server_cfg.max_sessions may use fewer
+#define RTSP_MAX_SESSIONS CONFIG_RTSP_MJPEG_MAX_SESSIONS
+// The slot after the client sessions is the shared multicast sender
+#define MCAST_SLOT        RTSP_MAX_SESSIONS
+#define RTSP_STREAM_SLOTS (RTSP_MAX_SESSIONS + 1)
+
+#ifdef CONFIG_RTSP_MJPEG_MULTICAST
+#define MCAST_ENABLED     1
+#define MCAST_GROUP       CONFIG_RTSP_MJPEG_MULTICAST_GROUP
+#define MCAST_PORT        CONFIG_RTSP_MJPEG_MULTICAST_PORT
+#define MCAST_TTL         CONFIG_RTSP_MJPEG_MULTICAST_TTL
+#else
+#define MCAST_ENABLED     0
+#define MCAST_GROUP       "239.255.0.1"
+#define MCAST_PORT        5004
+#define MCAST_TTL         1
+#endif
+
+// UDP sessions get an even RTP port and RTCP on the next one (RFC 3550 §11)
+#define RTP_PORT_BASE          CONFIG_RTSP_MJPEG_RTP_PORT_BASE
+#define RTP_PORT_RANGE         1000
+
+// RFC 3550 §6.2 minimum interval; the first SR follows PLAY immediately
+#define RTCP_SR_INTERVAL_US    (5 * 1000000LL)
+#define RTCP_RX_BUF_SIZE       512
+
+// Retransmission of packets a UDP viewer reports lost (RFC 4585 Generic NACK)
+#ifdef CONFIG_RTSP_MJPEG_NACK
+#define NACK_ENABLED           1
+#define NACK_HISTORY_SIZE      (CONFIG_RTSP_MJPEG_NACK_HISTORY_KB * 1024)
+#define NACK_DEADLINE_US       (CONFIG_RTSP_MJPEG_NACK_DEADLINE_MS * 1000LL)
+#else
+#define NACK_ENABLED           0
+#define NACK_HISTORY_SIZE      0
+#define NACK_DEADLINE_US       0
+#endif
+#ifdef CONFIG_RTSP_MJPEG_NACK_AVPF
+#define SDP_PROFILE            "RTP/AVPF"
+#else
+#define SDP_PROFILE            "RTP/AVP"
+#endif
+// Packets one RTCP packet may ask for; each NACK entry covers up to 17
+#define NACK_MAX_SEQS          64
+// A resend lost as well is asked for again, up to this many times
+#define NACK_MAX_RESENDS       2
+
+// Capture and transmit run as separate stages joined by a frame queue
+#define FRAME_QUEUE_LEN   CONFIG_RTSP_MJPEG_FRAME_QUEUE_LEN
+#define CORE_ID(core)     ((core) < 0 ? tskNO_AFFINITY : (core))
+
+// A scaled mount's frames are made by the scaler task, into output buffers
+// that reach the transmit stage through their own queue
+#define SCALER_BUFFERS         2
+#define SCALER_STACK_SIZE      (10 * 1024)
+#define SCALER_DEFAULT_QUALITY 70
+// Output buffers start at this size, or the camera JPEG's if larger
+#define SCALER_BUF_MIN         (16 * 1024)
+
+// Sessions with a max frame age skip frames that are older than that when
+// their turn comes; 0 delivers every frame. Clients override it per session
+// with "maxage=<ms>" in a request URL.
+#define MAX_FRAME_AGE_MS  CONFIG_RTSP_MJPEG_MAX_FRAME_AGE_MS
+
+// Network feedback is evaluated this often to adapt quality and frame size
+#define RATE_CTRL_PERIOD_US    (1000000LL)
+
+// multipart/x-mixed-replace stream of the first mount for browsers; "/"
+// serves it too, and every mount's own path serves that mount
+#define HTTP_STREAM_PATH  "/stream"
+#define HTTP_SNAPSHOT_PATH "/snapshot"
+#define HTTP_METRICS_PATH "/metrics"
+#define HTTP_BOUNDARY     "rtspmjpegframe"
+#define HTTP_PART_HDR_SIZE 256
+
+// Snapshots come from the cached latest frame while it is younger than
+// this; an older one makes the request wait for the next capture
+#ifdef CONFIG_RTSP_MJPEG_SNAPSHOT_MAX_AGE_MS
+#define SNAPSHOT_MAX_AGE_US (CONFIG_RTSP_MJPEG_SNAPSHOT_MAX_AGE_MS * 1000LL)
+#else
+#define SNAPSHOT_MAX_AGE_US (1000 * 1000LL)
+#endif
+
+#ifdef CONFIG_RTSP_MJPEG_METRICS_HTTP
+#define METRICS_HTTP      1
+#else
+#define METRICS_HTTP      0
+#endif
+// A session's frame rate reads 0 once no frame came for this many intervals
+#define FPS_STALL_INTERVALS 3
+
+#define RTSP_RX_BUF_SIZE       2048
+#define RTSP_SESSION_TIMEOUT_S 60
+#define RTSP_POLL_INTERVAL_MS  1000
+// Longest wait for the tasks to stop: a poll interval plus a capture that
+// esp_camera_fb_get() gives up on
+#define SERVER_STOP_TIMEOUT_MS 6000
+
+// RFC 2326 §10.12 interleaved framing: '$', channel, 16-bit length
+#define INTERLEAVED_HDR_SIZE   4
+#define TCP_TXQ_SIZE           CONFIG_RTSP_MJPEG_TCP_TXQ_SIZE
+// Space kept free for RTSP responses so they are never refused for video
+#define TCP_TXQ_CTRL_RESERVE   1024
+// Interleaved packets aren't bound by the MTU, only by the send queue and
+// the 16-bit length in front of them; packet_size is 16 bits as well
+#define TCP_PACKET_SIZE_LIMIT  (65535 - INTERLEAVED_HDR_SIZE)
+#define TCP_PACKET_SIZE_MAX    (TCP_TXQ_SIZE / 4 < TCP_PACKET_SIZE_LIMIT ? TCP_TXQ_SIZE / 4 : TCP_PACKET_SIZE_LIMIT)
+
+// RTSP session states (RFC 2326 Appendix A)
+typedef enum {
+    SESSION_FREE = 0,
+    SESSION_INIT,        // connected, no transport yet
+    SESSION_READY,       // SETUP done, or PAUSEd
+    SESSION_PLAYING,     // receives RTP from the stream task
+} session_state_t;
+
+typedef enum {
+    TRANSPORT_UDP = 0,
+    TRANSPORT_TCP,       // interleaved on the RTSP connection
+    TRANSPORT_MULTICAST, // member of the multicast group, sent nothing itself
+    TRANSPORT_HTTP,      // multipart JPEG over an HTTP connection, not RTSP
+} transport_t;
+
+// A captured or scaled frame shared by the transmit stage, the scaler and the
+// HTTP viewers still writing it out; the buffer goes back to the driver, or
+// to the scaler, with the last reference
+typedef struct {
+    camera_fb_t *fb;
+    int refs;
+} shared_frame_t;
+
+// Byte ring buffer in front of a TCP control socket. Video is admitted a
+// whole frame at a time, so a slow reader loses frames, never parts of one.
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t head;
+    size_t len;
+} tcp_txq_t;
+
+// A mount point: a stream with its own URL, rate cap and transport policy
+typedef struct {
+    char path[RTSP_MJPEG_MOUNT_PATH_MAX];  // without trailing '/', so "" is the root
+    rtsp_mjpeg_source_t source;
+    uint8_t fps;            // delivered rate: the cap, or the capture rate
+    uint8_t fps_cap;        // rate asked for, 0 = the capture rate
+    uint8_t transports;     // RTSP_MJPEG_ALLOW() bits, 0 = all
+    uint8_t scale;          // scaled source: 1/scale of the camera picture
+    uint8_t quality;        // scaled source: encoder quality
+    uint32_t period_us;     // between delivered frames, 0 = every captured one
+    int64_t next_us;        // stream task: capture time the next frame is due
+    bool due;               // stream task: the current frame goes to this mount
+} mount_t;
+
+// Per-client state. Everything the RTP stream needs lives here so that
+// several viewers can share one captured frame.
+typedef struct {
+    session_state_t state;
+    transport_t transport;
+    mount_t *mount;      // set by DESCRIBE, SETUP or the HTTP request
+    int ctrl_sock;
+    int rtp_sock;
+    int rtcp_sock;
+    int rtp_server_port; // RTCP is on the next port
+    struct sockaddr_in rtp_client;
+    struct sockaddr_in rtcp_client;
+    uint8_t rtp_channel;
+    uint8_t rtcp_channel;
+    tcp_txq_t txq;
+    bool tx_failed;      // set by the stream task, session closed by the server task
+    char client_ip[16];
+    char server_ip[16];  // our address on this connection
+    uint32_t session_id;
+    uint32_t ssrc;
+    uint16_t seq;
+    uint16_t packet_size;     // RTP packets, header included
+    uint32_t ts_base;    // random offset of this stream's RTP clock
+    uint32_t timestamp;  // RTP timestamp of the frame being sent
+    uint32_t frame_count;
+    uint32_t frames_dropped;
+    uint32_t frames_stale;    // skipped for being older than max_age_us
+    int64_t max_age_us;       // 0 = deliver every frame
+    uint32_t rtp_packets;     // sender report counts
+    uint32_t rtp_octets;      // payload only, RTP headers excluded
+    int64_t last_sr_us;
+    rtcp_report_block_t rr;   // last receiver report about our SSRC
+    uint32_t rr_count;
+    int64_t last_rr_us;
+    uint32_t rtt_us;
+    rtp_history_t history;    // UDP viewers: packets kept for NACKs
+    uint32_t nacks;           // packets asked for again
+    uint32_t packets_resent;
+    uint32_t resend_misses;   // asked for, but no longer kept, too old or over the NACK's burst
+    int64_t connected_us;
+    uint64_t bytes_sent;      // on the wire, all headers included
+    uint32_t send_failures;
+    uint32_t enobufs;
+    int64_t tx_start_us;      // first byte of the current frame
+    uint64_t tx_time_us;      // summed frame send times, for the average
+    uint32_t tx_max_us;
+    int64_t last_frame_us;    // when the last frame was completely sent
+    uint32_t frame_interval_us;  // smoothed time between frames
+    uint8_t qt_q;        // Q whose tables this viewer has been sent
+    uint8_t qt_age;      // frames since tables were last sent in-band
+    bool tx_active;      // current frame not fully sent yet
+    bool tx_with_tables;
+    size_t tx_offset;    // next scan byte of the current frame
+    shared_frame_t *http_frame;  // frame being written to an HTTP viewer
+    bool http_snapshot;          // one JPEG, then close, instead of a stream
+    size_t http_offset;          // bytes of the part written so far
+    size_t http_hdr_len;
+    char http_hdr[HTTP_PART_HDR_SIZE];
+    int64_t last_activity_us;
+    size_t rx_len;
+    char rx_buf[RTSP_RX_BUF_SIZE];
+    rtsp_parser_t parser;        // request at the start of rx_buf
+} rtsp_session_t;
+
+static rtsp_session_t sessions[RTSP_STREAM_SLOTS];
+static SemaphoreHandle_t sessions_lock = NULL;
+
+// Settings of the running server, copied at start; mounts and name point
+// into the tables below instead of the caller's memory
+static rtsp_mjpeg_config_t server_cfg;
+static char server_name[64];
+static mount_t mounts[RTSP_MJPEG_MAX_MOUNTS];
+static size_t mount_count;
+// Left by rtsp_mjpeg_reconfigure() for the stream task; sessions_lock
+static rtsp_mjpeg_reconfig_t reconfig_pending;
+static bool reconfig_queued;
+
+// Quantization tables of the current frame, camera [0] and scaled [1] apart
+// so the two streams don't make each other's viewers resend them; only used
+// by the stream task
+static rtp_jpeg_qt_cache_t qt_cache[2];
+
+// Frames held by HTTP viewers and the scaler; never more than the driver and
+// the scaler have buffers. Only touched with sessions_lock held.
+static shared_frame_t shared_frames[CAMERA_FB_COUNT + SCALER_BUFFERS];
+// Latest frame the transmit stage handed out, kept for snapshots
+static shared_frame_t *latest_frame;
+
+// Captured frames waiting for the transmit stage
+static QueueHandle_t frame_queue = NULL;
+static uint32_t frames_captured;  // capture task only
+static uint32_t frames_overrun;   // frames dropped because the queue was full
+static uint32_t capture_failures; // capture task only
+// Server task only
+static uint32_t sessions_accepted;
+static uint32_t sessions_rejected;
+static int64_t server_start_us;
+
+// Paces the packets of all viewers together, NACK resends included; used
+// under sessions_lock
+static rtp_pacer_t pacer;
+
+// Scaler of the scaled mount, if there is one. The stream task hands it a
+// reference to a due camera frame; the JPEG is copied out first so the
+// camera buffer goes back at once, not after the decode and encode.
+typedef struct {
+    mount_t *mount;                   // NULL without a scaled mount
+    TaskHandle_t task;
+    QueueHandle_t queue;              // encoded frames for the stream task
+    shared_frame_t *in;               // frame to scale next; sessions_lock
+    bool out_busy[SCALER_BUFFERS];    // sessions_lock
+    camera_fb_t out[SCALER_BUFFERS];
+    size_t out_size[SCALER_BUFFERS];
+    size_t out_want;                  // grown when a frame did not fit
+    uint8_t *copy;                    // the JPEG being scaled
+    size_t copy_size;
+    jpeg_scaler_t js;
+    uint32_t frames;                  // scaler task only
+    uint32_t failures;                // scaler task only
+    uint32_t skipped;                 // sessions_lock
+} scaler_t;
+static scaler_t scaler;
 
 //------------------------------------------------------------------------------
-// Find end of JPEG header (SOI→SOS + length)
-static int find_sos(const uint8_t *buf, size_t len)
+// 90 kHz RTP clock derived from esp_timer, the clock cam_hal stamps frames
+// with. Monotonic, and the truncation to 32 bits wraps like RTP timestamps do.
+static inline uint32_t rtp_clock(int64_t us)
 {
-    for (int i = 0; i + 3 < (int)len; i++) {
-        if (buf[i] == 0xFF && buf[i+1] == 0xDA) {
-            return i + 4;
-        }
-    }
-    return 0;
+    return (uint64_t)us * 9 / 100;
 }
 
 // Build RTP header
@@ -61,558 +365,2975 @@ static void build_rtp_header(uint8_t *pkt, uint16_t seq, uint32_t ts,
     pkt[10] = ssrc >> 8;  pkt[11] = ssrc & 0xFF;
 }
 
-// Build JPEG payload header (8 bytes, RFC 2435)
-static void build_jpeg_header(uint8_t *pkt, int offset, int type,
-                              int q, int w8, int h8)
+//------------------------------------------------------------------------------
+// Mount points
+
+static const char *mount_name(const mount_t *m)
 {
-    pkt[0] = type;
-    pkt[1] = (offset >> 16) & 0xFF;
-    pkt[2] = (offset >> 8)  & 0xFF;
-    pkt[3] =  offset        & 0xFF;
-    pkt[4] = 0;
-    pkt[5] = q;
-    pkt[6] = w8;
-    pkt[7] = h8;
+    return m->path[0] ? m->path : "/";
 }
 
-// Returns 1 if DQT marker is found (only log once per session)
-static int check_and_log_dqt_once(const uint8_t *buf, size_t header_len, bool *logged)
+// Mount a request URL belongs to: the longest mount path that is a whole
+// leading part of the URL's path, so rtsp://cam/main/track1 finds "/main"
+static mount_t *mount_find(const char *uri)
 {
-    for (size_t i = 0; i + 1 < header_len; ++i) {
-        if (buf[i] == 0xFF && buf[i+1] == 0xDB) {
-            if (!*logged) {
-                ESP_LOGI(TAG, "JPEG contains DQT tables, using Q=255");
-                *logged = true;
-            }
-            return 1;
+    const char *path = uri;
+    const char *scheme = strstr(uri, "://");
+    if (scheme) {
+        path = strchr(scheme + 3, '/');
+        if (!path) {
+            path = "";
         }
     }
-    if (!*logged) {
-        ESP_LOGW(TAG, "No DQT tables found, using Q=0");
-        *logged = true;
+    size_t path_len = strcspn(path, "?");
+
+    mount_t *best = NULL;
+    for (size_t i = 0; i < mount_count; i++) {
+        mount_t *m = &mounts[i];
+        size_t len = strlen(m->path);
+        if (len > path_len || strncmp(path, m->path, len) != 0 ||
+            (len < path_len && path[len] != '/')) {
+            continue;
+        }
+        if (!best || len > strlen(best->path)) {
+            best = m;
+        }
     }
-    return 0;
+    return best;
+}
+
+static bool mount_allows(const mount_t *m, transport_t transport)
+{
+    return !m->transports || (m->transports & RTSP_MJPEG_ALLOW(transport));
 }
 
-// Extract CSeq from an RTSP request
-static bool get_cseq(const char *req, char *cseq, size_t len)
+// Delivered rate of a mount at a capture rate: its cap, if that is lower
+static void mount_set_rate(mount_t *m, uint8_t capture_fps)
 {
-    const char *p = strstr(req, "CSeq:");
-    if (!p) return false;
-    p += 5;
-    while (*p == ' ') p++;
-    size_t i = 0;
-    while (*p && *p!='\r' && *p!='\n' && i+1<len) {
-        cseq[i++] = *p++;
+    if (m->fps_cap && m->fps_cap < capture_fps) {
+        m->fps = m->fps_cap;
+        m->period_us = 1000000 / m->fps_cap;
+    } else {
+        m->fps = capture_fps;
+        m->period_us = 0;
     }
-    cseq[i] = '\0';
-    return true;
 }
 
-// Build minimal SDP
-static int build_sdp(char *buf, size_t size, const char *ip)
+// Choose the mounts that get the frame captured at capture_us. A capped
+// mount takes one when its schedule is due; half a capture period early
+// counts as on time, so capture jitter doesn't push frames to the next slot.
+// The scaled mount is scheduled on camera frames too, but what it is due is
+// a frame for the scaler: returns true then. A scaled frame goes to the
+// scaled mount only.
+static bool mounts_schedule(int64_t capture_us, uint32_t capture_period_us, bool scaled)
+{
+    bool scale = false;
+    for (size_t i = 0; i < mount_count; i++) {
+        mount_t *m = &mounts[i];
+        bool scaled_mount = m->source == RTSP_MJPEG_SOURCE_SCALED;
+        if (scaled) {
+            m->due = scaled_mount;
+            continue;
+        }
+        bool due = !m->period_us || capture_us >= m->next_us - capture_period_us / 2;
+        if (due && m->period_us) {
+            m->next_us += m->period_us;
+            if (m->next_us <= capture_us) {
+                m->next_us = capture_us + m->period_us;  // first frame, or capture fell behind
+            }
+        }
+        m->due = due && !scaled_mount;
+        scale |= due && scaled_mount;
+    }
+    return scale;
+}
+
+// Picture size a mount's viewers get
+static void mount_frame_size(const mount_t *m, int *width, int *height)
 {
     sensor_t *s = esp_camera_sensor_get();
-    int width  = 320, height = 240;
+    *width = 320;
+    *height = 240;
     if (s) {
         framesize_t fs = s->status.framesize;
-        width  = resolution[fs].width;
-        height = resolution[fs].height;
+        *width = resolution[fs].width;
+        *height = resolution[fs].height;
+    }
+    if (m->source == RTSP_MJPEG_SOURCE_SCALED) {
+        // As jpeg_scaler_run() crops them
+        *width = *width / m->scale & ~15;
+        *height = *height / m->scale & ~15;
+    }
+}
+
+// Whether SETUP would let a multicast client of the mount join the group:
+// the policy allows it, and the group is free or already carries the mount
+static bool mcast_offered(const mount_t *mount)
+{
+    const rtsp_session_t *group = &sessions[MCAST_SLOT];
+    return MCAST_ENABLED && mount_allows(mount, TRANSPORT_MULTICAST) &&
+           (group->state == SESSION_FREE || group->mount == mount);
+}
+
+// The SDP names the group only for mounts that list multicast in their
+// policy; the others keep clients that follow the SDP, like VLC, on unicast
+static bool mcast_announced(const mount_t *mount)
+{
+    return mcast_offered(mount) && (mount->transports & RTSP_MJPEG_ALLOW(TRANSPORT_MULTICAST));
+}
+
+// Whether the server can serve the transport on the mount: the one
+// multicast group carries a single mount, the one its first member chose
+static bool mount_serves(const mount_t *mount, transport_t transport)
+{
+    return mount_allows(mount, transport) && (transport != TRANSPORT_MULTICAST || mcast_offered(mount));
+}
+
+// The transport one alternative of a Transport header asks for
+static transport_t transport_parse(const char *spec)
+{
+    if (strstr(spec, "multicast")) {
+        return TRANSPORT_MULTICAST;
+    }
+    if (strstr(spec, "/TCP")) {  // RTP/AVP or RTP/AVPF
+        return TRANSPORT_TCP;
+    }
+    return TRANSPORT_UDP;
+}
+
+// Build minimal SDP. With multicast announced, the connection address is
+// the group (RFC 4566 §5.7), and clients following it ask to join
+static int build_sdp(char *buf, size_t size, const char *ip, const mount_t *mount, bool multicast)
+{
+    int width, height;
+    mount_frame_size(mount, &width, &height);
+
+    char conn[24];
+    if (multicast) {
+        snprintf(conn, sizeof(conn), "%s/%d", MCAST_GROUP, MCAST_TTL);
+    } else {
+        snprintf(conn, sizeof(conn), "%s", ip);
     }
 
-    return snprintf(buf, size,
+    int n = snprintf(buf, size,
         "v=0\r\n"
         "o=- 0 0 IN IP4 %s\r\n"
-        "s=ESP32 MJPEG\r\n"
+        "s=%s\r\n"
         "c=IN IP4 %s\r\n"
         "t=0 0\r\n"
-        "m=video 0 RTP/AVP %d\r\n"
+        "m=video 0 " SDP_PROFILE " %d\r\n"
         "a=control:track1\r\n"
         "a=rtpmap:%d JPEG/90000\r\n"
         "a=framesize:%d %d-%d\r\n"
         "a=framerate:%d\r\n",
-        ip, ip, RTP_PAYLOAD_TYPE, RTP_PAYLOAD_TYPE,
-        RTP_PAYLOAD_TYPE, width, height,
-        CONFIG_RTSP_MJPEG_DEFAULT_FPS
+        ip, server_name, conn, RTP_PAYLOAD_TYPE, RTP_PAYLOAD_TYPE,
+        RTP_PAYLOAD_TYPE, width, height, mount->fps
     );
+    // UDP viewers may ask for lost packets again (RFC 4585 §4.2)
+    if (NACK_ENABLED && n > 0 && (size_t)n < size) {
+        n += snprintf(buf + n, size - n, "a=rtcp-fb:%d nack\r\n", RTP_PAYLOAD_TYPE);
+    }
+    return n;
 }
 
-// Handle complete RTSP message reception
-static int recv_rtsp_message(int sock, char *buffer, size_t buffer_size, int timeout_sec)
-{
-    int total_received = 0;
-    bool headers_complete = false;
-    
-    struct timeval timeout = {.tv_sec = timeout_sec, .tv_usec = 0};
-    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    
-    while (total_received < (int)buffer_size - 1 && !headers_complete) {
-        int bytes = recv(sock, buffer + total_received, buffer_size - total_received - 1, 0);
-        if (bytes <= 0) {
-            if (total_received > 0) break;
-            return bytes;
-        }
-        
-        total_received += bytes;
-        buffer[total_received] = '\0';
-        
-        if (strstr(buffer, "\r\n\r\n")) {
-            headers_complete = true;
-        }
-        
-        if (total_received > 50) {
-            struct timeval short_timeout = {.tv_sec = 0, .tv_usec = 100000};
-            setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &short_timeout, sizeof(short_timeout));
-            
-            char temp_buf[10];
-            int extra = recv(sock, temp_buf, sizeof(temp_buf), 0);
-            if (extra <= 0) {
-                headers_complete = true;
-            } else {
-                if (total_received + extra < (int)buffer_size - 1) {
-                    memcpy(buffer + total_received, temp_buf, extra);
-                    total_received += extra;
-                    buffer[total_received] = '\0';
-                }
-            }
-            setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+// Send one UDP packet.
+// The packet is passed as an iovec list so the payload can point straight
+// into the frame buffer; only the stack ever copies frame bytes. Pacing
+// keeps ENOBUFS rare, so a full driver queue only costs a tick or two.
+static bool send_rtp_packet(rtsp_session_t *s, const struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg = {
+        .msg_name = &s->rtp_client,
+        .msg_namelen = sizeof(s->rtp_client),
+        .msg_iov = (struct iovec *)iov,
+        .msg_iovlen = iovcnt,
+    };
+
+    for (int retry = 0; ; retry++) {
+        if (sendmsg(s->rtp_sock, &msg, 0) >= 0) {
+            return true;
+        }
+        if (errno != ENOBUFS) {
+            ESP_LOGE(TAG, "sendmsg failed: %d (%s)", errno, strerror(errno));
+            return false;
+        }
+        rtp_pacer_stall(&pacer);
+        s->enobufs++;
+        if (retry == ENOBUFS_RETRIES) {
+            return false;
         }
+        vTaskDelay(1);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// TCP interleaved send queue
+
+// Prefer PSRAM for large buffers so they don't eat internal RAM needed by WiFi
+static void *psram_alloc(size_t size)
+{
+    void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return p ? p : heap_caps_malloc(size, MALLOC_CAP_8BIT);
+}
+
+static bool txq_init(tcp_txq_t *q, size_t size)
+{
+    q->buf = psram_alloc(size);
+    q->size = q->buf ? size : 0;
+    q->head = 0;
+    q->len = 0;
+    return q->buf != NULL;
+}
+
+static void txq_free(tcp_txq_t *q)
+{
+    free(q->buf);
+    memset(q, 0, sizeof(*q));
+}
+
+static size_t txq_space(const tcp_txq_t *q)
+{
+    return q->size - q->len;
+}
+
+static bool txq_push(tcp_txq_t *q, const void *data, size_t len)
+{
+    if (txq_space(q) < len) {
+        return false;
     }
-    return total_received;
+    size_t tail = (q->head + q->len) % q->size;
+    size_t first = q->size - tail;
+    if (first > len) first = len;
+    memcpy(q->buf + tail, data, first);
+    memcpy(q->buf, (const uint8_t *)data + first, len - first);
+    q->len += len;
+    return true;
 }
 
-// Optimized RTP packet sending with flow control
-static bool send_rtp_packet_reliable(int sock, struct sockaddr_in *client, 
-                                   const uint8_t *data, size_t len)
+// Write as much as the socket accepts without blocking.
+// Returns false on a fatal socket error.
+static bool txq_flush(tcp_txq_t *q, int sock)
 {
-    int retry_count = 0;
-    
-    while (retry_count < MAX_SEND_RETRIES) {
-        int sent = sendto(sock, data, len, 0, (struct sockaddr*)client, sizeof(*client));
-        if (sent >= 0) {
+    while (q->len > 0) {
+        size_t chunk = q->size - q->head;
+        if (chunk > q->len) chunk = q->len;
+        int sent = send(sock, q->buf + q->head, chunk, MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                return true;
+            }
+            ESP_LOGW(TAG, "Interleaved send failed: %d (%s)", errno, strerror(errno));
+            return false;
+        }
+        q->head = (q->head + sent) % q->size;
+        q->len -= sent;
+        if ((size_t)sent < chunk) {
             return true;
         }
-        
-        if (errno == ENOBUFS) {
-            // Network buffer full - back off exponentially
-            vTaskDelay(pdMS_TO_TICKS(RETRY_DELAY_MS * (1 << retry_count)));
-            retry_count++;
-            
-            // Also yield to allow network stack to drain
-            taskYIELD();
-            continue;
-        } else {
-            // Other error - log and fail
-            ESP_LOGE(TAG, "sendto failed: %d (%s)", errno, strerror(errno));
-            return false;
+    }
+    q->head = 0;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Reference counted frames. Callers hold sessions_lock.
+
+// Index of fb among the scaler's output buffers, -1 for a camera frame
+static int scaler_slot(const camera_fb_t *fb)
+{
+    return (fb >= scaler.out && fb < scaler.out + SCALER_BUFFERS) ? fb - scaler.out : -1;
+}
+
+// Give a frame back to the driver or the scaler
+static void frame_release(camera_fb_t *fb)
+{
+    int slot = scaler_slot(fb);
+    if (slot >= 0) {
+        scaler.out_busy[slot] = false;
+    } else {
+        esp_camera_fb_return(fb);
+    }
+}
+
+// Take the transmit stage's reference on a freshly dequeued frame
+static shared_frame_t *shared_frame_wrap(camera_fb_t *fb)
+{
+    for (int i = 0; i < CAMERA_FB_COUNT + SCALER_BUFFERS; i++) {
+        if (shared_frames[i].refs == 0) {
+            shared_frames[i].fb = fb;
+            shared_frames[i].refs = 1;
+            return &shared_frames[i];
         }
     }
-    
-    ESP_LOGW(TAG, "Failed to send RTP packet after %d retries", MAX_SEND_RETRIES);
-    return false;
+    return NULL;
 }
 
-static void rtsp_server_task(void *pvParameters)
+static void shared_frame_put(shared_frame_t *sf)
 {
-    ESP_LOGI(TAG, "RTSP server task started");
+    if (--sf->refs == 0) {
+        frame_release(sf->fb);
+        sf->fb = NULL;
+    }
+}
 
-    struct sockaddr_in serv = {
+static int64_t shared_frame_capture_us(const shared_frame_t *sf)
+{
+    return (int64_t)sf->fb->timestamp.tv_sec * 1000000 + sf->fb->timestamp.tv_usec;
+}
+
+// Make sf the frame snapshots are served from
+static void shared_frame_set_latest(shared_frame_t *sf)
+{
+    if (CAMERA_FB_COUNT < 2) {
+        return;  // holding the only buffer would stall capture
+    }
+    sf->refs++;
+    if (latest_frame) {
+        shared_frame_put(latest_frame);
+    }
+    latest_frame = sf;
+}
+
+//------------------------------------------------------------------------------
+// Session table
+
+static rtsp_session_t *session_alloc(int ctrl_sock, const struct sockaddr_in *cli)
+{
+    rtsp_session_t *s = NULL;
+
+    xSemaphoreTake(sessions_lock, portMAX_DELAY);
+    for (int i = 0; i < server_cfg.max_sessions; i++) {
+        if (sessions[i].state == SESSION_FREE) {
+            s = &sessions[i];
+            memset(s, 0, sizeof(*s));
+            s->state = SESSION_INIT;
+            break;
+        }
+    }
+    xSemaphoreGive(sessions_lock);
+
+    if (!s) {
+        return NULL;
+    }
+
+    s->ctrl_sock = ctrl_sock;
+    s->rtp_sock = -1;
+    s->rtcp_sock = -1;
+    s->session_id = esp_random();
+    s->ssrc = esp_random();
+    s->ts_base = esp_random();
+    s->max_age_us = MAX_FRAME_AGE_MS * 1000LL;
+    s->packet_size = server_cfg.packet_size;
+    s->last_activity_us = esp_timer_get_time();
+    s->connected_us = s->last_activity_us;
+    strcpy(s->client_ip, inet_ntoa(cli->sin_addr));
+    s->rtp_client.sin_family = AF_INET;
+    s->rtp_client.sin_addr.s_addr = cli->sin_addr.s_addr;
+    s->rtcp_client = s->rtp_client;
+
+    struct sockaddr_in local;
+    socklen_t local_len = sizeof(local);
+    if (getsockname(ctrl_sock, (struct sockaddr *)&local, &local_len) == 0) {
+        strcpy(s->server_ip, inet_ntoa(local.sin_addr));
+    }
+    return s;
+}
+
+static void mcast_update(void);
+
+// Close the session's sockets and return its slot to the table.
+// Caller must hold sessions_lock.
+static void session_close(rtsp_session_t *s)
+{
+    if (s->rtp_sock >= 0) {
+        close(s->rtp_sock);
+    }
+    if (s->rtcp_sock >= 0) {
+        close(s->rtcp_sock);
+    }
+    if (s->ctrl_sock >= 0) {
+        close(s->ctrl_sock);
+    }
+    txq_free(&s->txq);
+    rtp_history_free(&s->history);
+    if (s->http_frame) {
+        shared_frame_put(s->http_frame);
+        s->http_frame = NULL;
+    }
+    if (s->transport == TRANSPORT_HTTP && (s->http_snapshot || s->state == SESSION_INIT)) {
+        // Snapshots and metrics are polled every few seconds, not worth a log line each
+        ESP_LOGD(TAG, "HTTP request from %s done", s->client_ip);
+    } else {
+        ESP_LOGI(TAG, "Client session %08lX (%s) ended after %lu frames (%lu dropped)",
+                 (unsigned long)s->session_id, s->client_ip,
+                 (unsigned long)s->frame_count, (unsigned long)s->frames_dropped);
+    }
+    if (s->frames_stale) {
+        ESP_LOGI(TAG, "  %lu frames skipped as older than %lu ms",
+                 (unsigned long)s->frames_stale, (unsigned long)(s->max_age_us / 1000));
+    }
+    s->rtp_sock = -1;
+    s->rtcp_sock = -1;
+    s->ctrl_sock = -1;
+    s->state = SESSION_FREE;
+    if (s->transport == TRANSPORT_MULTICAST) {
+        mcast_update();
+    }
+}
+
+static int open_udp_port(uint16_t port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    struct sockaddr_in local = {
         .sin_family = AF_INET,
         .sin_addr.s_addr = INADDR_ANY,
-        .sin_port = htons(CONFIG_RTSP_MJPEG_PORT)
+        .sin_port = htons(port)
     };
+    if (bind(sock, (struct sockaddr*)&local, sizeof(local)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
 
-    while (1) {
-        ESP_LOGI(TAG, "Creating RTSP control socket...");
-        int ctrl_sock = socket(AF_INET, SOCK_STREAM, 0);
-        if (ctrl_sock < 0) {
-            ESP_LOGE(TAG, "Failed to create RTSP control socket");
-            vTaskDelay(pdMS_TO_TICKS(1000));
+// Bind an even RTP port and the RTCP port above it
+static bool session_open_rtp(rtsp_session_t *s)
+{
+    static uint16_t next_port = RTP_PORT_BASE;
+
+    for (int attempt = 0; attempt < 16; attempt++) {
+        uint16_t port = next_port;
+        next_port += 2;
+        if (next_port >= RTP_PORT_BASE + RTP_PORT_RANGE) {
+            next_port = RTP_PORT_BASE;
+        }
+
+        s->rtp_sock = open_udp_port(port);
+        if (s->rtp_sock < 0) continue;
+        s->rtcp_sock = open_udp_port(port + 1);
+        if (s->rtcp_sock < 0) {
+            close(s->rtp_sock);
+            s->rtp_sock = -1;
             continue;
         }
 
-        int opt = 1;
-        setsockopt(ctrl_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        // Increase UDP send buffer
+        int sndbuf = 64 * 1024;
+        setsockopt(s->rtp_sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        // Receiver reports are read from the server task's select loop
+        fcntl(s->rtcp_sock, F_SETFL, fcntl(s->rtcp_sock, F_GETFL, 0) | O_NONBLOCK);
+        s->rtp_server_port = port;
+        return true;
+    }
 
-        if (bind(ctrl_sock, (struct sockaddr*)&serv, sizeof(serv)) < 0) {
-            ESP_LOGE(TAG, "Failed to bind RTSP control socket: %d", errno);
-            close(ctrl_sock);
-            vTaskDelay(pdMS_TO_TICKS(1000));
+    ESP_LOGE(TAG, "Failed to bind an RTP/RTCP port pair");
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// Multicast. One sender slot streams to the group for all multicast clients;
+// it is PLAYING while any of them is. Caller holds sessions_lock.
+
+static bool mcast_open(const rtsp_session_t *client)
+{
+    rtsp_session_t *m = &sessions[MCAST_SLOT];
+    if (m->state != SESSION_FREE) {
+        return true;
+    }
+
+    memset(m, 0, sizeof(*m));
+    m->ctrl_sock = -1;
+    m->rtp_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    // Receivers send their reports to the group, RTCP port
+    m->rtcp_sock = open_udp_port(MCAST_PORT + 1);
+    if (m->rtp_sock < 0 || m->rtcp_sock < 0) {
+        ESP_LOGE(TAG, "Failed to create multicast sockets");
+        if (m->rtp_sock >= 0) close(m->rtp_sock);
+        if (m->rtcp_sock >= 0) close(m->rtcp_sock);
+        return false;
+    }
+
+    // lwIP takes single byte values for these
+    uint8_t ttl = MCAST_TTL;
+    uint8_t loop = 0;
+    setsockopt(m->rtp_sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(m->rtcp_sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(m->rtcp_sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    int sndbuf = 64 * 1024;
+    setsockopt(m->rtp_sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    struct ip_mreq mreq = {
+        .imr_multiaddr.s_addr = inet_addr(MCAST_GROUP),
+        .imr_interface.s_addr = INADDR_ANY,
+    };
+    if (setsockopt(m->rtcp_sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        ESP_LOGW(TAG, "Can't join %s, multicast receiver reports will be missed", MCAST_GROUP);
+    }
+    fcntl(m->rtcp_sock, F_SETFL, fcntl(m->rtcp_sock, F_GETFL, 0) | O_NONBLOCK);
+
+    m->transport = TRANSPORT_UDP;
+    m->rtp_client.sin_family = AF_INET;
+    m->rtp_client.sin_addr.s_addr = mreq.imr_multiaddr.s_addr;
+    m->rtp_client.sin_port = htons(MCAST_PORT);
+    m->rtcp_client = m->rtp_client;
+    m->rtcp_client.sin_port = htons(MCAST_PORT + 1);
+    m->session_id = esp_random();
+    m->ssrc = esp_random();
+    m->ts_base = esp_random();
+    m->max_age_us = MAX_FRAME_AGE_MS * 1000LL;
+    m->packet_size = server_cfg.packet_size;
+    m->mount = client->mount;
+    m->connected_us = esp_timer_get_time();
+    strcpy(m->client_ip, MCAST_GROUP);
+    strcpy(m->server_ip, client->server_ip);
+    m->state = SESSION_READY;
+    ESP_LOGI(TAG, "Multicast sender for %s:%d-%d ttl %d opened",
+             MCAST_GROUP, MCAST_PORT, MCAST_PORT + 1, MCAST_TTL);
+    return true;
+}
+
+// Start, pause or close the multicast sender to follow its clients
+static void mcast_update(void)
+{
+    rtsp_session_t *m = &sessions[MCAST_SLOT];
+    if (m->state == SESSION_FREE) {
+        return;
+    }
+
+    int members = 0, playing = 0;
+    for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+        const rtsp_session_t *s = &sessions[i];
+        if (s->state == SESSION_FREE || s->transport != TRANSPORT_MULTICAST) continue;
+        members++;
+        if (s->state == SESSION_PLAYING) playing++;
+    }
+
+    if (!members) {
+        session_close(m);
+    } else if (playing && m->state != SESSION_PLAYING) {
+        m->state = SESSION_PLAYING;
+        m->last_sr_us = 0;
+    } else if (!playing) {
+        m->state = SESSION_READY;
+    }
+}
+
+static int session_count(session_state_t state)
+{
+    int n = 0;
+    for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+        if (sessions[i].state == state) n++;
+    }
+    return n;
+}
+
+// Account a frame the session has handed completely to the stack
+static void session_frame_sent(rtsp_session_t *s, int64_t now)
+{
+    uint32_t took = now - s->tx_start_us;
+    s->tx_time_us += took;
+    if (took > s->tx_max_us) {
+        s->tx_max_us = took;
+    }
+    if (s->last_frame_us) {
+        // Smoothed by 1/16 like RTCP jitter, so one late frame barely shows
+        int64_t interval = now - s->last_frame_us;
+        s->frame_interval_us = s->frame_interval_us ?
+            s->frame_interval_us + (interval - (int64_t)s->frame_interval_us) / 16 : interval;
+    }
+    s->last_frame_us = now;
+    s->frame_count++;
+}
+
+//------------------------------------------------------------------------------
+// RTCP receiver reports and NACKs. Caller holds sessions_lock.
+
+// Send the packets a Generic NACK asks for again, with their original
+// sequence numbers. A payload still being sent to others comes from the
+// frame buffer, which the stream task holds until it has detached the history.
+// Resends are charged to the pacer, delaying the frame in progress, and one
+// RTCP packet gets at most a pacing burst of them, so NACKs can't flood the link.
+static void session_on_nack(rtsp_session_t *s, const uint8_t *buf, size_t len)
+{
+    uint16_t seqs[NACK_MAX_SEQS];
+    size_t count;
+    if (rtcp_parse_nack(buf, len, s->ssrc, seqs, NACK_MAX_SEQS, &count) != ESP_OK) {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    uint32_t resent = 0;
+    size_t budget = PACING_BURST;
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *hdr, *payload;
+        rtp_history_entry_t *e = rtp_history_find(&s->history, seqs[i], &hdr, &payload);
+        s->nacks++;
+        if (!e || now - e->sent_us > NACK_DEADLINE_US || e->resends >= NACK_MAX_RESENDS ||
+            e->hdr_len + e->payload_len > budget) {
+            s->resend_misses++;
             continue;
         }
-
-        if (listen(ctrl_sock, 5) < 0) {
-            ESP_LOGE(TAG, "Failed to listen on RTSP control socket");
-            close(ctrl_sock);
-            vTaskDelay(pdMS_TO_TICKS(1000));
+        struct iovec iov[2] = {
+            { .iov_base = (void *)hdr, .iov_len = e->hdr_len },
+            { .iov_base = (void *)payload, .iov_len = e->payload_len },
+        };
+        struct msghdr msg = {
+            .msg_name = &s->rtp_client,
+            .msg_namelen = sizeof(s->rtp_client),
+            .msg_iov = iov,
+            .msg_iovlen = 2,
+        };
+        // No waiting for driver buffers here: the server task serves everyone
+        if (sendmsg(s->rtp_sock, &msg, 0) < 0) {
+            s->resend_misses++;
             continue;
         }
-        ESP_LOGI(TAG, "RTSP listening on port %d", CONFIG_RTSP_MJPEG_PORT);
-
-        while (1) {
-            struct sockaddr_in cli;
-            socklen_t addrlen = sizeof(cli);
-            ESP_LOGI(TAG, "Waiting for RTSP client connection...");
-            
-            // Log free heap before client connection
-            ESP_LOGI(TAG, "Free heap: %lu bytes", (unsigned long)esp_get_free_heap_size());
-            
-            int client = accept(ctrl_sock, (struct sockaddr*)&cli, &addrlen);
-            if (client < 0) {
-                ESP_LOGW(TAG, "accept() failed: %d", client);
-                break;
-            }
-            ESP_LOGI(TAG, "Client connected %s", inet_ntoa(cli.sin_addr));
+        budget -= e->hdr_len + e->payload_len;
+        rtp_pacer_charge(&pacer, e->hdr_len + e->payload_len, now);
+        e->resends++;
+        s->packets_resent++;
+        s->bytes_sent += e->hdr_len + e->payload_len;
+        resent++;
+    }
+    s->last_activity_us = now;
+    ESP_LOGD(TAG, "NACK from %s: %u packets asked for, %lu resent",
+             s->client_ip, (unsigned)count, (unsigned long)resent);
+}
 
-            // Set client socket options for better performance
-            struct timeval timeout = {.tv_sec = 30, .tv_usec = 0};
-            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+static void session_on_rtcp(rtsp_session_t *s, const uint8_t *buf, size_t len)
+{
+    rtcp_report_block_t rb;
+    esp_err_t err = rtcp_parse_report(buf, len, s->ssrc, &rb);
+    if (err == ESP_ERR_INVALID_ARG) {
+        ESP_LOGD(TAG, "Malformed RTCP from %s", s->client_ip);
+        return;
+    }
+    // NACKs come behind a receiver report, often one without report blocks
+    if (s->history.data) {
+        session_on_nack(s, buf, len);
+    }
+    if (err != ESP_OK) {
+        return;
+    }
 
-            // Create RTP socket
-            int rtp_sock = socket(AF_INET, SOCK_DGRAM, 0);
-            if (rtp_sock < 0) {
-                ESP_LOGE(TAG, "Failed to create RTP socket");
-                close(client);
-                continue;
-            }
+    s->rr = rb;
+    s->rr_count++;
+    s->last_rr_us = esp_timer_get_time();
+    s->last_activity_us = s->last_rr_us;
 
-            // Increase UDP send buffer
-            int sndbuf = 64 * 1024;
-            setsockopt(rtp_sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    // RFC 3550 §6.4.1: RTT = arrival - LSR - DLSR, in 1/65536 s
+    if (rb.lsr) {
+        uint32_t rtt = rtcp_ntp_middle(rtcp_ntp_now()) - rb.lsr - rb.dlsr;
+        if (rtt < 0x80000000u) {
+            s->rtt_us = ((uint64_t)rtt * 1000000) >> 16;
+        }
+    }
+    ESP_LOGD(TAG, "RR from %s: lost %d/256 (total %ld), jitter %lu, rtt %lu us",
+             s->client_ip, rb.fraction_lost, (long)rb.cumulative_lost,
+             (unsigned long)rb.jitter, (unsigned long)s->rtt_us);
+}
 
-            struct sockaddr_in rtp_local = {
-                .sin_family = AF_INET,
-                .sin_addr.s_addr = INADDR_ANY,
-                .sin_port = 0
-            };
+static void session_read_rtcp(rtsp_session_t *s)
+{
+    uint8_t buf[RTCP_RX_BUF_SIZE];
+    int r;
+    while ((r = recv(s->rtcp_sock, buf, sizeof(buf), 0)) > 0) {
+        xSemaphoreTake(sessions_lock, portMAX_DELAY);
+        session_on_rtcp(s, buf, r);
+        xSemaphoreGive(sessions_lock);
+    }
+}
 
-            if (bind(rtp_sock, (struct sockaddr*)&rtp_local, sizeof(rtp_local)) < 0) {
-                ESP_LOGE(TAG, "Failed to bind RTP socket");
-                close(rtp_sock);
-                close(client);
-                continue;
-            }
+//------------------------------------------------------------------------------
+// RTSP request handling. Runs on the server task with sessions_lock held.
+// Returns false when the connection should be closed.
 
-            socklen_t addr_len = sizeof(rtp_local);
-            if (getsockname(rtp_sock, (struct sockaddr*)&rtp_local, &addr_len) < 0) {
-                ESP_LOGE(TAG, "Failed to get RTP socket name");
-                close(rtp_sock);
-                close(client);
-                continue;
-            }
-            int rtp_server_port = ntohs(rtp_local.sin_port);
+static bool rtsp_send_response(rtsp_session_t *s, const char *resp, int n, const char *what)
+{
+    if (s->txq.buf) {
+        // Interleaved session: responses must not land inside a '$' frame
+        if (!txq_push(&s->txq, resp, n) || !txq_flush(&s->txq, s->ctrl_sock)) {
+            ESP_LOGE(TAG, "Failed to queue %s response", what);
+            return false;
+        }
+        return true;
+    }
+    // A response is far smaller than the socket buffer; a client that lets it
+    // fill up isn't reading and is closed rather than waited for
+    if (send(s->ctrl_sock, resp, n, MSG_DONTWAIT) != n) {
+        ESP_LOGE(TAG, "Failed to send %s response: %d", what, errno);
+        return false;
+    }
+    return true;
+}
 
-            char client_ip[16];
-            strcpy(client_ip, inet_ntoa(cli.sin_addr));
+// Blocksize (RFC 2326 §12.7) asks for an RTP payload size. It is granted
+// down to what the largest RFC 2435 header needs and up to what the
+// transport carries; the granted size goes back in hdr for the response.
+static void session_set_blocksize(rtsp_session_t *s, const rtsp_msg_t *req, size_t max_packet,
+                                  char *hdr, size_t hdr_size)
+{
+    s->packet_size = server_cfg.packet_size;
+    hdr[0] = '\0';
+    const char *bs = rtsp_msg_header(req, "Blocksize");
+    if (!bs) {
+        return;
+    }
+    char *end;
+    long payload = strtol(bs, &end, 10);
+    if (end == bs || *end || payload <= 0) {
+        ESP_LOGW(TAG, "Ignoring invalid Blocksize from %s", s->client_ip);
+        return;
+    }
+    size_t size = (size_t)payload > max_packet - RTP_HEADER_SIZE ? max_packet : (size_t)payload + RTP_HEADER_SIZE;
+    if (size < PACKET_SIZE_MIN) {
+        size = PACKET_SIZE_MIN;
+    }
+    s->packet_size = size;
+    snprintf(hdr, hdr_size, "Blocksize: %u\r\n", (unsigned)(size - RTP_HEADER_SIZE));
+    ESP_LOGI(TAG, "%s asked for Blocksize %ld, sending %u byte packets", s->client_ip, payload,
+             (unsigned)size);
+}
 
-            struct sockaddr_in rtp_client = {0};
-            rtp_client.sin_family = AF_INET;
-            rtp_client.sin_addr.s_addr = cli.sin_addr.s_addr;
+static bool rtsp_handle_request(rtsp_session_t *s, const rtsp_msg_t *req)
+{
+    char resp[2048];
+    int n;
 
-            bool streaming = false;
-            char recv_buf[2048], resp[2048];
-            int client_rtp_port = 0;
-            bool dqt_logged = false;  // Track DQT logging per session
+    ESP_LOGD(TAG, "RTSP <-- (%s): %s %s, %u headers", s->client_ip, req->method_name, req->uri,
+             (unsigned)req->header_count);
 
-            // RTSP handshake loop
-            // RTSP handshake loop - FIXED VERSION
-while (!streaming) {
-    ESP_LOGI(TAG, "Waiting for RTSP request...");
-    
-    int r = recv_rtsp_message(client, recv_buf, sizeof(recv_buf), 30);
-    if (r <= 0) {
-        ESP_LOGW(TAG, "RTSP recv_rtsp_message()=%d, errno=%d", r, errno);
-        break; // Client disconnected or timeout
+    const char *cseq = rtsp_msg_header(req, "CSeq");
+    if (!cseq) {
+        cseq = "1";
+    }
+    if (strcmp(req->version, "RTSP/1.0") != 0) {
+        ESP_LOGW(TAG, "%s speaks %s", s->client_ip, req->version);
+        n = snprintf(resp, sizeof(resp),
+            "RTSP/1.0 505 RTSP Version Not Supported\r\n"
+            "CSeq: %s\r\n"
+            "Server: ESP32-RTSP/1.0\r\n"
+            "\r\n", cseq);
+        return rtsp_send_response(s, resp, n, "error");
     }
-    
-    ESP_LOGD(TAG, "RTSP <-- (%d bytes):\n%.*s", r, r, recv_buf);
 
-    char cseq[32] = {0};
-    if (!get_cseq(recv_buf, cseq, sizeof(cseq))) {
-        strcpy(cseq, "1");
+    // Freshness override in the request URL, e.g. rtsp://cam/track1?maxage=150
+    const char *maxage = strstr(req->uri, "maxage=");
+    if (maxage) {
+        s->max_age_us = strtoul(maxage + strlen("maxage="), NULL, 10) * 1000LL;
+        ESP_LOGI(TAG, "Session %08lX: max frame age %lu ms", (unsigned long)s->session_id,
+                 (unsigned long)(s->max_age_us / 1000));
     }
 
     // Process each RTSP method
-    if (strstr(recv_buf, "OPTIONS ")) {
+    if (req->method == RTSP_METHOD_OPTIONS) {
         ESP_LOGI(TAG, "RTSP --> OPTIONS response");
-        int n = snprintf(resp, sizeof(resp),
+        n = snprintf(resp, sizeof(resp),
             "RTSP/1.0 200 OK\r\n"
             "CSeq: %s\r\n"
-            "Public: OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN\r\n"
+            "Public: OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, TEARDOWN, GET_PARAMETER\r\n"
             "Server: ESP32-RTSP/1.0\r\n"
             "\r\n", cseq);
-        
-        if (send(client, resp, n, 0) < 0) {
-            ESP_LOGE(TAG, "Failed to send OPTIONS response");
-            break;
+        return rtsp_send_response(s, resp, n, "OPTIONS");
+
+    } else if (req->method == RTSP_METHOD_DESCRIBE) {
+        mount_t *mount = mount_find(req->uri);
+        if (!mount) {
+            ESP_LOGW(TAG, "DESCRIBE from %s: no mount for %s", s->client_ip, req->uri);
+            n = snprintf(resp, sizeof(resp),
+                "RTSP/1.0 404 Not Found\r\n"
+                "CSeq: %s\r\n"
+                "Server: ESP32-RTSP/1.0\r\n"
+                "\r\n", cseq);
+            return rtsp_send_response(s, resp, n, "DESCRIBE error");
         }
-        // Continue to wait for next request (DESCRIBE)
+        s->mount = mount;
 
-    } else if (strstr(recv_buf, "DESCRIBE ")) {
-        ESP_LOGI(TAG, "RTSP --> DESCRIBE response");
+        ESP_LOGI(TAG, "RTSP --> DESCRIBE response for %s", mount_name(mount));
         char sdp[1024];
-        int sdp_len = build_sdp(sdp, sizeof(sdp), client_ip);
-        int n = snprintf(resp, sizeof(resp),
+        int sdp_len = build_sdp(sdp, sizeof(sdp), s->server_ip, mount, mcast_announced(mount));
+        // Relative to the mount, so "track1" resolves to <mount>/track1
+        n = snprintf(resp, sizeof(resp),
             "RTSP/1.0 200 OK\r\n"
             "CSeq: %s\r\n"
-            "Content-Base: rtsp://%s:%d/\r\n"
+            "Content-Base: rtsp://%s:%u%s/\r\n"
             "Content-Type: application/sdp\r\n"
             "Content-Length: %d\r\n"
             "Server: ESP32-RTSP/1.0\r\n"
             "\r\n%s",
-            cseq, client_ip, CONFIG_RTSP_MJPEG_PORT, sdp_len, sdp);
-        
-        if (send(client, resp, n, 0) < 0) {
-            ESP_LOGE(TAG, "Failed to send DESCRIBE response");
-            break;
-        }
-        // Continue to wait for next request (SETUP)
+            cseq, s->server_ip, server_cfg.port, mount->path, sdp_len, sdp);
+        return rtsp_send_response(s, resp, n, "DESCRIBE");
 
-    } else if (strstr(recv_buf, "SETUP ")) {
+    } else if (req->method == RTSP_METHOD_SETUP) {
         ESP_LOGI(TAG, "RTSP --> SETUP response");
 
-        // Parse Transport header for client port
-        int found_port = 0;
-        char *transport_line = strstr(recv_buf, "Transport:");
+        mount_t *mount = mount_find(req->uri);
+        if (!mount) {
+            ESP_LOGW(TAG, "SETUP from %s: no mount for %s", s->client_ip, req->uri);
+            n = snprintf(resp, sizeof(resp),
+                "RTSP/1.0 404 Not Found\r\n"
+                "CSeq: %s\r\n"
+                "Server: ESP32-RTSP/1.0\r\n"
+                "\r\n", cseq);
+            return rtsp_send_response(s, resp, n, "SETUP error");
+        }
+        // The client lists transports in order of preference (RFC 2326 §12.39);
+        // the first one the mount's policy allows is taken
+        char transport_buf[160] = "";
+        const char *transport_line = rtsp_msg_header(req, "Transport");
+        transport_t wanted = TRANSPORT_UDP;
+        bool supported = !transport_line && mount_serves(mount, wanted);
+        for (const char *alt = transport_line; alt && *alt && !supported; ) {
+            size_t len = strcspn(alt, ",");
+            snprintf(transport_buf, sizeof(transport_buf), "%.*s", (int)len, alt);
+            wanted = transport_parse(transport_buf);
+            supported = mount_serves(mount, wanted);
+            alt += len + (alt[len] == ',');
+        }
         if (transport_line) {
-            char *client_port_str = strstr(transport_line, "client_port=");
-            if (client_port_str) {
-                int port1 = 0;
-                if (sscanf(client_port_str + strlen("client_port="), "%d", &port1) == 1) {
-                    client_rtp_port = port1;
-                    found_port = 1;
-                    ESP_LOGI(TAG, "Parsed client RTP port: %d", client_rtp_port);
-                }
-            }
+            transport_line = transport_buf;
+        }
+        if (!supported) {
+            ESP_LOGW(TAG, "SETUP from %s: no transport offered is allowed on %s", s->client_ip, mount_name(mount));
+            n = snprintf(resp, sizeof(resp),
+                "RTSP/1.0 461 Unsupported Transport\r\n"
+                "CSeq: %s\r\n"
+                "Server: ESP32-RTSP/1.0\r\n"
+                "\r\n", cseq);
+            return rtsp_send_response(s, resp, n, "SETUP error");
         }
+        s->mount = mount;
+
+        if (wanted == TRANSPORT_MULTICAST) {
+            // All multicast clients share one stream sent to the configured group
+            if (!MCAST_ENABLED || !mcast_open(s)) {
+                n = snprintf(resp, sizeof(resp),
+                    "RTSP/1.0 461 Unsupported Transport\r\n"
+                    "CSeq: %s\r\n"
+                    "Server: ESP32-RTSP/1.0\r\n"
+                    "\r\n", cseq);
+                return rtsp_send_response(s, resp, n, "SETUP error");
+            }
 
-        if (found_port && client_rtp_port > 0) {
-            rtp_client.sin_port = htons(client_rtp_port);
-            ESP_LOGI(TAG, "UDP Transport - Client RTP port: %d, Server RTP port: %d",
-                    client_rtp_port, rtp_server_port);
+            s->transport = TRANSPORT_MULTICAST;
+            if (s->state == SESSION_INIT) {
+                s->state = SESSION_READY;
+            }
+            ESP_LOGI(TAG, "Multicast Transport - %s joins %s:%d", s->client_ip, MCAST_GROUP, MCAST_PORT);
 
-            int n = snprintf(resp, sizeof(resp),
+            n = snprintf(resp, sizeof(resp),
                 "RTSP/1.0 200 OK\r\n"
                 "CSeq: %s\r\n"
-                "Transport: RTP/AVP;unicast;client_port=%d;server_port=%d\r\n"
-                "Session: %08X\r\n"
+                "Transport: RTP/AVP;multicast;destination=%s;port=%d-%d;ttl=%d;ssrc=%08lX\r\n"
+                "Session: %08lX;timeout=%d\r\n"
                 "Server: ESP32-RTSP/1.0\r\n"
                 "\r\n",
-                cseq, client_rtp_port, rtp_server_port, RTP_SSRC);
-            
-            if (send(client, resp, n, 0) < 0) {
-                ESP_LOGE(TAG, "Failed to send SETUP response");
-                break;
+                cseq, MCAST_GROUP, MCAST_PORT, MCAST_PORT + 1, MCAST_TTL,
+                (unsigned long)sessions[MCAST_SLOT].ssrc,
+                (unsigned long)s->session_id, RTSP_SESSION_TIMEOUT_S);
+            return rtsp_send_response(s, resp, n, "SETUP");
+        }
+
+        if (wanted == TRANSPORT_TCP) {
+            // Interleaved transport, RTP and RTCP ride on this connection
+            int ch_rtp = 0, ch_rtcp = 1;
+            const char *il = strstr(transport_line, "interleaved=");
+            if (il && sscanf(il + strlen("interleaved="), "%d-%d", &ch_rtp, &ch_rtcp) < 1) {
+                ch_rtp = 0;
             }
-            // Continue to wait for next request (PLAY)
-        } else {
-            ESP_LOGW(TAG, "No valid client RTP port found in SETUP request");
-            int n = snprintf(resp, sizeof(resp),
-                "RTSP/1.0 400 Bad Request\r\n"
-                "CSeq: %s\r\n"
+            if (!il || ch_rtcp == ch_rtp) {
+                ch_rtcp = ch_rtp + 1;
+            }
+
+            if (!s->txq.buf && !txq_init(&s->txq, TCP_TXQ_SIZE)) {
+                ESP_LOGE(TAG, "No memory for %d byte TCP send queue", TCP_TXQ_SIZE);
+                n = snprintf(resp, sizeof(resp),
+                    "RTSP/1.0 453 Not Enough Bandwidth\r\n"
+                    "CSeq: %s\r\n"
+                    "Server: ESP32-RTSP/1.0\r\n"
+                    "\r\n", cseq);
+                return rtsp_send_response(s, resp, n, "SETUP error");
+            }
+
+            char blocksize[32];
+            session_set_blocksize(s, req, TCP_PACKET_SIZE_MAX, blocksize, sizeof(blocksize));
+            s->transport = TRANSPORT_TCP;
+            s->rtp_channel = ch_rtp & 0xFF;
+            s->rtcp_channel = ch_rtcp & 0xFF;
+            if (s->state == SESSION_INIT) {
+                s->state = SESSION_READY;
+            }
+            ESP_LOGI(TAG, "TCP Transport - interleaved channels %d-%d", s->rtp_channel, s->rtcp_channel);
+
+            n = snprintf(resp, sizeof(resp),
+                "RTSP/1.0 200 OK\r\n"
+                "CSeq: %s\r\n"
+                "Transport: RTP/AVP/TCP;unicast;interleaved=%d-%d;ssrc=%08lX\r\n"
+                "Session: %08lX;timeout=%d\r\n"
+                "%s"
+                "Server: ESP32-RTSP/1.0\r\n"
+                "\r\n",
+                cseq, s->rtp_channel, s->rtcp_channel,
+                (unsigned long)s->ssrc, (unsigned long)s->session_id, RTSP_SESSION_TIMEOUT_S, blocksize);
+            return rtsp_send_response(s, resp, n, "SETUP");
+        }
+
+        // Parse Transport header for the client port pair
+        int client_rtp_port = 0, client_rtcp_port = 0;
+        if (transport_line) {
+            const char *client_port_str = strstr(transport_line, "client_port=");
+            if (client_port_str) {
+                if (sscanf(client_port_str + strlen("client_port="), "%d-%d",
+                           &client_rtp_port, &client_rtcp_port) >= 1) {
+                    ESP_LOGI(TAG, "Parsed client RTP port: %d", client_rtp_port);
+                }
+            }
+        }
+        if (client_rtcp_port <= 0) {
+            client_rtcp_port = client_rtp_port + 1;
+        }
+
+        if (client_rtp_port <= 0 || (s->rtp_sock < 0 && !session_open_rtp(s))) {
+            ESP_LOGW(TAG, "No valid client RTP port found in SETUP request");
+            n = snprintf(resp, sizeof(resp),
+                "RTSP/1.0 400 Bad Request\r\n"
+                "CSeq: %s\r\n"
                 "Server: ESP32-RTSP/1.0\r\n"
                 "\r\n", cseq);
-            
-            if (send(client, resp, n, 0) < 0) {
-                ESP_LOGE(TAG, "Failed to send SETUP error response");
+            rtsp_send_response(s, resp, n, "SETUP error");
+            return false; // Invalid SETUP, terminate session
+        }
+
+        // Without memory for the history the viewer still plays, only without resends
+        if (NACK_ENABLED && !s->history.data) {
+            esp_err_t err = rtp_history_init(&s->history, NACK_HISTORY_SIZE);
+            if (err != ESP_OK) {
+                ESP_LOGW(TAG, "No packet history for %s: %s", s->client_ip, esp_err_to_name(err));
             }
-            break; // Invalid SETUP, terminate session
         }
 
-    } else if (strstr(recv_buf, "PLAY ")) {
-        ESP_LOGI(TAG, "RTSP --> PLAY response");
+        char blocksize[32];
+        session_set_blocksize(s, req, UDP_PACKET_SIZE_MAX, blocksize, sizeof(blocksize));
+        s->transport = TRANSPORT_UDP;
+        s->rtp_client.sin_port = htons(client_rtp_port);
+        s->rtcp_client.sin_port = htons(client_rtcp_port);
+        if (s->state == SESSION_INIT) {
+            s->state = SESSION_READY;
+        }
+        ESP_LOGI(TAG, "UDP Transport - Client ports: %d-%d, Server ports: %d-%d",
+                client_rtp_port, client_rtcp_port, s->rtp_server_port, s->rtp_server_port + 1);
+
+        n = snprintf(resp, sizeof(resp),
+            "RTSP/1.0 200 OK\r\n"
+            "CSeq: %s\r\n"
+            "Transport: RTP/AVP;unicast;client_port=%d-%d;server_port=%d-%d;ssrc=%08lX\r\n"
+            "Session: %08lX;timeout=%d\r\n"
+            "%s"
+            "Server: ESP32-RTSP/1.0\r\n"
+            "\r\n",
+            cseq, client_rtp_port, client_rtcp_port, s->rtp_server_port, s->rtp_server_port + 1,
+            (unsigned long)s->ssrc, (unsigned long)s->session_id, RTSP_SESSION_TIMEOUT_S, blocksize);
+        return rtsp_send_response(s, resp, n, "SETUP");
+
+    } else if (req->method == RTSP_METHOD_PLAY) {
+        if (s->state == SESSION_INIT) {
+            ESP_LOGW(TAG, "PLAY before SETUP");
+            n = snprintf(resp, sizeof(resp),
+                "RTSP/1.0 455 Method Not Valid in This State\r\n"
+                "CSeq: %s\r\n"
+                "Server: ESP32-RTSP/1.0\r\n"
+                "\r\n", cseq);
+            return rtsp_send_response(s, resp, n, "PLAY error");
+        }
 
-        // Reset counters for new session
-        global_seq = 0;
-        global_timestamp = 0;
+        ESP_LOGI(TAG, "RTSP --> PLAY response");
 
-        int n = snprintf(resp, sizeof(resp),
+        // Sequence numbers continue across PAUSE/PLAY and timestamps follow
+        // the capture clock. Multicast clients join the shared stream.
+        const rtsp_session_t *src = (s->transport == TRANSPORT_MULTICAST) ? &sessions[MCAST_SLOT] : s;
+        n = snprintf(resp, sizeof(resp),
             "RTSP/1.0 200 OK\r\n"
             "CSeq: %s\r\n"
-            "Session: %08X\r\n"
-            "RTP-Info: url=rtsp://%s:%d/track1;seq=0;rtptime=0\r\n"
+            "Session: %08lX\r\n"
+            "RTP-Info: url=rtsp://%s:%u%s/track1;seq=%u;rtptime=%lu\r\n"
             "Server: ESP32-RTSP/1.0\r\n"
             "\r\n",
-            cseq, RTP_SSRC, client_ip, CONFIG_RTSP_MJPEG_PORT);
-        
-        if (send(client, resp, n, 0) < 0) {
-            ESP_LOGE(TAG, "Failed to send PLAY response");
-            break;
+            cseq, (unsigned long)s->session_id, s->server_ip, server_cfg.port, s->mount->path,
+            src->seq, (unsigned long)(src->ts_base + rtp_clock(esp_timer_get_time())));
+        if (!rtsp_send_response(s, resp, n, "PLAY")) {
+            return false;
+        }
+
+        if (s->state != SESSION_PLAYING) {
+            if (s->transport == TRANSPORT_TCP) {
+                ESP_LOGI(TAG, "Starting interleaved streaming to %s", s->client_ip);
+            } else if (s->transport == TRANSPORT_MULTICAST) {
+                ESP_LOGI(TAG, "%s watching multicast stream", s->client_ip);
+            } else {
+                ESP_LOGI(TAG, "Starting streaming to %s:%d",
+                         s->client_ip, ntohs(s->rtp_client.sin_port));
+            }
+            s->state = SESSION_PLAYING;
+            s->last_sr_us = 0;  // send a sender report with the first frame
+            mcast_update();
+            xTaskNotifyGive(capture_task_handle);
+        }
+        return true;
+
+    } else if (req->method == RTSP_METHOD_PAUSE) {
+        ESP_LOGI(TAG, "RTSP --> PAUSE response");
+        if (s->state == SESSION_PLAYING) {
+            s->state = SESSION_READY;
+            mcast_update();
         }
-        
-        streaming = true; // This will exit the handshake loop
-        ESP_LOGI(TAG, "RTSP handshake complete, starting streaming");
+        n = snprintf(resp, sizeof(resp),
+            "RTSP/1.0 200 OK\r\n"
+            "CSeq: %s\r\n"
+            "Session: %08lX\r\n"
+            "Server: ESP32-RTSP/1.0\r\n"
+            "\r\n", cseq, (unsigned long)s->session_id);
+        return rtsp_send_response(s, resp, n, "PAUSE");
 
-    } else if (strstr(recv_buf, "TEARDOWN ")) {
+    } else if (req->method == RTSP_METHOD_GET_PARAMETER) {
+        // Used by clients as a keepalive; activity time is already refreshed
+        n = snprintf(resp, sizeof(resp),
+            "RTSP/1.0 200 OK\r\n"
+            "CSeq: %s\r\n"
+            "Session: %08lX\r\n"
+            "Server: ESP32-RTSP/1.0\r\n"
+            "\r\n", cseq, (unsigned long)s->session_id);
+        return rtsp_send_response(s, resp, n, "GET_PARAMETER");
+
+    } else if (req->method == RTSP_METHOD_TEARDOWN) {
         ESP_LOGI(TAG, "RTSP --> TEARDOWN response");
-        int n = snprintf(resp, sizeof(resp),
+        n = snprintf(resp, sizeof(resp),
             "RTSP/1.0 200 OK\r\n"
             "CSeq: %s\r\n"
-            "Session: %08X\r\n"
+            "Session: %08lX\r\n"
             "Server: ESP32-RTSP/1.0\r\n"
-            "\r\n", cseq, RTP_SSRC);
-        
-        send(client, resp, n, 0);
-        break; // Client requested teardown
+            "\r\n", cseq, (unsigned long)s->session_id);
+        rtsp_send_response(s, resp, n, "TEARDOWN");
+        return false; // Client requested teardown
 
     } else {
-        ESP_LOGW(TAG, "Unknown RTSP method in: %.50s", recv_buf);
-        int n = snprintf(resp, sizeof(resp),
+        ESP_LOGW(TAG, "Unsupported RTSP method %.20s from %s", req->method_name, s->client_ip);
+        n = snprintf(resp, sizeof(resp),
             "RTSP/1.0 501 Not Implemented\r\n"
             "CSeq: %s\r\n"
             "Server: ESP32-RTSP/1.0\r\n"
             "\r\n", cseq);
-        
-        send(client, resp, n, 0);
-        // Continue loop for next request (don't break on unknown methods)
-    }
-} // End of handshake loop
-
-            // Optimized streaming loop
-            if (streaming && ntohs(rtp_client.sin_port) > 0) {
-                ESP_LOGI(TAG, "Starting streaming to %s:%d", 
-                         client_ip, ntohs(rtp_client.sin_port));
-                
-                TickType_t last_frame = xTaskGetTickCount();
-                const TickType_t frame_period = pdMS_TO_TICKS(1000 / CONFIG_RTSP_MJPEG_DEFAULT_FPS);
-                uint32_t frame_count = 0;
-
-                while (1) {
-                    // Non-blocking client check
-                    int flags = fcntl(client, F_GETFL, 0);
-                    fcntl(client, F_SETFL, flags | O_NONBLOCK);
-                    char dummy;
-                    int conn_check = recv(client, &dummy, 1, MSG_PEEK);
-                    fcntl(client, F_SETFL, flags);
-                    
-                    if (conn_check == 0 || (conn_check < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
-                        ESP_LOGI(TAG, "Client disconnected during streaming");
-                        break;
-                    }
+        // Continue with the next request (don't close on unknown methods)
+        return rtsp_send_response(s, resp, n, "error");
+    }
+}
 
-                    // Get camera frame
-                    camera_fb_t *fb = esp_camera_fb_get();
-                    if (!fb) {
-                        ESP_LOGE(TAG, "Failed to get camera frame");
-                        vTaskDelay(pdMS_TO_TICKS(100));
-                        continue;
-                    }
+//------------------------------------------------------------------------------
+// Metrics. Collected with sessions_lock held; the capture and scaler tasks'
+// counters are single words and read without it.
 
-                    // JPEG header analysis (once per session)
-                    const int jpeg_hdr_size = 8;
-                    int width = fb->width;
-                    int height = fb->height;
-                    size_t jpeg_len = fb->len;
-                    int header_len = find_sos(fb->buf, jpeg_len);
-                    
-                    if (header_len <= 0) {
-                        ESP_LOGE(TAG, "Invalid JPEG frame");
-                        esp_camera_fb_return(fb);
-                        continue;
-                    }
+static void metrics_collect(rtsp_mjpeg_server_metrics_t *server,
+                            rtsp_mjpeg_session_metrics_t *out, size_t max, size_t *count)
+{
+    int64_t now = esp_timer_get_time();
+    if (server) {
+        memset(server, 0, sizeof(*server));
+        server->uptime_ms = (now - server_start_us) / 1000;
+        server->frames_captured = frames_captured;
+        server->capture_failures = capture_failures;
+        server->frames_overrun = frames_overrun;
+        server->frames_scaled = scaler.frames;
+        server->scale_skipped = scaler.skipped;
+        server->scale_failures = scaler.failures;
+        server->sessions_active = RTSP_MAX_SESSIONS - session_count(SESSION_FREE);
+        server->sessions_playing = session_count(SESSION_PLAYING);
+        server->sessions_accepted = sessions_accepted;
+        server->sessions_rejected = sessions_rejected;
+        server->free_heap = esp_get_free_heap_size();
+    }
 
-                    int q_val = check_and_log_dqt_once(fb->buf, header_len, &dqt_logged) ? 255 : 0;
+    size_t n = 0;
+    for (int i = 0; i < RTSP_STREAM_SLOTS && out && n < max; i++) {
+        const rtsp_session_t *s = &sessions[i];
+        // HTTP connections that are not viewers are only a request away from closing
+        if (s->state == SESSION_FREE || (s->transport == TRANSPORT_HTTP && s->state == SESSION_INIT)) {
+            continue;
+        }
 
-                    // Check if JPEG header fits in packet
-                    const int max_payload = MAX_PACKET_SIZE - RTP_HEADER_SIZE - jpeg_hdr_size;
-                    if (header_len > max_payload) {
-                        ESP_LOGE(TAG, "JPEG header (%d bytes) too large for packet", header_len);
-                        esp_camera_fb_return(fb);
-                        continue;
-                    }
+        rtsp_mjpeg_session_metrics_t *m = &out[n++];
+        memset(m, 0, sizeof(*m));
+        m->session_id = s->session_id;
+        strcpy(m->client_ip, s->client_ip);
+        // MCAST_SLOT is the group sender, its members are TRANSPORT_MULTICAST
+        m->transport = (rtsp_mjpeg_transport_t)(i == MCAST_SLOT ? TRANSPORT_MULTICAST : s->transport);
+        if (s->mount) {
+            strcpy(m->mount, mount_name(s->mount));
+        }
+        m->playing = s->state == SESSION_PLAYING;
+        m->connected_ms = (now - s->connected_us) / 1000;
+        m->frames_sent = s->frame_count;
+        m->frames_dropped = s->frames_dropped;
+        m->frames_stale = s->frames_stale;
+        m->packets_sent = (s->transport == TRANSPORT_HTTP) ? s->frame_count : s->rtp_packets;
+        m->bytes_sent = s->bytes_sent;
+        m->send_failures = s->send_failures;
+        m->enobufs = s->enobufs;
+        m->nacks = s->nacks;
+        m->packets_resent = s->packets_resent;
+        m->resend_misses = s->resend_misses;
+        m->avg_frame_us = s->frame_count ? s->tx_time_us / s->frame_count : 0;
+        m->max_frame_us = s->tx_max_us;
+        if (s->frame_interval_us &&
+            now - s->last_frame_us < (int64_t)s->frame_interval_us * FPS_STALL_INTERVALS) {
+            m->fps = 1e6f / s->frame_interval_us;
+        }
+    }
+    if (count) {
+        *count = n;
+    }
+}
 
-                    // Fragment and send
-                    size_t scan_len_total = jpeg_len - header_len;
-                    size_t scan_offset = 0;
+#if METRICS_HTTP
+// Prometheus text exposition format, one labelled sample per session
+#define METRICS_TEXT_SIZE (1024 + RTSP_STREAM_SLOTS * 2048)
 
-                    while (scan_offset < scan_len_total) {
-                        bool first_pkt = (scan_offset == 0);
-                        bool last_pkt = false;
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+} metrics_text_t;
 
-                        int chunk = max_payload;
-                        if (first_pkt) chunk -= header_len;
-                        if (chunk > (int)(scan_len_total - scan_offset)) {
-                            chunk = scan_len_total - scan_offset;
-                            last_pkt = true;
-                        }
+static void metrics_printf(metrics_text_t *t, const char *fmt, ...)
+{
+    if (t->len >= t->size) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(t->buf + t->len, t->size - t->len, fmt, args);
+    va_end(args);
+    if (n > 0) {
+        t->len = (t->len + n < t->size) ? t->len + n : t->size - 1;
+    }
+}
 
-                        if (chunk <= 0) {
-                            ESP_LOGE(TAG, "Invalid chunk size: %d", chunk);
-                            break;
-                        }
+static const struct {
+    const char *name;
+    const char *type;
+    size_t offset;
+    char kind;  // 'u' uint32_t, 'U' uint64_t, 'f' float
+} session_metric_defs[] = {
+    { "frames_sent_total",     "counter", offsetof(rtsp_mjpeg_session_metrics_t, frames_sent), 'u' },
+    { "frames_dropped_total",  "counter", offsetof(rtsp_mjpeg_session_metrics_t, frames_dropped), 'u' },
+    { "frames_stale_total",    "counter", offsetof(rtsp_mjpeg_session_metrics_t, frames_stale), 'u' },
+    { "packets_sent_total",    "counter", offsetof(rtsp_mjpeg_session_metrics_t, packets_sent), 'u' },
+    { "bytes_sent_total",      "counter", offsetof(rtsp_mjpeg_session_metrics_t, bytes_sent), 'U' },
+    { "send_failures_total",   "counter", offsetof(rtsp_mjpeg_session_metrics_t, send_failures), 'u' },
+    { "enobufs_total",         "counter", offsetof(rtsp_mjpeg_session_metrics_t, enobufs), 'u' },
+    { "nacks_total",           "counter", offsetof(rtsp_mjpeg_session_metrics_t, nacks), 'u' },
+    { "packets_resent_total",  "counter", offsetof(rtsp_mjpeg_session_metrics_t, packets_resent), 'u' },
+    { "resend_misses_total",   "counter", offsetof(rtsp_mjpeg_session_metrics_t, resend_misses), 'u' },
+    { "frame_send_avg_us",     "gauge",   offsetof(rtsp_mjpeg_session_metrics_t, avg_frame_us), 'u' },
+    { "frame_send_max_us",     "gauge",   offsetof(rtsp_mjpeg_session_metrics_t, max_frame_us), 'u' },
+    { "fps",                   "gauge",   offsetof(rtsp_mjpeg_session_metrics_t, fps), 'f' },
+    { "connected_ms",          "gauge",   offsetof(rtsp_mjpeg_session_metrics_t, connected_ms), 'u' },
+};
+
+static void metrics_format(metrics_text_t *t)
+{
+    static const char *const transport_names[] = { "udp", "tcp", "multicast", "http" };
+    rtsp_mjpeg_server_metrics_t server;
+    rtsp_mjpeg_session_metrics_t list[RTSP_STREAM_SLOTS];
+    size_t count;
+    metrics_collect(&server, list, RTSP_STREAM_SLOTS, &count);
+
+    metrics_printf(t, "# TYPE rtsp_mjpeg_uptime_seconds gauge\n"
+                      "rtsp_mjpeg_uptime_seconds %lu.%03lu\n",
+                   (unsigned long)(server.uptime_ms / 1000), (unsigned long)(server.uptime_ms % 1000));
+    const struct { const char *name; const char *type; uint32_t value; } server_defs[] = {
+        { "frames_captured_total",   "counter", server.frames_captured },
+        { "capture_failures_total",  "counter", server.capture_failures },
+        { "frames_overrun_total",    "counter", server.frames_overrun },
+        { "frames_scaled_total",     "counter", server.frames_scaled },
+        { "scale_skipped_total",     "counter", server.scale_skipped },
+        { "scale_failures_total",    "counter", server.scale_failures },
+        { "sessions_active",         "gauge",   server.sessions_active },
+        { "sessions_playing",        "gauge",   server.sessions_playing },
+        { "sessions_accepted_total", "counter", server.sessions_accepted },
+        { "sessions_rejected_total", "counter", server.sessions_rejected },
+        { "free_heap_bytes",         "gauge",   server.free_heap },
+    };
+    for (size_t i = 0; i < sizeof(server_defs) / sizeof(server_defs[0]); i++) {
+        metrics_printf(t, "# TYPE rtsp_mjpeg_%s %s\nrtsp_mjpeg_%s %lu\n", server_defs[i].name,
+                       server_defs[i].type, server_defs[i].name, (unsigned long)server_defs[i].value);
+    }
 
-                        int pkt_size = RTP_HEADER_SIZE + jpeg_hdr_size + (first_pkt ? header_len : 0) + chunk;
+    for (size_t d = 0; d < sizeof(session_metric_defs) / sizeof(session_metric_defs[0]); d++) {
+        metrics_printf(t, "# TYPE rtsp_mjpeg_session_%s %s\n",
+                       session_metric_defs[d].name, session_metric_defs[d].type);
+        for (size_t i = 0; i < count; i++) {
+            const rtsp_mjpeg_session_metrics_t *m = &list[i];
+            const uint8_t *field = (const uint8_t *)m + session_metric_defs[d].offset;
+            metrics_printf(t, "rtsp_mjpeg_session_%s{session=\"%08lX\",client=\"%s\",transport=\"%s\","
+                           "mount=\"%s\"} ", session_metric_defs[d].name, (unsigned long)m->session_id,
+                           m->client_ip, transport_names[m->transport], m->mount);
+            switch (session_metric_defs[d].kind) {
+            case 'U': metrics_printf(t, "%llu\n", (unsigned long long)*(const uint64_t *)field); break;
+            case 'f': metrics_printf(t, "%.2f\n", *(const float *)field); break;
+            default:  metrics_printf(t, "%lu\n", (unsigned long)*(const uint32_t *)field); break;
+            }
+        }
+    }
+}
+#endif
 
-                        // Use pre-allocated buffer instead of malloc
-                        uint8_t *pkt = packet_buffer;
+//------------------------------------------------------------------------------
+// HTTP MJPEG viewers. They live in the session table next to RTSP clients
+// and are handed the same captured frames: each part is written straight
+// from the camera buffer, which the viewer holds a reference to until the
+// socket has taken all of it. A viewer still busy with an older frame when
+// a new one arrives skips the new one. Snapshot requests are sessions that
+// get a single JPEG, from the cached latest frame when it is recent.
 
-                        // Build packet
-                        build_rtp_header(pkt, global_seq, global_timestamp, RTP_SSRC, last_pkt);
-                        build_jpeg_header(pkt + RTP_HEADER_SIZE, scan_offset, 0, q_val, width/8, height/8);
+static bool http_send_part(rtsp_session_t *s);
 
-                        int pos = RTP_HEADER_SIZE + jpeg_hdr_size;
+// Attach a frame to an idle viewer and build what goes in front of it
+static void http_start_part(rtsp_session_t *s, shared_frame_t *sf)
+{
+    int64_t capture_us = shared_frame_capture_us(sf);
+    if (s->http_snapshot) {
+        s->http_hdr_len = snprintf(s->http_hdr, sizeof(s->http_hdr),
+                                   "HTTP/1.1 200 OK\r\n"
+                                   "Content-Type: image/jpeg\r\n"
+                                   "Content-Length: %u\r\n"
+                                   "Cache-Control: no-cache, no-store\r\n"
+                                   "Access-Control-Allow-Origin: *\r\n"
+                                   "X-Timestamp: %lld.%06ld\r\n"
+                                   "Connection: close\r\n"
+                                   "\r\n",
+                                   (unsigned)sf->fb->len, (long long)(capture_us / 1000000),
+                                   (long)(capture_us % 1000000));
+    } else {
+        s->http_hdr_len = snprintf(s->http_hdr, sizeof(s->http_hdr),
+                                   "--" HTTP_BOUNDARY "\r\n"
+                                   "Content-Type: image/jpeg\r\n"
+                                   "Content-Length: %u\r\n"
+                                   "X-Timestamp: %lld.%06ld\r\n"
+                                   "\r\n",
+                                   (unsigned)sf->fb->len, (long long)(capture_us / 1000000),
+                                   (long)(capture_us % 1000000));
+    }
+    s->http_offset = 0;
+    s->http_frame = sf;
+    s->tx_start_us = esp_timer_get_time();
+    sf->refs++;
+}
 
-                        if (first_pkt) {
-                            memcpy(pkt + pos, fb->buf, header_len);
-                            pos += header_len;
-                        }
+// Responses on a new connection fit its empty socket buffer, so they are
+// sent without waiting under sessions_lock; one that doesn't fit is given up
+static bool http_send_status(rtsp_session_t *s, const char *status)
+{
+    char resp[128];
+    int n = snprintf(resp, sizeof(resp),
+                     "HTTP/1.1 %s\r\n"
+                     "Content-Length: 0\r\n"
+                     "Connection: close\r\n"
+                     "\r\n", status);
+    send(s->ctrl_sock, resp, n, MSG_DONTWAIT);
+    return false;
+}
 
-                        memcpy(pkt + pos, fb->buf + header_len + scan_offset, chunk);
+#if METRICS_HTTP
+// Room for the response header in front of the metrics text
+#define METRICS_HDR_SIZE 160
 
-                        // Send with improved reliability
-                        if (!send_rtp_packet_reliable(rtp_sock, &rtp_client, pkt, pkt_size)) {
-                            ESP_LOGW(TAG, "Dropping packet seq=%u", global_seq);
-                        }
+// Format a scrape into the session's send queue. The text is larger than
+// lwIP's socket buffer, so it is not sent here but by http_send_part() as
+// the socket drains, without sessions_lock held across a blocking send.
+static bool http_send_metrics(rtsp_session_t *s)
+{
+    if (!txq_init(&s->txq, METRICS_HDR_SIZE + METRICS_TEXT_SIZE)) {
+        return http_send_status(s, "503 Service Unavailable");
+    }
+    metrics_text_t t = { .buf = (char *)s->txq.buf + METRICS_HDR_SIZE, .size = METRICS_TEXT_SIZE };
+    metrics_format(&t);
+
+    char hdr[METRICS_HDR_SIZE];
+    int n = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: text/plain; version=0.0.4\r\n"
+                     "Content-Length: %u\r\n"
+                     "Cache-Control: no-cache\r\n"
+                     "Connection: close\r\n"
+                     "\r\n", (unsigned)t.len);
+    // Header right in front of the text, so the queue holds the response as is
+    s->txq.head = METRICS_HDR_SIZE - n;
+    s->txq.len = n + t.len;
+    memcpy(s->txq.buf + s->txq.head, hdr, n);
+    return true;
+}
+#endif
 
-                        scan_offset += chunk;
-                        global_seq++;
-                        
-                        // Yield after each packet to prevent WiFi overflow
-                        taskYIELD();
-                    }
+// Handle the request line of a new HTTP connection. Called with sessions_lock held.
+static bool http_handle_request(rtsp_session_t *s, const rtsp_msg_t *req)
+{
+    if (req->method != RTSP_METHOD_GET) {
+        return http_send_status(s, "405 Method Not Allowed");
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "%.*s", (int)strcspn(req->uri, "?"), req->uri);
+#if METRICS_HTTP
+    if (strcmp(path, HTTP_METRICS_PATH) == 0) {
+        return http_send_metrics(s);
+    }
+#endif
+    if (strcmp(path, HTTP_SNAPSHOT_PATH) == 0) {
+        s->http_snapshot = true;
+        s->state = SESSION_PLAYING;
+        if (latest_frame &&
+            esp_timer_get_time() - shared_frame_capture_us(latest_frame) <= SNAPSHOT_MAX_AGE_US) {
+            http_start_part(s, latest_frame);
+            return http_send_part(s);
+        }
+        // Nothing recent: a playing session makes the capture stage run,
+        // and the next frame is sent by http_offer_frame()
+        xTaskNotifyGive(capture_task_handle);
+        return true;
+    }
+    mount_t *mount = NULL;
+    if (strcmp(path, HTTP_STREAM_PATH) == 0 || strcmp(path, "/") == 0) {
+        mount = &mounts[0];
+    } else {
+        for (size_t i = 0; i < mount_count && !mount; i++) {
+            if (strcmp(path, mount_name(&mounts[i])) == 0) {
+                mount = &mounts[i];
+            }
+        }
+    }
+    if (!mount) {
+        ESP_LOGW(TAG, "HTTP %s: no such path %s", s->client_ip, path);
+        return http_send_status(s, "404 Not Found");
+    }
+    if (!mount_allows(mount, TRANSPORT_HTTP)) {
+        ESP_LOGW(TAG, "HTTP %s: %s is not served over HTTP", s->client_ip, mount_name(mount));
+        return http_send_status(s, "403 Forbidden");
+    }
+    s->mount = mount;
+
+    static const char hdr[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: multipart/x-mixed-replace;boundary=" HTTP_BOUNDARY "\r\n"
+        "Cache-Control: no-cache, no-store\r\n"
+        "Pragma: no-cache\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Connection: close\r\n"
+        "\r\n";
+    if (send(s->ctrl_sock, hdr, sizeof(hdr) - 1, MSG_DONTWAIT) != sizeof(hdr) - 1) {
+        ESP_LOGW(TAG, "HTTP response to %s failed: %d", s->client_ip, errno);
+        return false;
+    }
+    ESP_LOGI(TAG, "Starting HTTP MJPEG stream of %s to %s", mount_name(mount), s->client_ip);
+    s->state = SESSION_PLAYING;
+    xTaskNotifyGive(capture_task_handle);
+    return true;
+}
 
-                    esp_camera_fb_return(fb);
-                    frame_count++;
+static bool http_on_readable(rtsp_session_t *s)
+{
+    if (s->state == SESSION_PLAYING || s->txq.buf) {
+        s->rx_len = 0;  // nothing more is expected from a viewer or a scrape; discard it
+        return true;
+    }
+    esp_err_t err = rtsp_parser_run(&s->parser, s->rx_buf, s->rx_len);
+    if (err == ESP_ERR_NOT_FINISHED) {
+        return true;
+    }
+    xSemaphoreTake(sessions_lock, portMAX_DELAY);
+    bool keep = err == ESP_OK ? http_handle_request(s, &s->parser.msg)
+                              : http_send_status(s, "400 Bad Request");
+    xSemaphoreGive(sessions_lock);
+    rtsp_parser_reset(&s->parser);
+    s->rx_len = 0;
+    return keep;
+}
 
-                    // Log statistics every 100 frames
-                    if (frame_count % 100 == 0) {
-                        ESP_LOGI(TAG, "Sent %lu frames, heap: %lu bytes", 
-                                (unsigned long)frame_count, (unsigned long)esp_get_free_heap_size());
-                    }
+// Write as much of the current part as the socket takes without blocking:
+// part header, the JPEG from the frame buffer, then CRLF unless it is a
+// snapshot. A queued metrics response is written the same way instead.
+// Called with sessions_lock held.
+static bool http_send_part(rtsp_session_t *s)
+{
+    static const char crlf[] = "\r\n";
+
+    if (s->txq.buf) {
+        if (!txq_flush(&s->txq, s->ctrl_sock)) {
+            s->send_failures++;
+            return false;
+        }
+        if (!s->txq.len) {
+            s->tx_failed = true;  // done; the server task closes it like a finished snapshot
+        }
+        return true;
+    }
+
+    while (s->http_frame) {
+        const camera_fb_t *fb = s->http_frame->fb;
+        size_t trailer = s->http_snapshot ? 0 : 2;
+        size_t total = s->http_hdr_len + fb->len + trailer;
+        size_t off = s->http_offset;
+        struct iovec iov[3];
+        int iovcnt = 0;
+
+        if (off < s->http_hdr_len) {
+            iov[iovcnt].iov_base = s->http_hdr + off;
+            iov[iovcnt++].iov_len = s->http_hdr_len - off;
+            off = s->http_hdr_len;
+        }
+        off -= s->http_hdr_len;
+        if (off < fb->len) {
+            iov[iovcnt].iov_base = fb->buf + off;
+            iov[iovcnt++].iov_len = fb->len - off;
+            off = fb->len;
+        }
+        off -= fb->len;
+        if (off < trailer) {
+            iov[iovcnt].iov_base = (void *)(crlf + off);
+            iov[iovcnt++].iov_len = trailer - off;
+        }
+
+        struct msghdr msg = {
+            .msg_iov = iov,
+            .msg_iovlen = iovcnt,
+        };
+        int sent = sendmsg(s->ctrl_sock, &msg, MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                return true;  // the server task resumes when the socket drains
+            }
+            ESP_LOGW(TAG, "HTTP send to %s failed: %d (%s)", s->client_ip, errno, strerror(errno));
+            s->send_failures++;
+            return false;
+        }
+        s->http_offset += sent;
+        s->bytes_sent += sent;
+        if (s->http_offset < total) {
+            return true;
+        }
+        shared_frame_put(s->http_frame);
+        s->http_frame = NULL;
+        session_frame_sent(s, esp_timer_get_time());
+        if (s->http_snapshot) {
+            s->tx_failed = true;  // done; the server task closes it like a failed viewer
+        }
+    }
+    return true;
+}
+
+// Start sending a frame to every idle HTTP viewer and waiting snapshot.
+// Called with sessions_lock held.
+static void http_offer_frame(shared_frame_t *sf)
+{
+    for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+        rtsp_session_t *s = &sessions[i];
+        if (s->transport != TRANSPORT_HTTP || s->state != SESSION_PLAYING || s->tx_failed) {
+            continue;
+        }
+        if (s->mount ? !s->mount->due : scaler_slot(sf->fb) >= 0) {
+            continue;  // capped below the capture rate or another source; snapshots have no mount
+        }
+        if (s->http_frame) {
+            if (!s->http_snapshot) {
+                s->frames_dropped++;
+            }
+            continue;
+        }
+        http_start_part(s, sf);
+        if (!http_send_part(s)) {
+            s->tx_failed = true;
+        }
+    }
+}
+
+// Read whatever is available on the control socket and dispatch every
+// complete request in the buffer. Returns false when the session must close.
+static bool session_on_readable(rtsp_session_t *s)
+{
+    if (s->rx_len >= sizeof(s->rx_buf) - 1) {
+        ESP_LOGW(TAG, "RTSP request from %s exceeds %d bytes", s->client_ip, RTSP_RX_BUF_SIZE);
+        return false;
+    }
+
+    int r = recv(s->ctrl_sock, s->rx_buf + s->rx_len, sizeof(s->rx_buf) - s->rx_len - 1, 0);
+    if (r <= 0) {
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        ESP_LOGI(TAG, "Client %s disconnected (recv=%d, errno=%d)", s->client_ip, r, errno);
+        return false;
+    }
+    s->rx_len += r;
+    s->rx_buf[s->rx_len] = '\0';
+    s->last_activity_us = esp_timer_get_time();
+
+    if (s->transport == TRANSPORT_HTTP) {
+        return http_on_readable(s);
+    }
 
-                    // Frame rate control
-                    vTaskDelayUntil(&last_frame, frame_period);
-                    global_timestamp += (90000 / CONFIG_RTSP_MJPEG_DEFAULT_FPS);
+    while (s->rx_len > 0) {
+        size_t msg_len;
+
+        if (s->parser.line_start == 0 && s->rx_buf[0] == '$') {
+            // Interleaved binary frame from the client (RTCP receiver reports)
+            if (s->rx_len < INTERLEAVED_HDR_SIZE) break;
+            msg_len = INTERLEAVED_HDR_SIZE + (((uint8_t)s->rx_buf[2] << 8) | (uint8_t)s->rx_buf[3]);
+            if (msg_len > s->rx_len) {
+                if (msg_len >= sizeof(s->rx_buf)) {
+                    ESP_LOGW(TAG, "Interleaved frame of %u bytes from %s too large",
+                             (unsigned)msg_len, s->client_ip);
+                    return false;
                 }
+                break;
+            }
+            if ((uint8_t)s->rx_buf[1] == s->rtcp_channel) {
+                xSemaphoreTake(sessions_lock, portMAX_DELAY);
+                session_on_rtcp(s, (const uint8_t *)s->rx_buf + INTERLEAVED_HDR_SIZE,
+                                msg_len - INTERLEAVED_HDR_SIZE);
+                xSemaphoreGive(sessions_lock);
             }
+            s->rx_len -= msg_len;
+            memmove(s->rx_buf, s->rx_buf + msg_len, s->rx_len);
+            s->rx_buf[s->rx_len] = '\0';
+            continue;
+        }
 
-            // Cleanup
-            close(rtp_sock);
-            close(client);
-            ESP_LOGI(TAG, "Client session ended");
+        // Each request is handled as soon as its last byte is in, even if
+        // more requests follow in the same read
+        esp_err_t err = rtsp_parser_run(&s->parser, s->rx_buf, s->rx_len);
+        if (err == ESP_ERR_NOT_FINISHED) {
+            if (s->parser.header_len && s->parser.msg.len >= sizeof(s->rx_buf)) {
+                ESP_LOGW(TAG, "RTSP request body of %u bytes from %s too large",
+                         (unsigned)s->parser.msg.content_length, s->client_ip);
+                return false;
+            }
+            break;
         }
-        close(ctrl_sock);
-        ESP_LOGI(TAG, "RTSP control socket closed, restarting server loop");
+        if (err != ESP_OK && err != ESP_ERR_INVALID_ARG) {
+            ESP_LOGW(TAG, "Unusable RTSP request from %s: %s", s->client_ip, esp_err_to_name(err));
+            return false;
+        }
+
+        xSemaphoreTake(sessions_lock, portMAX_DELAY);
+        bool keep;
+        if (err == ESP_OK) {
+            keep = rtsp_handle_request(s, &s->parser.msg);
+        } else {
+            // The message's extent is known, so it is answered and skipped
+            const char *cseq = rtsp_msg_header(&s->parser.msg, "CSeq");
+            char resp[128];
+            int n = snprintf(resp, sizeof(resp),
+                "RTSP/1.0 400 Bad Request\r\n"
+                "CSeq: %.32s\r\n"
+                "Server: ESP32-RTSP/1.0\r\n"
+                "\r\n", cseq ? cseq : "0");
+            ESP_LOGW(TAG, "Malformed RTSP request from %s", s->client_ip);
+            keep = rtsp_send_response(s, resp, n, "error");
+        }
+        xSemaphoreGive(sessions_lock);
+        if (!keep) {
+            return false;
+        }
+
+        msg_len = s->parser.msg.len;
+        rtsp_parser_reset(&s->parser);
+        s->rx_len -= msg_len;
+        memmove(s->rx_buf, s->rx_buf + msg_len, s->rx_len);
+        s->rx_buf[s->rx_len] = '\0';
     }
+    return true;
 }
 
-esp_err_t rtsp_mjpeg_server_start(size_t stack_size, UBaseType_t priority)
+//------------------------------------------------------------------------------
+// Streaming
+
+// Send one RTP packet, given as header and payload iovecs, over the session's transport
+static bool session_send_rtp(rtsp_session_t *s, const struct iovec *iov, int iovcnt)
 {
-    if (rtsp_task_handle) return ESP_ERR_INVALID_STATE;
-    xTaskCreate(rtsp_server_task, "rtsp_server",
-                stack_size, NULL, priority, &rtsp_task_handle);
-    return ESP_OK;
+    if (s->transport == TRANSPORT_TCP) {
+        size_t len = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            len += iov[i].iov_len;
+        }
+        uint8_t hdr[INTERLEAVED_HDR_SIZE] = { '$', s->rtp_channel, len >> 8, len & 0xFF };
+        // Space for the whole frame was checked up front
+        bool ok = txq_push(&s->txq, hdr, sizeof(hdr));
+        for (int i = 0; ok && i < iovcnt; i++) {
+            ok = txq_push(&s->txq, iov[i].iov_base, iov[i].iov_len);
+        }
+        return ok;
+    }
+    return send_rtp_packet(s, iov, iovcnt);
 }
 
-esp_err_t rtsp_mjpeg_server_stop(void)
+// Send an RTCP sender report mapping the current RTP timestamp to wallclock
+static void session_send_sr(rtsp_session_t *s, int64_t now_us)
 {
-    if (!rtsp_task_handle) return ESP_ERR_INVALID_STATE;
-    vTaskDelete(rtsp_task_handle);
-    rtsp_task_handle = NULL;
-    if (rtsp_ctrl_sock >= 0) {
-        close(rtsp_ctrl_sock);
-        rtsp_ctrl_sock = -1;
+    uint8_t pkt[INTERLEAVED_HDR_SIZE + RTCP_SR_MAX_SIZE];
+    uint8_t *sr = pkt + INTERLEAVED_HDR_SIZE;
+    char cname[32];
+    snprintf(cname, sizeof(cname), "esp32@%s", s->server_ip);
+
+    // Frames are stamped on the same clock, so this maps them to wallclock
+    uint32_t rtp_ts = s->ts_base + rtp_clock(now_us);
+    size_t len = rtcp_build_sr(sr, RTCP_SR_MAX_SIZE, s->ssrc, rtcp_ntp_now(), rtp_ts,
+                               s->rtp_packets, s->rtp_octets, cname);
+    if (!len) {
+        return;
     }
-    return ESP_OK;
-}
\ No newline at end of file
+
+    if (s->transport == TRANSPORT_TCP) {
+        pkt[0] = '$';
+        pkt[1] = s->rtcp_channel;
+        pkt[2] = len >> 8;
+        pkt[3] = len & 0xFF;
+        if (txq_space(&s->txq) < INTERLEAVED_HDR_SIZE + len + TCP_TXQ_CTRL_RESERVE) {
+            return;  // try again after the next frame
+        }
+        txq_push(&s->txq, pkt, INTERLEAVED_HDR_SIZE + len);
+        if (!txq_flush(&s->txq, s->ctrl_sock)) {
+            s->tx_failed = true;
+        }
+    } else if (sendto(s->rtcp_sock, sr, len, 0,
+                      (struct sockaddr *)&s->rtcp_client, sizeof(s->rtcp_client)) < 0) {
+        ESP_LOGD(TAG, "Sender report to %s failed: %d", s->client_ip, errno);
+    }
+    s->last_sr_us = now_us;
+}
+
+// Prepare a session for a new frame. Returns false if the frame is skipped.
+static bool session_begin_frame(rtsp_session_t *s, const rtp_jpeg_frame_t *jf,
+                                const rtp_jpeg_qt_cache_t *qt, int64_t capture_us)
+{
+    s->tx_active = false;
+    // Frames sent to earlier sessions, pacing waits and the queue all age
+    // the frame; a viewer that wants low latency gets the next one instead
+    if (s->max_age_us && esp_timer_get_time() - capture_us > s->max_age_us) {
+        s->frames_stale++;
+        pacer.stats.frames_stale++;
+        return false;
+    }
+    if (s->transport == TRANSPORT_TCP) {
+        // Queue the frame only if all of it fits; otherwise the reader is
+        // behind and this frame is skipped without touching seq numbers
+        size_t packets = jf->scan_len / (s->packet_size - RTP_HEADER_SIZE - RTP_JPEG_HDR_MAX) + 1;
+        size_t wire_len = jf->scan_len + RTP_JPEG_HDR_MAX +
+                          packets * (INTERLEAVED_HDR_SIZE + RTP_HEADER_SIZE + RTP_JPEG_HDR_MIN_MAX);
+        if (txq_space(&s->txq) < wire_len + TCP_TXQ_CTRL_RESERVE) {
+            s->frames_dropped++;
+            pacer.stats.frames_skipped++;
+            if (!txq_flush(&s->txq, s->ctrl_sock)) {
+                s->tx_failed = true;
+            }
+            return false;
+        }
+    }
+    // Quantization tables are sent when they change and then about once a
+    // second, so a viewer that lost the first packet of a frame recovers
+    s->tx_with_tables = s->qt_q != qt->q || s->qt_age >= s->mount->fps;
+    s->tx_offset = 0;
+    s->tx_start_us = esp_timer_get_time();
+    s->tx_active = true;
+    return true;
+}
+
+// Send the next RFC 2435 fragment of the current frame to one session.
+// Returns the bytes sent.
+static size_t session_send_packet(rtsp_session_t *s, const rtp_jpeg_frame_t *jf,
+                                  const rtp_jpeg_qt_cache_t *qt)
+{
+    // Only the headers are built here; the scan data is referenced in place
+    uint8_t hdr[RTP_HEADER_SIZE + RTP_JPEG_HDR_MAX];
+    size_t hdr_len = RTP_HEADER_SIZE +
+        rtp_jpeg_build_header(hdr + RTP_HEADER_SIZE, jf, qt, s->tx_offset, s->tx_with_tables);
+
+    size_t chunk = s->packet_size - hdr_len;
+    bool last_pkt = false;
+    if (chunk >= jf->scan_len - s->tx_offset) {
+        chunk = jf->scan_len - s->tx_offset;
+        last_pkt = true;
+    }
+    build_rtp_header(hdr, s->seq, s->timestamp, s->ssrc, last_pkt);
+
+    struct iovec iov[2] = {
+        { .iov_base = hdr, .iov_len = hdr_len },
+        { .iov_base = (void *)(jf->scan + s->tx_offset), .iov_len = chunk },
+    };
+
+    if (session_send_rtp(s, iov, 2)) {
+        s->bytes_sent += hdr_len + chunk + (s->transport == TRANSPORT_TCP ? INTERLEAVED_HDR_SIZE : 0);
+    } else {
+        ESP_LOGW(TAG, "Dropping packet seq=%u", s->seq);
+        pacer.stats.packets_dropped++;
+        s->send_failures++;
+    }
+    // Kept even when the stack refused it: the viewer will ask for it
+    if (s->history.data && s->transport == TRANSPORT_UDP) {
+        rtp_history_add(&s->history, s->seq, hdr, hdr_len, iov[1].iov_base, chunk, s->tx_start_us);
+    }
+    s->tx_offset += chunk;
+    s->seq++;
+    s->rtp_packets++;
+    s->rtp_octets += hdr_len - RTP_HEADER_SIZE + chunk;
+
+    if (s->transport == TRANSPORT_TCP) {
+        if (s->txq.len > pacer.stats.txq_peak) {
+            pacer.stats.txq_peak = s->txq.len;
+        }
+        if (!txq_flush(&s->txq, s->ctrl_sock)) {
+            s->tx_failed = true;
+        }
+    }
+
+    if (last_pkt) {
+        if (s->tx_with_tables) {
+            s->qt_q = qt->q;
+            s->qt_age = 0;
+        } else {
+            s->qt_age++;
+        }
+        session_frame_sent(s, esp_timer_get_time());
+        s->tx_active = false;
+    }
+    return hdr_len + chunk;
+}
+
+// Send one frame to every playing session of a due mount, a packet per
+// session in turn, so viewers see the frame at the same time. The pacer
+// spreads it over budget_us and decides when to pause; sessions_lock is
+// released while waiting so RTSP requests are served meanwhile. fb is the
+// camera frame for the trace, NULL for a scaled one. Called and returns
+// with sessions_lock held.
+static void stream_send_frame(const camera_fb_t *fb, const rtp_jpeg_frame_t *jf,
+                              const rtp_jpeg_qt_cache_t *qt, int64_t capture_us, uint32_t budget_us)
+{
+    size_t frame_bytes = 0;
+    for (int i = 0; i < RTSP_STREAM_SLOTS; i++) {
+        rtsp_session_t *s = &sessions[i];
+        if (s->state != SESSION_PLAYING || s->transport == TRANSPORT_MULTICAST ||
+            s->transport == TRANSPORT_HTTP) {
+            // Multicast members are served by the sender in MCAST_SLOT,
+            // HTTP viewers by http_offer_frame()
+            s->tx_active = false;
+            continue;
+        }
+        if (!s->mount->due) {
+            s->tx_active = false;  // its mount is capped below the capture rate
+            continue;
+        }
+        // Capture time, not send time: capture jitter and skipped frames
+        // don't turn into playback speed changes at the receiver
+        s->timestamp = s->ts_base + rtp_clock(capture_us);
+        if (session_begin_frame(s, jf, qt, capture_us)) {
+            frame_bytes += jf->scan_len;
+        }
+    }
+    if (!frame_bytes) {
+        return;
+    }
+
+    rtp_pacer_begin_frame(&pacer, frame_bytes, budget_us, PACING_MAX_RATE, esp_timer_get_time());
+    bool more = true;
+    bool first = true;
+    while (more) {
+        more = false;
+        for (int i = 0; i < RTSP_STREAM_SLOTS; i++) {
+            rtsp_session_t *s = &sessions[i];
+            // A session may have paused or closed while the lock was released
+            if (!s->tx_active || s->state != SESSION_PLAYING || s->tx_failed) {
+                s->tx_active = false;
+                continue;
+            }
+            size_t sent = session_send_packet(s, jf, qt);
+            more |= s->tx_active;
+            if (first && sent) {
+                if (fb) {
+                    CAM_TRACE(CAM_TRACE_FIRST_PACKET, fb);
+                }
+                first = false;
+            }
+
+            uint32_t wait_us = rtp_pacer_consume(&pacer, sent, esp_timer_get_time());
+            if (wait_us) {
+                TickType_t ticks = pdMS_TO_TICKS(wait_us / 1000);
+                xSemaphoreGive(sessions_lock);
+                vTaskDelay(ticks ? ticks : 1);
+                xSemaphoreTake(sessions_lock, portMAX_DELAY);
+                rtp_pacer_waited(&pacer, wait_us);
+            }
+        }
+    }
+    if (fb) {
+        CAM_TRACE(CAM_TRACE_LAST_PACKET, fb);
+    }
+    int64_t now = esp_timer_get_time();
+    rtp_pacer_end_frame(&pacer, now);
+
+    // The frame buffer goes back after this; what NACKs may still ask for is copied
+    for (int i = 0; i < RTSP_STREAM_SLOTS; i++) {
+        if (sessions[i].history.data) {
+            rtp_history_detach(&sessions[i].history);
+        }
+    }
+
+    for (int i = 0; i < RTSP_STREAM_SLOTS; i++) {
+        rtsp_session_t *s = &sessions[i];
+        if (s->state == SESSION_PLAYING && !s->tx_failed && s->rtp_packets &&
+            (!s->last_sr_us || now - s->last_sr_us >= RTCP_SR_INTERVAL_US)) {
+            session_send_sr(s, now);
+        }
+    }
+}
+
+#ifdef CONFIG_RTSP_MJPEG_ABR
+// Closed loop from send errors, pacing backlog and receiver reports to the
+// sensor's JPEG quality and frame size. Runs on the stream task between frames.
+typedef struct {
+    rate_ctrl_t rc;
+    rtsp_mjpeg_pacing_stats_t last;  // pacer counters at the previous evaluation
+    uint32_t seen_frames;
+    uint32_t max_frame_us;           // longest frame send time this period
+    int64_t last_eval_us;
+    bool enabled;
+} stream_abr_t;
+
+static void stream_abr_init(stream_abr_t *abr)
+{
+    memset(abr, 0, sizeof(*abr));
+    sensor_t *cam = esp_camera_sensor_get();
+    if (!cam || !cam->set_quality || !cam->set_framesize) {
+        ESP_LOGW(TAG, "Sensor can't change quality or frame size, bitrate adaptation off");
+        return;
+    }
+    rate_ctrl_init(&abr->rc, CONFIG_RTSP_MJPEG_ABR_LADDER, cam->status.framesize,
+                   cam->status.quality, CONFIG_RTSP_MJPEG_ABR_MAX_QUALITY,
+                   CONFIG_RTSP_MJPEG_ABR_QUALITY_STEP, CONFIG_RTSP_MJPEG_ABR_UPGRADE_PERIODS);
+    abr->last_eval_us = esp_timer_get_time();
+    abr->enabled = true;
+}
+
+// Adaptation only ever lowers the sensor settings. What a reconfiguration
+// keeps is where adaptation started from, not where it has got to.
+static void stream_abr_restore(const stream_abr_t *abr, rtsp_mjpeg_reconfig_t *rc)
+{
+    if (!abr->enabled) return;
+    if (rc->framesize == FRAMESIZE_INVALID) rc->framesize = abr->rc.ladder[0];
+    if (rc->quality < 0) rc->quality = abr->rc.base_quality;
+}
+
+static void stream_abr_update(stream_abr_t *abr, uint32_t frame_period_us)
+{
+    if (!abr->enabled) return;
+
+    int64_t now = esp_timer_get_time();
+    rate_ctrl_input_t in = { .rtcp_loss = -1 };
+
+    xSemaphoreTake(sessions_lock, portMAX_DELAY);
+    const rtsp_mjpeg_pacing_stats_t *st = &pacer.stats;
+    if (st->frames != abr->seen_frames) {
+        abr->seen_frames = st->frames;
+        if (st->last_frame_us > abr->max_frame_us) {
+            abr->max_frame_us = st->last_frame_us;
+        }
+    }
+    if (now - abr->last_eval_us < RATE_CTRL_PERIOD_US) {
+        xSemaphoreGive(sessions_lock);
+        return;
+    }
+    in.packets = st->packets - abr->last.packets;
+    in.send_errors = (st->enobufs - abr->last.enobufs) + (st->packets_dropped - abr->last.packets_dropped);
+    in.frames = st->frames - abr->last.frames;
+    in.frames_skipped = st->frames_skipped - abr->last.frames_skipped;
+    for (int i = 0; i < RTSP_STREAM_SLOTS; i++) {
+        const rtsp_session_t *s = &sessions[i];
+        // Only reports that arrived during this period say something new
+        if (s->state != SESSION_PLAYING || !s->rr_count || s->last_rr_us <= abr->last_eval_us) continue;
+        if (s->rr.fraction_lost > in.rtcp_loss) in.rtcp_loss = s->rr.fraction_lost;
+        uint32_t jitter_us = (uint64_t)s->rr.jitter * 1000 / 90;
+        if (jitter_us > in.rtcp_jitter_us) in.rtcp_jitter_us = jitter_us;
+    }
+    abr->last = *st;
+    xSemaphoreGive(sessions_lock);
+
+    in.max_frame_us = abr->max_frame_us;
+    in.frame_period_us = frame_period_us;
+    in.frame_budget_us = PACING_SPREAD_PERCENT ? frame_period_us * PACING_SPREAD_PERCENT / 100
+                                               : frame_period_us;
+    abr->max_frame_us = 0;
+    abr->last_eval_us = now;
+
+    if (rate_ctrl_update(&abr->rc, &in)) {
+        sensor_t *cam = esp_camera_sensor_get();
+        if (cam->status.framesize != rate_ctrl_framesize(&abr->rc)) {
+            cam->set_framesize(cam, rate_ctrl_framesize(&abr->rc));
+        }
+        cam->set_quality(cam, abr->rc.quality);
+    }
+}
+#endif
+
+// Stopped: tell rtsp_mjpeg_server_stop() and wait to be deleted. The task
+// stays valid until then, so the others can still notify it.
+static void task_park(int task)
+{
+    xSemaphoreTake(sessions_lock, portMAX_DELAY);
+    tasks_parked |= 1 << task;
+    xSemaphoreGive(sessions_lock);
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Capture stage. Grabs frames at the configured rate and hands them to the
+// transmit stage, so the next frame is exposed while one is still being sent.
+
+static void frame_queue_put(camera_fb_t *fb)
+{
+    if (xQueueSend(frame_queue, &fb, 0) == pdTRUE) {
+        return;
+    }
+    frames_overrun++;
+#ifdef CONFIG_RTSP_MJPEG_QUEUE_DROP_OLDEST
+    camera_fb_t *old;
+    if (xQueueReceive(frame_queue, &old, 0) == pdTRUE) {
+        esp_camera_fb_return(old);
+    }
+    if (xQueueSend(frame_queue, &fb, 0) == pdTRUE) {
+        return;
+    }
+#endif
+    esp_camera_fb_return(fb);
+}
+
+// Give queued frames back to the driver
+static void frame_queue_flush(void)
+{
+    camera_fb_t *fb;
+    while (xQueueReceive(frame_queue, &fb, 0) == pdTRUE) {
+        esp_camera_fb_return(fb);
+    }
+}
+
+static void rtsp_capture_task(void *pvParameters)
+{
+    TickType_t last_frame = xTaskGetTickCount();
+
+    while (!server_stopping) {
+        xSemaphoreTake(sessions_lock, portMAX_DELAY);
+        int playing = session_count(SESSION_PLAYING);
+        xSemaphoreGive(sessions_lock);
+
+        if (playing == 0) {
+            // Nobody is watching: don't touch the camera until PLAY arrives,
+            // and don't let the first viewer see a stale frame
+            frame_queue_flush();
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            last_frame = xTaskGetTickCount();
+            continue;
+        }
+
+        // Get camera frame
+        camera_fb_t *fb = esp_camera_fb_get();
+        if (!fb) {
+            capture_failures++;
+            ESP_LOGE(TAG, "Failed to get camera frame");
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+        if (server_stopping) {
+            esp_camera_fb_return(fb);
+            break;
+        }
+        frames_captured++;
+        frame_queue_put(fb);
+        // The stream task sleeps on its notification, which both the
+        // capture and scaler stages give, not on one queue
+        xTaskNotifyGive(stream_task_handle);
+
+        // Log statistics every 100 frames
+        if (frames_captured % 100 == 0) {
+            ESP_LOGI(TAG, "Captured %lu frames (%lu dropped, queue full), %d viewers, heap: %lu bytes",
+                    (unsigned long)frames_captured, (unsigned long)frames_overrun,
+                    playing, (unsigned long)esp_get_free_heap_size());
+        }
+
+        // Frame rate control; the rate may be changed while running
+        vTaskDelayUntil(&last_frame, pdMS_TO_TICKS(1000 / server_cfg.fps));
+    }
+    task_park(TASK_CAPTURE);
+}
+
+//------------------------------------------------------------------------------
+// Scaler stage, for the scaled mount. Runs on its own core at its mount's
+// rate; frames due while it is still busy are skipped, never queued.
+
+static bool mount_playing(const mount_t *m)
+{
+    for (int i = 0; i < RTSP_STREAM_SLOTS; i++) {
+        if (sessions[i].state == SESSION_PLAYING && sessions[i].mount == m) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Hand a camera frame to the scaler. Called with sessions_lock held.
+static void scaler_offer(shared_frame_t *sf)
+{
+    if (!mount_playing(scaler.mount)) {
+        return;
+    }
+    if (scaler.in) {
+        scaler.skipped++;  // the previous one hasn't even been copied yet
+        return;
+    }
+    sf->refs++;
+    scaler.in = sf;
+    xTaskNotifyGive(scaler.task);
+}
+
+// Scale the copied JPEG of len bytes into output buffer slot
+static esp_err_t scaler_encode(int slot, size_t len)
+{
+    camera_fb_t *fb = &scaler.out[slot];
+    // A smaller picture rarely encodes larger than the camera's JPEG did;
+    // a frame that doesn't fit doubles the room for the next ones
+    size_t want = len > scaler.out_want ? len : scaler.out_want;
+    if (scaler.out_size[slot] < want) {
+        free(fb->buf);
+        fb->buf = psram_alloc(want);
+        scaler.out_size[slot] = fb->buf ? want : 0;
+        if (!fb->buf) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    uint16_t width, height;
+    esp_err_t err = jpeg_scaler_run(&scaler.js, scaler.copy, len, scaler.mount->scale,
+                                    scaler.mount->quality, fb->buf, scaler.out_size[slot],
+                                    &fb->len, &width, &height);
+    if (err == ESP_ERR_INVALID_SIZE) {
+        scaler.out_want = scaler.out_size[slot] * 2;
+    } else if (err == ESP_OK) {
+        fb->width = width;
+        fb->height = height;
+        fb->format = PIXFORMAT_JPEG;
+    }
+    return err;
+}
+
+static void rtsp_scaler_task(void *pvParameters)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (server_stopping) {
+            break;
+        }
+
+        xSemaphoreTake(sessions_lock, portMAX_DELAY);
+        shared_frame_t *sf = scaler.in;
+        int slot = -1;
+        for (int i = 0; i < SCALER_BUFFERS && sf && slot < 0; i++) {
+            if (!scaler.out_busy[i]) {
+                slot = i;
+                scaler.out_busy[i] = true;
+            }
+        }
+        xSemaphoreGive(sessions_lock);
+        if (!sf) {
+            continue;
+        }
+
+        // The frame can't change while referenced; copy it without the lock
+        const camera_fb_t *src = sf->fb;
+        size_t len = src->len;
+        struct timeval timestamp = src->timestamp;
+        bool copied = false;
+        if (slot >= 0) {
+            if (len > scaler.copy_size) {
+                free(scaler.copy);
+                scaler.copy_size = len + len / 4;
+                scaler.copy = psram_alloc(scaler.copy_size);
+                if (!scaler.copy) {
+                    scaler.copy_size = 0;
+                }
+            }
+            if (scaler.copy) {
+                memcpy(scaler.copy, src->buf, len);
+                copied = true;
+            }
+        }
+        xSemaphoreTake(sessions_lock, portMAX_DELAY);
+        shared_frame_put(sf);
+        scaler.in = NULL;
+        if (slot < 0) {
+            scaler.skipped++;  // both outputs still queued or being sent
+        }
+        xSemaphoreGive(sessions_lock);
+        if (slot < 0) {
+            continue;
+        }
+
+        esp_err_t err = copied ? scaler_encode(slot, len) : ESP_ERR_NO_MEM;
+        if (err != ESP_OK) {
+            if (scaler.failures++ % 100 == 0) {
+                ESP_LOGW(TAG, "Can't scale frame for %s: %s", mount_name(scaler.mount), esp_err_to_name(err));
+            }
+            xSemaphoreTake(sessions_lock, portMAX_DELAY);
+            scaler.out_busy[slot] = false;
+            xSemaphoreGive(sessions_lock);
+            continue;
+        }
+        // Capture time of the source frame, so RTP time follows the camera
+        camera_fb_t *fb = &scaler.out[slot];
+        fb->timestamp = timestamp;
+        scaler.frames++;
+        xQueueSend(scaler.queue, &fb, 0);  // never full: it holds SCALER_BUFFERS
+        xTaskNotifyGive(stream_task_handle);
+        // The idle task gets its turn (and feeds the task watchdog) even
+        // when frames come in faster than they are scaled
+        vTaskDelay(1);
+    }
+    task_park(TASK_SCALER);
+}
+
+//------------------------------------------------------------------------------
+// Transmit stage. Fans each queued frame out to every playing session.
+// Control traffic and disconnects are handled by the server task, so the
+// frame path does no per-session socket polling.
+
+// True if every playing viewer limits frame age, i.e. nobody needs every frame
+static bool stream_all_fresh(void)
+{
+    bool any = false;
+    for (int i = 0; i < RTSP_STREAM_SLOTS; i++) {
+        const rtsp_session_t *s = &sessions[i];
+        // HTTP viewers skip frames on their own while busy
+        if (s->state != SESSION_PLAYING || s->transport == TRANSPORT_MULTICAST ||
+            s->transport == TRANSPORT_HTTP) continue;
+        if (!s->max_age_us) return false;
+        any = true;
+    }
+    return any;
+}
+
+// Latest frame wins: if newer frames are already queued and no viewer wants
+// every frame, skip the older ones instead of sending them late
+static camera_fb_t *stream_skip_to_newest(camera_fb_t *fb)
+{
+    if (!uxQueueMessagesWaiting(frame_queue)) {
+        return fb;
+    }
+
+    xSemaphoreTake(sessions_lock, portMAX_DELAY);
+    if (stream_all_fresh()) {
+        camera_fb_t *newer;
+        while (xQueueReceive(frame_queue, &newer, 0) == pdTRUE) {
+            esp_camera_fb_return(fb);
+            fb = newer;
+            pacer.stats.frames_stale++;
+            for (int i = 0; i < RTSP_STREAM_SLOTS; i++) {
+                rtsp_session_t *s = &sessions[i];
+                if (s->state == SESSION_PLAYING && s->transport != TRANSPORT_MULTICAST &&
+                    s->transport != TRANSPORT_HTTP) {
+                    s->frames_stale++;
+                }
+            }
+        }
+    }
+    xSemaphoreGive(sessions_lock);
+    return fb;
+}
+
+// Take the settings rtsp_mjpeg_reconfigure() left, if any. The frame rate
+// changes at once: capture and the mount schedule read it every frame.
+static bool stream_reconfig_take(rtsp_mjpeg_reconfig_t *rc)
+{
+    xSemaphoreTake(sessions_lock, portMAX_DELAY);
+    bool queued = reconfig_queued;
+    if (queued) {
+        *rc = reconfig_pending;
+        reconfig_queued = false;
+        if (rc->fps) {
+            server_cfg.fps = rc->fps;
+            for (size_t i = 0; i < mount_count; i++) {
+                mount_set_rate(&mounts[i], rc->fps);
+            }
+        }
+    }
+    xSemaphoreGive(sessions_lock);
+    return queued;
+}
+
+// Sensor changes are made here, between frames, where bitrate adaptation
+// makes its own; the sensor is never driven from two tasks at once
+static void stream_reconfig_apply(const rtsp_mjpeg_reconfig_t *rc)
+{
+    sensor_t *cam = esp_camera_sensor_get();
+    if (rc->framesize != FRAMESIZE_INVALID && rc->framesize != cam->status.framesize &&
+        cam->set_framesize(cam, rc->framesize) != 0) {
+        ESP_LOGE(TAG, "Sensor can't switch to %ux%u", resolution[rc->framesize].width,
+                 resolution[rc->framesize].height);
+    }
+    if (rc->quality >= 0 && cam->set_quality(cam, rc->quality) != 0) {
+        ESP_LOGE(TAG, "Sensor can't set quality %d", rc->quality);
+    }
+    framesize_t fs = cam->status.framesize;
+    ESP_LOGI(TAG, "Reconfigured to %ux%u, quality %u, %u fps", resolution[fs].width,
+             resolution[fs].height, cam->status.quality, server_cfg.fps);
+}
+
+static void rtsp_stream_task(void *pvParameters)
+{
+    uint32_t frame_count = 0;
+    bool dht_warned = false;
+#ifdef CONFIG_RTSP_MJPEG_ABR
+    stream_abr_t abr;
+    stream_abr_init(&abr);
+#endif
+
+    while (!server_stopping) {
+        rtsp_mjpeg_reconfig_t rc;
+        if (stream_reconfig_take(&rc)) {
+#ifdef CONFIG_RTSP_MJPEG_ABR
+            stream_abr_restore(&abr, &rc);
+            stream_reconfig_apply(&rc);
+            stream_abr_init(&abr);
+#else
+            stream_reconfig_apply(&rc);
+#endif
+        }
+
+        // Scaled frames first: they are few and their viewers wait longest
+        camera_fb_t *fb;
+        if ((!scaler.queue || xQueueReceive(scaler.queue, &fb, 0) != pdTRUE) &&
+            xQueueReceive(frame_queue, &fb, 0) != pdTRUE) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        const uint32_t frame_period_us = 1000000 / server_cfg.fps;
+        bool scaled = scaler_slot(fb) >= 0;
+        if (!scaled) {
+            fb = stream_skip_to_newest(fb);
+            CAM_TRACE(CAM_TRACE_TX_DEQUEUE, fb);
+        }
+        rtp_jpeg_qt_cache_t *qt = &qt_cache[scaled];
+
+        // JPEG header analysis, shared by all sessions; scaled frames have
+        // no marker index from the driver and are parsed in full
+        rtp_jpeg_frame_t jf;
+        esp_err_t err = rtp_jpeg_parse_fb(fb, &jf);
+
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "JPEG frame can't be sent as RFC 2435: %s", esp_err_to_name(err));
+        } else {
+            if (!jf.std_huffman && !dht_warned) {
+                // Receivers rebuild the Annex K tables; a custom DHT would not decode
+                ESP_LOGW(TAG, "Sensor uses non-standard Huffman tables, receivers may fail to decode");
+                dht_warned = true;
+            }
+            rtp_jpeg_qt_update(qt, &jf);
+        }
+
+        int64_t capture_us = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+        // A picture 1/scale the size is spread over 1/scale of the interval,
+        // so it doesn't hold up the next camera frame
+        uint32_t budget_us = frame_period_us * PACING_SPREAD_PERCENT / 100;
+        if (scaled) {
+            budget_us /= scaler.mount->scale;
+        }
+        xSemaphoreTake(sessions_lock, portMAX_DELAY);
+        bool scale = mounts_schedule(capture_us, frame_period_us, scaled);
+        // HTTP viewers and the scaler take a reference and work on the frame
+        // themselves, so it reaches them while RTP is still being paced
+        shared_frame_t *sf = shared_frame_wrap(fb);
+        if (sf) {
+            if (!scaled) {
+                shared_frame_set_latest(sf);
+            }
+            if (scale) {
+                scaler_offer(sf);
+            }
+            http_offer_frame(sf);
+        }
+        if (err == ESP_OK) {
+            stream_send_frame(scaled ? NULL : fb, &jf, qt, capture_us, budget_us);
+        }
+        if (sf) {
+            shared_frame_put(sf);
+        } else {
+            frame_release(fb);
+        }
+        xSemaphoreGive(sessions_lock);
+        frame_count++;
+
+#ifdef CONFIG_RTSP_MJPEG_ABR
+        stream_abr_update(&abr, frame_period_us);
+#endif
+
+        if (frame_count % 100 == 0) {
+            ESP_LOGI(TAG, "Pacing %lu kbit/s, last frame %lu us (max %lu), %lu waits, %lu ENOBUFS",
+                    (unsigned long)pacer.stats.rate_kbps, (unsigned long)pacer.stats.last_frame_us,
+                    (unsigned long)pacer.stats.max_frame_us, (unsigned long)pacer.stats.waits,
+                    (unsigned long)pacer.stats.enobufs);
+        }
+    }
+    task_park(TASK_STREAM);
+}
+
+//------------------------------------------------------------------------------
+// Server event loop: one select() over the listening socket and every
+// control connection. Nothing here blocks on a single client.
+
+static int rtsp_open_listener(uint16_t port, const char *proto)
+{
+    struct sockaddr_in serv = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = INADDR_ANY,
+        .sin_port = htons(port)
+    };
+
+    ESP_LOGI(TAG, "Creating %s listening socket...", proto);
+    int ctrl_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (ctrl_sock < 0) {
+        ESP_LOGE(TAG, "Failed to create %s listening socket", proto);
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(ctrl_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    if (bind(ctrl_sock, (struct sockaddr*)&serv, sizeof(serv)) < 0) {
+        ESP_LOGE(TAG, "Failed to bind %s socket to port %u: %d", proto, port, errno);
+        close(ctrl_sock);
+        return -1;
+    }
+
+    if (listen(ctrl_sock, 5) < 0) {
+        ESP_LOGE(TAG, "Failed to listen on %s socket", proto);
+        close(ctrl_sock);
+        return -1;
+    }
+
+    // accept() is only called when select() reports a pending connection,
+    // but a client may reset in between; never let that block the loop
+    fcntl(ctrl_sock, F_SETFL, fcntl(ctrl_sock, F_GETFL, 0) | O_NONBLOCK);
+
+    ESP_LOGI(TAG, "%s listening on port %u", proto, port);
+    return ctrl_sock;
+}
+
+static void rtsp_accept_client(int ctrl_sock, transport_t transport)
+{
+    struct sockaddr_in cli;
+    socklen_t addrlen = sizeof(cli);
+
+    int client = accept(ctrl_sock, (struct sockaddr*)&cli, &addrlen);
+    if (client < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            ESP_LOGW(TAG, "accept() failed: %d", errno);
+        }
+        return;
+    }
+    if (transport == TRANSPORT_HTTP) {
+        ESP_LOGD(TAG, "HTTP client connected %s", inet_ntoa(cli.sin_addr));
+    } else {
+        ESP_LOGI(TAG, "Client connected %s, free heap: %lu bytes",
+                 inet_ntoa(cli.sin_addr), (unsigned long)esp_get_free_heap_size());
+    }
+
+    rtsp_session_t *s = session_alloc(client, &cli);
+    if (!s) {
+        sessions_rejected++;
+        ESP_LOGW(TAG, "All %d sessions in use, rejecting %s",
+                 server_cfg.max_sessions, inet_ntoa(cli.sin_addr));
+        const char *busy = (transport == TRANSPORT_HTTP) ?
+            "HTTP/1.1 503 Service Unavailable\r\n"
+            "Content-Length: 0\r\n"
+            "Connection: close\r\n"
+            "\r\n" :
+            "RTSP/1.0 503 Service Unavailable\r\n"
+            "Server: ESP32-RTSP/1.0\r\n"
+            "\r\n";
+        send(client, busy, strlen(busy), MSG_DONTWAIT);
+        close(client);
+        return;
+    }
+    sessions_accepted++;
+    // RTSP clients pick UDP or TCP in SETUP; HTTP viewers are fixed from the start
+    if (transport == TRANSPORT_HTTP) {
+        s->transport = TRANSPORT_HTTP;
+    }
+
+    // Responses are small; don't let a stuck peer hold up the event loop
+    struct timeval timeout = {.tv_sec = 2, .tv_usec = 0};
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+// Drop sessions whose client went quiet without closing the connection.
+// Playing sessions are only closed by TEARDOWN or disconnect since not
+// every client sends keepalives while receiving RTP.
+static void rtsp_reap_idle_sessions(void)
+{
+    int64_t now = esp_timer_get_time();
+
+    xSemaphoreTake(sessions_lock, portMAX_DELAY);
+    for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+        rtsp_session_t *s = &sessions[i];
+        if (s->state == SESSION_FREE || s->state == SESSION_PLAYING) continue;
+        if (now - s->last_activity_us > (int64_t)RTSP_SESSION_TIMEOUT_S * 1000000) {
+            ESP_LOGW(TAG, "Session %08lX (%s) timed out", (unsigned long)s->session_id, s->client_ip);
+            session_close(s);
+        }
+    }
+    xSemaphoreGive(sessions_lock);
+}
+
+static void rtsp_server_task(void *pvParameters)
+{
+    ESP_LOGI(TAG, "RTSP server task started");
+
+    while (!server_stopping) {
+        int ctrl_sock = rtsp_open_listener(server_cfg.port, "RTSP");
+        if (ctrl_sock < 0) {
+            vTaskDelay(pdMS_TO_TICKS(1000));
+            continue;
+        }
+        rtsp_ctrl_sock = ctrl_sock;
+        // The RTSP server runs without it if the HTTP port can't be opened
+        int http_sock = server_cfg.http_port ? rtsp_open_listener(server_cfg.http_port, "HTTP") : -1;
+        http_listen_sock = http_sock;
+
+        // Sessions are left to rtsp_mjpeg_server_stop(), which closes them
+        // once no task can touch them any more
+        while (!server_stopping) {
+            fd_set rfds, wfds;
+            FD_ZERO(&rfds);
+            FD_ZERO(&wfds);
+            FD_SET(ctrl_sock, &rfds);
+            int max_fd = ctrl_sock;
+            if (http_sock >= 0) {
+                FD_SET(http_sock, &rfds);
+                if (http_sock > max_fd) max_fd = http_sock;
+            }
+
+            // Only the server task adds or removes sessions, so the table
+            // can be read here without the lock
+            for (int i = 0; i < RTSP_MAX_SESSIONS; i++) {
+                rtsp_session_t *s = &sessions[i];
+                if (s->state == SESSION_FREE) continue;
+                if (s->tx_failed) {
+                    xSemaphoreTake(sessions_lock, portMAX_DELAY);
+                    session_close(s);
+                    xSemaphoreGive(sessions_lock);
+                    continue;
+                }
+                FD_SET(s->ctrl_sock, &rfds);
+                if (s->txq.len > 0 || s->http_frame) {
+                    FD_SET(s->ctrl_sock, &wfds);
+                }
+                if (s->ctrl_sock > max_fd) max_fd = s->ctrl_sock;
+                if (s->rtcp_sock >= 0) {
+                    FD_SET(s->rtcp_sock, &rfds);
+                    if (s->rtcp_sock > max_fd) max_fd = s->rtcp_sock;
+                }
+            }
+            rtsp_session_t *mcast = &sessions[MCAST_SLOT];
+            if (mcast->state != SESSION_FREE) {
+                FD_SET(mcast->rtcp_sock, &rfds);
+                if (mcast->rtcp_sock > max_fd) max_fd = mcast->rtcp_sock;
+            }
+
+            struct timeval tv = {
+                .tv_sec = RTSP_POLL_INTERVAL_MS / 1000,
+                .tv_usec = (RTSP_POLL_INTERVAL_MS % 1000) * 1000
+            };
+            int ready = select(max_fd + 1, &rfds, &wfds, NULL, &tv);
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                ESP_LOGE(TAG, "select() failed: %d", errno);
+                break;
+            }
+
+            if (ready > 0 && mcast->state != SESSION_FREE && FD_ISSET(mcast->rtcp_sock, &rfds)) {
+                session_read_rtcp(mcast);
+            }
+
+            for (int i = 0; i < RTSP_MAX_SESSIONS && ready > 0; i++) {
+                rtsp_session_t *s = &sessions[i];
+                if (s->state == SESSION_FREE) continue;
+
+                if (FD_ISSET(s->ctrl_sock, &wfds)) {
+                    // Drain the interleaved queue or the HTTP part the
+                    // stream task could not finish
+                    xSemaphoreTake(sessions_lock, portMAX_DELAY);
+                    bool ok = (s->transport == TRANSPORT_HTTP) ? http_send_part(s) :
+                              txq_flush(&s->txq, s->ctrl_sock);
+                    if (!ok) {
+                        s->tx_failed = true;
+                    }
+                    xSemaphoreGive(sessions_lock);
+                }
+
+                if (s->rtcp_sock >= 0 && FD_ISSET(s->rtcp_sock, &rfds)) {
+                    session_read_rtcp(s);
+                }
+
+                if (!FD_ISSET(s->ctrl_sock, &rfds)) continue;
+                if (!session_on_readable(s)) {
+                    xSemaphoreTake(sessions_lock, portMAX_DELAY);
+                    session_close(s);
+                    xSemaphoreGive(sessions_lock);
+                }
+            }
+
+            if (ready > 0 && FD_ISSET(ctrl_sock, &rfds)) {
+                rtsp_accept_client(ctrl_sock, TRANSPORT_UDP);
+            }
+            if (ready > 0 && http_sock >= 0 && FD_ISSET(http_sock, &rfds)) {
+                rtsp_accept_client(http_sock, TRANSPORT_HTTP);
+            }
+
+            rtsp_reap_idle_sessions();
+        }
+        close(ctrl_sock);
+        rtsp_ctrl_sock = -1;
+        if (http_sock >= 0) {
+            close(http_sock);
+            http_listen_sock = -1;
+        }
+        if (!server_stopping) {
+            ESP_LOGI(TAG, "RTSP control socket closed, restarting server loop");
+        }
+    }
+    task_park(TASK_SERVER);
+}
+
+// Check a configuration and make it the one the server runs with
+static esp_err_t server_config_set(const rtsp_mjpeg_config_t *config)
+{
+    static const rtsp_mjpeg_mount_t root_mount = { .path = "/" };
+    const rtsp_mjpeg_mount_t *list = config->mount_count ? config->mounts : &root_mount;
+    size_t count = config->mount_count ? config->mount_count : 1;
+
+    if (!config->port || !config->fps || !config->stack_size) {
+        ESP_LOGE(TAG, "Port, fps and stack size must be set");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->packet_size < PACKET_SIZE_MIN || config->packet_size > UDP_PACKET_SIZE_MAX) {
+        ESP_LOGE(TAG, "Packet size %u outside %d-%d", config->packet_size,
+                 PACKET_SIZE_MIN, UDP_PACKET_SIZE_MAX);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!config->max_sessions || config->max_sessions > RTSP_MAX_SESSIONS) {
+        ESP_LOGE(TAG, "Max sessions %u outside 1-%d (CONFIG_RTSP_MJPEG_MAX_SESSIONS)",
+                 config->max_sessions, RTSP_MAX_SESSIONS);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!list || count > RTSP_MJPEG_MAX_MOUNTS) {
+        ESP_LOGE(TAG, "Up to %d mounts can be served", RTSP_MJPEG_MAX_MOUNTS);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    mount_t table[RTSP_MJPEG_MAX_MOUNTS] = {0};
+    for (size_t i = 0; i < count; i++) {
+        const rtsp_mjpeg_mount_t *in = &list[i];
+        mount_t *m = &table[i];
+        if (!in->path || in->path[0] != '/' || strlen(in->path) >= sizeof(m->path) ||
+            strpbrk(in->path, "? \t\r\n")) {
+            ESP_LOGE(TAG, "Mount %u: path must start with '/' and be under %d bytes",
+                     (unsigned)i, RTSP_MJPEG_MOUNT_PATH_MAX);
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (in->source == RTSP_MJPEG_SOURCE_SCALED) {
+            if (in->scale != 2 && in->scale != 4 && in->scale != 8) {
+                ESP_LOGE(TAG, "Mount %s: scale must be 2, 4 or 8", in->path);
+                return ESP_ERR_INVALID_ARG;
+            }
+            if (in->quality > 100) {
+                ESP_LOGE(TAG, "Mount %s: encoder quality must be 1-100", in->path);
+                return ESP_ERR_INVALID_ARG;
+            }
+            for (size_t j = 0; j < i; j++) {
+                if (table[j].source == RTSP_MJPEG_SOURCE_SCALED) {
+                    ESP_LOGE(TAG, "Mount %s: only one scaled mount can be served", in->path);
+                    return ESP_ERR_INVALID_ARG;
+                }
+            }
+            m->scale = in->scale;
+            m->quality = in->quality ? in->quality : SCALER_DEFAULT_QUALITY;
+        } else if (in->source != RTSP_MJPEG_SOURCE_CAMERA) {
+            ESP_LOGE(TAG, "Mount %s: unknown source %d", in->path, in->source);
+            return ESP_ERR_INVALID_ARG;
+        }
+        strcpy(m->path, in->path);
+        size_t len = strlen(m->path);
+        while (len > 0 && m->path[len - 1] == '/') {
+            m->path[--len] = '\0';
+        }
+        for (size_t j = 0; j < i; j++) {
+            if (strcmp(table[j].path, m->path) == 0) {
+                ESP_LOGE(TAG, "Mount %s listed twice", in->path);
+                return ESP_ERR_INVALID_ARG;
+            }
+        }
+        m->source = in->source;
+        m->transports = in->transports;
+        m->fps_cap = in->fps;
+        mount_set_rate(m, config->fps);
+    }
+
+    server_cfg = *config;
+    snprintf(server_name, sizeof(server_name), "%s", config->name ? config->name : "ESP32 MJPEG");
+    server_cfg.name = server_name;
+    server_cfg.mounts = NULL;
+    server_cfg.mount_count = count;
+    memcpy(mounts, table, sizeof(mounts));
+    mount_count = count;
+
+    // One sensor, one quality: the best any camera mount asks for
+    int quality = -1;
+    for (size_t i = 0; i < count; i++) {
+        if (list[i].source == RTSP_MJPEG_SOURCE_CAMERA && list[i].quality &&
+            (quality < 0 || list[i].quality < quality)) {
+            quality = list[i].quality;
+        }
+    }
+    sensor_t *cam = esp_camera_sensor_get();
+    if (quality >= 0 && cam && cam->set_quality) {
+        cam->set_quality(cam, quality);
+    }
+
+    scaler.mount = NULL;
+    for (size_t i = 0; i < count; i++) {
+        if (mounts[i].source == RTSP_MJPEG_SOURCE_SCALED) {
+            scaler.mount = &mounts[i];
+            ESP_LOGI(TAG, "Mount %s: %u fps, 1/%u scale, quality %u", mount_name(&mounts[i]),
+                     mounts[i].fps, mounts[i].scale, mounts[i].quality);
+        } else {
+            ESP_LOGI(TAG, "Mount %s: %u fps", mount_name(&mounts[i]), mounts[i].fps);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t rtsp_mjpeg_server_start(size_t stack_size, UBaseType_t priority)
+{
+    rtsp_mjpeg_config_t config = RTSP_MJPEG_DEFAULT_CONFIG();
+    config.stack_size = stack_size;
+    config.priority = priority;
+    return rtsp_mjpeg_server_start_config(&config);
+}
+
+esp_err_t rtsp_mjpeg_server_start_config(const rtsp_mjpeg_config_t *config)
+{
+    if (!config) return ESP_ERR_INVALID_ARG;
+    if (rtsp_task_handle) return ESP_ERR_INVALID_STATE;
+
+    esp_err_t err = server_config_set(config);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (!sessions_lock) {
+        sessions_lock = xSemaphoreCreateMutex();
+        if (!sessions_lock) return ESP_ERR_NO_MEM;
+    }
+    if (!frame_queue) {
+        frame_queue = xQueueCreate(FRAME_QUEUE_LEN, sizeof(camera_fb_t *));
+        if (!frame_queue) return ESP_ERR_NO_MEM;
+    }
+    if (scaler.mount && !scaler.queue) {
+        scaler.queue = xQueueCreate(SCALER_BUFFERS, sizeof(camera_fb_t *));
+        if (!scaler.queue) return ESP_ERR_NO_MEM;
+    }
+    scaler.frames = 0;
+    scaler.failures = 0;
+    scaler.skipped = 0;
+    scaler.out_want = SCALER_BUF_MIN;
+    server_stopping = false;
+
+    server_start_us = esp_timer_get_time();
+    sessions_accepted = 0;
+    sessions_rejected = 0;
+
+    // The smallest wait the pacer asks for is one scheduler tick
+    rtp_pacer_init(&pacer, PACING_BURST, portTICK_PERIOD_MS * 1000);
+
+    // Capture and transmit on different cores so a long send never delays
+    // the next frame
+    UBaseType_t priority = server_cfg.priority;
+    if (xTaskCreatePinnedToCore(rtsp_stream_task, "rtsp_stream", server_cfg.stack_size, NULL, priority,
+                                &stream_task_handle, CORE_ID(server_cfg.tx_core)) != pdPASS) {
+        stream_task_handle = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(rtsp_capture_task, "rtsp_capture", 4 * 1024, NULL, priority,
+                                &capture_task_handle, CORE_ID(server_cfg.capture_core)) != pdPASS) {
+        vTaskDelete(stream_task_handle);
+        stream_task_handle = NULL;
+        capture_task_handle = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    // Scaling is background work: lowest priority, so it never delays
+    // capture or a send on the core it shares
+    if (scaler.mount &&
+        xTaskCreatePinnedToCore(rtsp_scaler_task, "rtsp_scaler", SCALER_STACK_SIZE, NULL, tskIDLE_PRIORITY + 1,
+                                &scaler.task, CORE_ID(server_cfg.scaler_core)) != pdPASS) {
+        vTaskDelete(capture_task_handle);
+        vTaskDelete(stream_task_handle);
+        capture_task_handle = NULL;
+        stream_task_handle = NULL;
+        scaler.task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(rtsp_server_task, "rtsp_server", server_cfg.stack_size, NULL, priority,
+                                &rtsp_task_handle, CORE_ID(server_cfg.server_core)) != pdPASS) {
+        if (scaler.task) {
+            vTaskDelete(scaler.task);
+            scaler.task = NULL;
+        }
+        vTaskDelete(capture_task_handle);
+        vTaskDelete(stream_task_handle);
+        capture_task_handle = NULL;
+        stream_task_handle = NULL;
+        rtsp_task_handle = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+static TaskHandle_t *const server_tasks[TASK_COUNT] = {
+    [TASK_SERVER] = &rtsp_task_handle,
+    [TASK_STREAM] = &stream_task_handle,
+    [TASK_SCALER] = &scaler.task,
+    [TASK_CAPTURE] = &capture_task_handle,
+};
+
+// Wait for the tasks in mask to see server_stopping and park, waking the
+// ones that sleep until there is work. Gives up after a while: a task that
+// is then deleted anyway keeps whatever it holds.
+static void server_tasks_wait(uint8_t mask)
+{
+    uint8_t left = 0;
+    for (int waited_ms = 0; waited_ms < SERVER_STOP_TIMEOUT_MS; waited_ms += 10) {
+        left = 0;
+        xSemaphoreTake(sessions_lock, portMAX_DELAY);
+        for (int i = 0; i < TASK_COUNT; i++) {
+            if ((mask & (1 << i)) && *server_tasks[i] && !(tasks_parked & (1 << i))) {
+                left |= 1 << i;
+                xTaskNotifyGive(*server_tasks[i]);
+            }
+        }
+        xSemaphoreGive(sessions_lock);
+        if (!left) {
+            return;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    ESP_LOGW(TAG, "Tasks %02x did not stop in time, deleting them", left);
+}
+
+// Buffers of the scaled mount, allocated as its frames came
+static void scaler_free(void)
+{
+    for (int i = 0; i < SCALER_BUFFERS; i++) {
+        free(scaler.out[i].buf);
+        scaler.out[i].buf = NULL;
+        scaler.out_size[i] = 0;
+    }
+    free(scaler.copy);
+    scaler.copy = NULL;
+    scaler.copy_size = 0;
+    jpeg_scaler_free(&scaler.js);
+}
+
+esp_err_t rtsp_mjpeg_server_stop(void)
+{
+    if (!rtsp_task_handle || server_stopping) return ESP_ERR_INVALID_STATE;
+    server_stopping = true;
+
+    // Transmit side first. Once it stands still, the sessions are closed and
+    // the frames it held go back to the driver, so a capture waiting for a
+    // free buffer gets one and the capture task sees the flag too.
+    server_tasks_wait((1 << TASK_SERVER) | (1 << TASK_STREAM) | (1 << TASK_SCALER));
+
+    xSemaphoreTake(sessions_lock, portMAX_DELAY);
+    for (int i = 0; i < RTSP_STREAM_SLOTS; i++) {
+        if (sessions[i].state != SESSION_FREE) {
+            session_close(&sessions[i]);
+        }
+    }
+    if (scaler.in) {
+        shared_frame_put(scaler.in);
+        scaler.in = NULL;
+    }
+    if (latest_frame) {
+        shared_frame_put(latest_frame);
+        latest_frame = NULL;
+    }
+    camera_fb_t *fb;
+    while (scaler.queue && xQueueReceive(scaler.queue, &fb, 0) == pdTRUE) {
+        frame_release(fb);
+    }
+    frame_queue_flush();
+    reconfig_queued = false;
+    xSemaphoreGive(sessions_lock);
+
+    server_tasks_wait(1 << TASK_CAPTURE);
+    for (int i = 0; i < TASK_COUNT; i++) {
+        if (*server_tasks[i]) {
+            vTaskDelete(*server_tasks[i]);
+            *server_tasks[i] = NULL;
+        }
+    }
+    tasks_parked = 0;
+    frame_queue_flush();  // a frame captured before the flag was seen
+    scaler_free();
+
+    if (rtsp_ctrl_sock >= 0) {
+        close(rtsp_ctrl_sock);
+        rtsp_ctrl_sock = -1;
+    }
+    if (http_listen_sock >= 0) {
+        close(http_listen_sock);
+        http_listen_sock = -1;
+    }
+    return ESP_OK;
+}
+
+esp_err_t rtsp_mjpeg_reconfigure(const rtsp_mjpeg_reconfig_t *rc)
+{
+    if (!rc || rc->quality < -1 || rc->quality > 63) return ESP_ERR_INVALID_ARG;
+    if (!rtsp_task_handle || server_stopping) return ESP_ERR_INVALID_STATE;
+    sensor_t *cam = esp_camera_sensor_get();
+    if (!cam) return ESP_ERR_INVALID_STATE;
+
+    if (rc->framesize != FRAMESIZE_INVALID) {
+        if (!cam->set_framesize) return ESP_ERR_NOT_SUPPORTED;
+        esp_err_t err = esp_camera_check_framesize(rc->framesize);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Can't switch to frame size %d: %s", rc->framesize, esp_err_to_name(err));
+            return err;
+        }
+    }
+    if (rc->quality >= 0 && !cam->set_quality) return ESP_ERR_NOT_SUPPORTED;
+
+    // Changes the stream task hasn't picked up yet add up, later ones win
+    xSemaphoreTake(sessions_lock, portMAX_DELAY);
+    if (!reconfig_queued) {
+        reconfig_pending = (rtsp_mjpeg_reconfig_t)RTSP_MJPEG_RECONFIG_KEEP();
+    }
+    if (rc->framesize != FRAMESIZE_INVALID) reconfig_pending.framesize = rc->framesize;
+    if (rc->quality >= 0) reconfig_pending.quality = rc->quality;
+    if (rc->fps) reconfig_pending.fps = rc->fps;
+    reconfig_queued = true;
+    if (stream_task_handle) {
+        xTaskNotifyGive(stream_task_handle);
+    }
+    xSemaphoreGive(sessions_lock);
+    return ESP_OK;
+}
+
+esp_err_t rtsp_mjpeg_get_pacing_stats(rtsp_mjpeg_pacing_stats_t *stats)
+{
+    if (!stats) return ESP_ERR_INVALID_ARG;
+    if (!sessions_lock) {
+        memset(stats, 0, sizeof(*stats));
+        return ESP_OK;
+    }
+    xSemaphoreTake(sessions_lock, portMAX_DELAY);
+    *stats = pacer.stats;
+    xSemaphoreGive(sessions_lock);
+    return ESP_OK;
+}
+
+esp_err_t rtsp_mjpeg_get_rtcp_stats(rtsp_mjpeg_rtcp_stats_t *stats, size_t max, size_t *count)
+{
+    if (!stats || !count) return ESP_ERR_INVALID_ARG;
+    *count = 0;
+    if (!sessions_lock) return ESP_OK;
+
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(sessions_lock, portMAX_DELAY);
+    for (int i = 0; i < RTSP_STREAM_SLOTS && *count < max; i++) {
+        const rtsp_session_t *s = &sessions[i];
+        if (s->state == SESSION_FREE || s->state == SESSION_INIT ||
+            s->transport == TRANSPORT_HTTP) continue;
+
+        rtsp_mjpeg_rtcp_stats_t *st = &stats[(*count)++];
+        memset(st, 0, sizeof(*st));
+        st->session_id = s->session_id;
+        strcpy(st->client_ip, s->client_ip);
+        st->ssrc = s->ssrc;
+        st->packets_sent = s->rtp_packets;
+        st->octets_sent = s->rtp_octets;
+        st->reports = s->rr_count;
+        if (s->rr_count) {
+            st->last_report_ms = (now - s->last_rr_us) / 1000;
+            st->loss_fraction = s->rr.fraction_lost / 256.0f;
+            st->cumulative_lost = s->rr.cumulative_lost;
+            st->highest_seq = s->rr.highest_seq;
+            st->jitter_us = (uint64_t)s->rr.jitter * 1000 / 90;  // 90 kHz clock
+            st->rtt_us = s->rtt_us;
+        }
+    }
+    xSemaphoreGive(sessions_lock);
+    return ESP_OK;
+}
+
+esp_err_t rtsp_mjpeg_get_metrics(rtsp_mjpeg_server_metrics_t *server,
+                                 rtsp_mjpeg_session_metrics_t *sessions, size_t max, size_t *count)
+{
+    if (sessions && !count) return ESP_ERR_INVALID_ARG;
+    if (!sessions_lock) {
+        if (server) memset(server, 0, sizeof(*server));
+        if (count) *count = 0;
+        return ESP_OK;
+    }
+    xSemaphoreTake(sessions_lock, portMAX_DELAY);
+    metrics_collect(server, sessions, max, count);
+    xSemaphoreGive(sessions_lock);
+    return ESP_OK;
+}
+
+esp_err_t rtsp_mjpeg_snapshot_get(rtsp_mjpeg_snapshot_t *snap)
+{
+    if (!snap) return ESP_ERR_INVALID_ARG;
+    if (!sessions_lock) return ESP_ERR_INVALID_STATE;
+
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(sessions_lock, portMAX_DELAY);
+    if (latest_frame) {
+        latest_frame->refs++;
+        snap->buf = latest_frame->fb->buf;
+        snap->len = latest_frame->fb->len;
+        snap->width = latest_frame->fb->width;
+        snap->height = latest_frame->fb->height;
+        snap->capture_us = shared_frame_capture_us(latest_frame);
+        snap->ref = latest_frame;
+        err = ESP_OK;
+    }
+    xSemaphoreGive(sessions_lock);
+    return err;
+}
+
+void rtsp_mjpeg_snapshot_release(rtsp_mjpeg_snapshot_t *snap)
+{
+    if (!snap || !snap->ref) return;
+    xSemaphoreTake(sessions_lock, portMAX_DELAY);
+    shared_frame_put(snap->ref);
+    xSemaphoreGive(sessions_lock);
+    snap->ref = NULL;
+    snap->buf = NULL;
+}
@@ -0,0 +1,186 @@
+// RTSP/1.0 (RFC 2326 §6) and HTTP/1.x request parsing, incremental and in place
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include "rtsp_msg.h"
+
+static const struct {
+    const char *name;
+    rtsp_method_t method;
+} methods[] = {
+    { "OPTIONS", RTSP_METHOD_OPTIONS },
+    { "DESCRIBE", RTSP_METHOD_DESCRIBE },
+    { "SETUP", RTSP_METHOD_SETUP },
+    { "PLAY", RTSP_METHOD_PLAY },
+    { "PAUSE", RTSP_METHOD_PAUSE },
+    { "TEARDOWN", RTSP_METHOD_TEARDOWN },
+    { "GET_PARAMETER", RTSP_METHOD_GET_PARAMETER },
+    { "SET_PARAMETER", RTSP_METHOD_SET_PARAMETER },
+    { "GET", RTSP_METHOD_GET },
+};
+
+void rtsp_parser_reset(rtsp_parser_t *p)
+{
+    memset(p, 0, sizeof(*p));
+}
+
+const char *rtsp_msg_header(const rtsp_msg_t *msg, const char *name)
+{
+    for (size_t i = 0; i < msg->header_count; i++) {
+        if (strcasecmp(msg->headers[i].name, name) == 0) {
+            return msg->headers[i].value;
+        }
+    }
+    return NULL;
+}
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+// Terminate the line starting at line (which ends with LF before end) and
+// return the start of the next one
+static char *split_line(char *line, char *end)
+{
+    char *nl = memchr(line, '\n', end - line);
+    char *next = nl + 1;
+    if (nl > line && nl[-1] == '\r') {
+        nl--;
+    }
+    *nl = '\0';
+    return next;
+}
+
+static esp_err_t parse_request_line(rtsp_msg_t *msg, char *line)
+{
+    char *uri = strchr(line, ' ');
+    if (!uri || uri == line) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *uri++ = '\0';
+    while (*uri == ' ') uri++;
+    char *version = strchr(uri, ' ');
+    if (!version || version == uri) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *version++ = '\0';
+    while (*version == ' ') version++;
+    if (strncmp(version, "RTSP/", 5) != 0 && strncmp(version, "HTTP/", 5) != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    msg->method_name = line;
+    msg->uri = uri;
+    msg->version = version;
+    msg->method = RTSP_METHOD_UNKNOWN;
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+        if (strcmp(line, methods[i].name) == 0) {
+            msg->method = methods[i].method;
+            break;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t parse_header(rtsp_msg_t *msg, char *line)
+{
+    char *colon = strchr(line, ':');
+    if (!colon || colon == line) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (msg->header_count == RTSP_MSG_MAX_HEADERS) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    char *name_end = colon;
+    while (name_end > line && is_space(name_end[-1])) name_end--;
+    *name_end = '\0';
+
+    char *value = colon + 1;
+    while (is_space(*value)) value++;
+    char *value_end = value + strlen(value);
+    while (value_end > value && is_space(value_end[-1])) value_end--;
+    *value_end = '\0';
+
+    msg->headers[msg->header_count].name = line;
+    msg->headers[msg->header_count].value = value;
+    msg->header_count++;
+    return ESP_OK;
+}
+
+// Split the complete header block in place
+static esp_err_t parse_headers(rtsp_parser_t *p, char *buf)
+{
+    rtsp_msg_t *msg = &p->msg;
+    char *line = buf + p->start;
+    char *end = buf + p->header_len;
+
+    // Obsolete line folding: a line starting with whitespace continues the
+    // previous header
+    for (char *c = line; c < end - 1; c++) {
+        if (*c == '\n' && is_space(c[1])) {
+            *c = ' ';
+            if (c[-1] == '\r') {
+                c[-1] = ' ';
+            }
+        }
+    }
+
+    char *next = split_line(line, end);
+    esp_err_t err = parse_request_line(msg, line);
+    while (err == ESP_OK) {
+        line = next;
+        next = split_line(line, end);
+        if (!*line) {
+            break;  // the blank line
+        }
+        err = parse_header(msg, line);
+    }
+    msg->len = p->header_len;
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    const char *cl = rtsp_msg_header(msg, "Content-Length");
+    if (cl) {
+        char *cl_end;
+        unsigned long n = strtoul(cl, &cl_end, 10);
+        if (cl_end == cl || *cl_end || *cl == '-') {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        msg->content_length = n;
+    }
+    msg->body = buf + p->header_len;
+    msg->len = p->header_len + msg->content_length;
+    if (msg->len < p->header_len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+esp_err_t rtsp_parser_run(rtsp_parser_t *p, char *buf, size_t len)
+{
+    while (!p->header_len) {
+        char *nl = memchr(buf + p->line_start, '\n', len - p->line_start);
+        if (!nl) {
+            return ESP_ERR_NOT_FINISHED;
+        }
+        size_t line_end = nl - buf;
+        bool blank = line_end == p->line_start ||
+                     (line_end == p->line_start + 1 && buf[p->line_start] == '\r');
+        if (!p->started && !blank) {
+            p->started = true;
+            p->start = p->line_start;
+        }
+        p->line_start = line_end + 1;
+        if (blank && p->started) {
+            p->header_len = p->line_start;
+            esp_err_t err = parse_headers(p, buf);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+    }
+    return len >= p->msg.len ? ESP_OK : ESP_ERR_NOT_FINISHED;
+}
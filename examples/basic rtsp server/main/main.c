@@ -83,7 +83,17 @@ void app_main(void)
     wifi_init_sta();
     esp_wifi_set_ps(WIFI_PS_NONE);
     ESP_ERROR_CHECK(init_camera());
-    esp_err_t rc = rtsp_mjpeg_server_start(8*1024, 5);
+    // rtsp://IP/ is the camera at full rate, rtsp://IP/preview the same at 5 fps,
+    // rtsp://IP/sub a quarter size copy at 10 fps scaled on the capture core
+    static const rtsp_mjpeg_mount_t mounts[] = {
+        { .path = "/" },
+        { .path = "/preview", .fps = 5 },
+        { .path = "/sub", .source = RTSP_MJPEG_SOURCE_SCALED, .scale = 4, .fps = 10 },
+    };
+    rtsp_mjpeg_config_t config = RTSP_MJPEG_DEFAULT_CONFIG();
+    config.mounts = mounts;
+    config.mount_count = sizeof(mounts) / sizeof(mounts[0]);
+    esp_err_t rc = rtsp_mjpeg_server_start_config(&config);
     if (rc != ESP_OK) {
         ESP_LOGE(TAG, "RTSP start failed: %s", esp_err_to_name(rc));
         return;